@@ -0,0 +1,231 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <malloc.h>
+#include <pthread.h>
+
+/*
+** Allocation accounting. malloc and friends are interposed here and
+** forward to glibc's own implementation; libc itself (strdup, getline,
+** opendir, ...) calls through these as well. The running total of bytes
+** asked for (shell_stats.bytes_allocated) is always kept, at the cost of
+** one relaxed add per call; live and peak bytes, which need the size of
+** every block freed too, are only tracked once alloc_accounting_enable()
+** was called.
+*/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static bool accounting = false;
+static int64_t live_bytes = 0;
+static int64_t peak_bytes = 0;
+
+// live bytes when the current line started, and its peak since then
+static int64_t line_start_bytes = 0;
+static int64_t line_peak_bytes = 0;
+
+// Blocks allocated since accounting was enabled, an open-addressed set
+// kept with libc's own allocator; only their frees are counted
+#define TRACKED_EMPTY 0
+#define TRACKED_GONE 1          // no block is at address 1
+#define TRACKED_MIN_SLOTS 4096
+
+static pthread_mutex_t tracked_lock = PTHREAD_MUTEX_INITIALIZER;
+static uintptr_t *tracked = NULL;
+static size_t tracked_slots = 0;
+static size_t tracked_used = 0;     // blocks and TRACKED_GONE slots
+
+
+static inline void count_allocated(size_t size){
+    // the completion builder thread allocates too
+    __atomic_add_fetch(&shell_stats.bytes_allocated, (uint64_t) size, __ATOMIC_RELAXED);
+}
+
+
+static inline void raise_to(int64_t *peak, int64_t live){
+    int64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (live > seen &&
+           !__atomic_compare_exchange_n(peak, &seen, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+static inline void account(int64_t delta){
+    int64_t live = __atomic_add_fetch(&live_bytes, delta, __ATOMIC_RELAXED);
+    if (delta > 0) {
+        raise_to(&line_peak_bytes, live);
+        raise_to(&peak_bytes, live);
+    }
+}
+
+
+static inline size_t tracked_slot(uintptr_t addr){
+    // blocks are 16-byte aligned, the low bits say nothing
+    return (size_t) ((addr >> 4) * 0x9E3779B97F4A7C15ULL) & (tracked_slots - 1);
+}
+
+
+static bool tracked_grow(void){
+    // twice the live blocks, and the TRACKED_GONE slots dropped
+    size_t slots = tracked_slots ? tracked_slots * 2 : TRACKED_MIN_SLOTS;
+    uintptr_t *old = tracked;
+    size_t old_slots = tracked_slots;
+    tracked = (uintptr_t *) __libc_calloc(slots, sizeof(uintptr_t));
+    if (tracked == NULL) {
+        tracked = old;
+        return false;
+    }
+    tracked_slots = slots;
+    tracked_used = 0;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old[i] > TRACKED_GONE) {
+            size_t slot = tracked_slot(old[i]);
+            while (tracked[slot] != TRACKED_EMPTY) {
+                slot = (slot + 1) & (tracked_slots - 1);
+            }
+            tracked[slot] = old[i];
+            tracked_used++;
+        }
+    }
+    __libc_free(old);
+    return true;
+}
+
+
+static bool track(void *ptr){
+    // a block that cannot be tracked is simply never counted
+    pthread_mutex_lock(&tracked_lock);
+    if ((tracked_used + 1) * 2 > tracked_slots && !tracked_grow()) {
+        pthread_mutex_unlock(&tracked_lock);
+        return false;
+    }
+    size_t slot = tracked_slot((uintptr_t) ptr);
+    while (tracked[slot] > TRACKED_GONE) {
+        slot = (slot + 1) & (tracked_slots - 1);
+    }
+    tracked_used += tracked[slot] == TRACKED_EMPTY;
+    tracked[slot] = (uintptr_t) ptr;
+    pthread_mutex_unlock(&tracked_lock);
+    return true;
+}
+
+
+static size_t untrack(void *ptr){
+    // the block's size if it was tracked, else 0
+    bool found = false;
+    pthread_mutex_lock(&tracked_lock);
+    if (tracked != NULL) {
+        size_t slot = tracked_slot((uintptr_t) ptr);
+        while (tracked[slot] != TRACKED_EMPTY && !found) {
+            found = tracked[slot] == (uintptr_t) ptr;
+            if (found) {
+                tracked[slot] = TRACKED_GONE;
+            }
+            slot = (slot + 1) & (tracked_slots - 1);
+        }
+    }
+    pthread_mutex_unlock(&tracked_lock);
+    return found ? malloc_usable_size(ptr) : 0;
+}
+
+
+void *malloc(size_t size){
+    void *ptr = __libc_malloc(size);
+    if (ptr != NULL) {
+        count_allocated(size);
+        if (accounting && track(ptr)) {
+            account(malloc_usable_size(ptr));
+        }
+    }
+    return ptr;
+}
+
+
+void *calloc(size_t nmemb, size_t size){
+    void *ptr = __libc_calloc(nmemb, size);
+    if (ptr != NULL) {
+        // no overflow, or calloc would have failed
+        count_allocated(nmemb * size);
+        if (accounting && track(ptr)) {
+            account(malloc_usable_size(ptr));
+        }
+    }
+    return ptr;
+}
+
+
+void *realloc(void *ptr, size_t size){
+    // only growth past the old block counts as newly asked for
+    size_t old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    if (!accounting) {
+        void *new_ptr = __libc_realloc(ptr, size);
+        if (new_ptr != NULL && size > old_size) {
+            count_allocated(size - old_size);
+        }
+        return new_ptr;
+    }
+
+    // a block from before accounting stays unknown to it when it moves
+    size_t tracked_size = ptr != NULL ? untrack(ptr) : 0;
+    bool was_tracked = ptr == NULL || tracked_size > 0;
+    void *new_ptr = __libc_realloc(ptr, size);
+    if (new_ptr != NULL && size > old_size) {
+        count_allocated(size - old_size);
+    }
+    if (new_ptr == NULL && size != 0) {
+        // failed, ptr is still there as it was
+        if (tracked_size > 0) {
+            track(ptr);
+        }
+        return NULL;
+    }
+    account(-(int64_t) tracked_size);
+    if (new_ptr != NULL && was_tracked && track(new_ptr)) {
+        account(malloc_usable_size(new_ptr));
+    }
+    return new_ptr;
+}
+
+
+void free(void *ptr){
+    if (accounting && ptr != NULL) {
+        account(-(int64_t) untrack(ptr));
+    }
+    __libc_free(ptr);
+}
+
+
+void alloc_accounting_enable(void){
+    // blocks from before this point are not known to us; only count
+    // what is allocated and freed from now on
+    accounting = true;
+}
+
+
+void alloc_line_begin(void){
+    if (!accounting) {
+        return;
+    }
+    line_start_bytes = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&line_peak_bytes, line_start_bytes, __ATOMIC_RELAXED);
+}
+
+
+void alloc_line_end(const char *source, long line_number){
+    if (!accounting) {
+        return;
+    }
+    int64_t live = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+    if (live > line_start_bytes) {
+        fprintf(stderr, ALLOC_GROWTH_FMT, source, line_number,
+                (long long) (live - line_start_bytes), (long long) live,
+                (long long) (line_peak_bytes - line_start_bytes),
+                (long long) peak_bytes);
+    }
+}
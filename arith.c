@@ -0,0 +1,261 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** Arithmetic expansion, $((expr)), evaluated in the shell: 64-bit signed
+** integers that wrap on overflow, with C's operators and precedence
+** (no assignments or ++/--). Numbers are decimal, 0x hex or 0 octal. A
+** bare name is the value of that variable, 0 if it is unset or empty.
+**
+** One recursive descent parser evaluates as it goes; the right side of
+** a short-circuited && or || or the unused arm of ?: is still parsed,
+** but with evaluation switched off, so a division by zero there is fine.
+*/
+typedef struct ArithParser {
+    const char *expr;       // the whole expression, for messages
+    const char *pos;
+    Variable *variables;
+    bool skip;              // parsing only, nothing is evaluated
+    bool failed;
+} ArithParser;
+
+// binary operators by precedence level, loosest first
+typedef enum ArithOp {
+    OP_NONE, OP_OR, OP_AND, OP_BOR, OP_BXOR, OP_BAND, OP_EQ, OP_NE,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_SHL, OP_SHR, OP_ADD, OP_SUB,
+    OP_MUL, OP_DIV, OP_MOD
+} ArithOp;
+
+#define ARITH_TERNARY_LEVEL 0
+#define ARITH_UNARY_LEVEL 11
+
+static int64_t parse_ternary(ArithParser *p);
+
+
+static void arith_error(ArithParser *p, const char *why){
+    if (!p->failed) {
+        ERR_PRINT(ERR_ARITH, p->expr, why);
+    }
+    p->failed = true;
+}
+
+
+static void skip_space(ArithParser *p){
+    while (isspace((unsigned char) *p->pos)) {
+        p->pos++;
+    }
+}
+
+
+static ArithOp peek_binary(ArithParser *p, int level, size_t *len){
+    /**
+     * The operator at p->pos if it binds at level (1 = ||, ... 10 = * / %),
+     * else OP_NONE. Longer operators are tried first, so '<' is not
+     * taken out of "<<" or "<=".
+    */
+    static const struct {const char *text; ArithOp op; int level;} ops[] = {
+        {"||", OP_OR, 1}, {"&&", OP_AND, 2}, {"==", OP_EQ, 6}, {"!=", OP_NE, 6},
+        {"<=", OP_LE, 7}, {">=", OP_GE, 7}, {"<<", OP_SHL, 8}, {">>", OP_SHR, 8},
+        {"|", OP_BOR, 3}, {"^", OP_BXOR, 4}, {"&", OP_BAND, 5}, {"<", OP_LT, 7},
+        {">", OP_GT, 7}, {"+", OP_ADD, 9}, {"-", OP_SUB, 9}, {"*", OP_MUL, 10},
+        {"/", OP_DIV, 10}, {"%", OP_MOD, 10},
+    };
+    skip_space(p);
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        size_t op_len = strlen(ops[i].text);
+        if (strncmp(p->pos, ops[i].text, op_len) == 0) {
+            if (ops[i].level != level) {
+                return OP_NONE;
+            }
+            *len = op_len;
+            return ops[i].op;
+        }
+    }
+    return OP_NONE;
+}
+
+
+static int64_t apply_binary(ArithParser *p, ArithOp op, int64_t a, int64_t b){
+    // + - * << go through uint64_t so that overflow wraps instead of being UB
+    switch (op) {
+    case OP_BOR: return a | b;
+    case OP_BXOR: return a ^ b;
+    case OP_BAND: return a & b;
+    case OP_EQ: return a == b;
+    case OP_NE: return a != b;
+    case OP_LT: return a < b;
+    case OP_LE: return a <= b;
+    case OP_GT: return a > b;
+    case OP_GE: return a >= b;
+    case OP_SHL: return (int64_t) ((uint64_t) a << (b & 63));
+    case OP_SHR: return a >> (b & 63);
+    case OP_ADD: return (int64_t) ((uint64_t) a + (uint64_t) b);
+    case OP_SUB: return (int64_t) ((uint64_t) a - (uint64_t) b);
+    case OP_MUL: return (int64_t) ((uint64_t) a * (uint64_t) b);
+    case OP_DIV:
+    case OP_MOD:
+        if (b == 0) {
+            arith_error(p, "division by zero");
+            return 0;
+        }
+        if (b == -1) {
+            // INT64_MIN / -1 traps
+            return op == OP_DIV ? (int64_t) (0 - (uint64_t) a) : 0;
+        }
+        return op == OP_DIV ? a / b : a % b;
+    default:
+        return 0;
+    }
+}
+
+
+static int64_t parse_variable(ArithParser *p){
+    const char *start = p->pos;
+    while (isalnum((unsigned char) *p->pos) || *p->pos == '_') {
+        p->pos++;
+    }
+    char name[p->pos - start + 1];
+    memcpy(name, start, p->pos - start);
+    name[p->pos - start] = '\0';
+
+    Variable *var = find_variable(p->variables, name);
+    if (p->skip || var == NULL || var->value[0] == '\0') {
+        return 0;
+    }
+    // the value has to be a number by itself
+    char *end;
+    errno = 0;
+    int64_t value = strtoll(var->value, &end, 0);
+    while (isspace((unsigned char) *end)) {
+        end++;
+    }
+    if (*end != '\0' || errno == ERANGE) {
+        arith_error(p, "variable is not a number");
+        return 0;
+    }
+    return value;
+}
+
+
+static int64_t parse_primary(ArithParser *p){
+    skip_space(p);
+    char c = *p->pos;
+    if (c == '(') {
+        p->pos++;
+        int64_t value = parse_ternary(p);
+        skip_space(p);
+        if (*p->pos != ')') {
+            arith_error(p, "missing ')'");
+            return 0;
+        }
+        p->pos++;
+        return value;
+    }
+    if (isdigit((unsigned char) c)) {
+        // wraps like the operators do; 0x and 0 prefixes as in C
+        char *end;
+        errno = 0;
+        uint64_t value = strtoull(p->pos, &end, 0);
+        if (errno == ERANGE || isalnum((unsigned char) *end) || *end == '_') {
+            arith_error(p, "bad number");
+            return 0;
+        }
+        p->pos = end;
+        return (int64_t) value;
+    }
+    if (isalpha((unsigned char) c) || c == '_') {
+        return parse_variable(p);
+    }
+    arith_error(p, c == '\0' ? "missing operand" : "unexpected character");
+    return 0;
+}
+
+
+static int64_t parse_unary(ArithParser *p){
+    skip_space(p);
+    char c = *p->pos;
+    if (c == '+' || c == '-' || c == '!' || c == '~') {
+        p->pos++;
+        int64_t value = parse_unary(p);
+        switch (c) {
+        case '-': return (int64_t) (0 - (uint64_t) value);
+        case '!': return !value;
+        case '~': return ~value;
+        default: return value;
+        }
+    }
+    return parse_primary(p);
+}
+
+
+static int64_t parse_binary(ArithParser *p, int level){
+    /**
+     * Left-associative operators from level up; || and && only evaluate
+     * their right side when it can change the result.
+    */
+    if (level == ARITH_UNARY_LEVEL) {
+        return parse_unary(p);
+    }
+    int64_t left = parse_binary(p, level + 1);
+    size_t len;
+    ArithOp op;
+    while (!p->failed && (op = peek_binary(p, level, &len)) != OP_NONE) {
+        p->pos += len;
+        bool was_skipping = p->skip;
+        if ((op == OP_OR && left) || (op == OP_AND && !left)) {
+            p->skip = true;
+        }
+        int64_t right = parse_binary(p, level + 1);
+        p->skip = was_skipping;
+        if (p->skip) {
+            continue;
+        }
+        if (op == OP_OR || op == OP_AND) {
+            left = op == OP_OR ? (left || right) : (left && right);
+        }
+        else {
+            left = apply_binary(p, op, left, right);
+        }
+    }
+    return left;
+}
+
+
+static int64_t parse_ternary(ArithParser *p){
+    int64_t cond = parse_binary(p, ARITH_TERNARY_LEVEL + 1);
+    skip_space(p);
+    if (p->failed || *p->pos != '?') {
+        return cond;
+    }
+    p->pos++;
+
+    bool was_skipping = p->skip;
+    p->skip = was_skipping || !cond;
+    int64_t then_value = parse_ternary(p);
+    skip_space(p);
+    if (*p->pos != ':') {
+        p->skip = was_skipping;
+        arith_error(p, "missing ':'");
+        return 0;
+    }
+    p->pos++;
+    p->skip = was_skipping || cond;
+    int64_t else_value = parse_ternary(p);
+    p->skip = was_skipping;
+    return cond ? then_value : else_value;
+}
+
+
+int eval_arith(const char *expr, Variable *variables, int64_t *result){
+    ArithParser p = {expr, expr, variables, false, false};
+    *result = parse_ternary(&p);
+    skip_space(&p);
+    if (!p.failed && *p.pos != '\0') {
+        arith_error(&p, *p.pos == ')' ? "unmatched ')'" : "unexpected character");
+    }
+    return p.failed ? -1 : 0;
+}
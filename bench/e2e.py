@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+"""
+End-to-end workload benchmark: runs the same script corpus under cscshell,
+/bin/sh and bash and reports wall time, CPU time, peak RSS and forks.
+
+Every script is written in the subset of shell syntax cscshell understands,
+so all shells do the same work. Results are appended to bench/results/ as
+one JSON file per run; the summary compares cscshell against the previous
+run so parser or executor regressions stand out.
+
+Usage: make bench-e2e
+       python3 bench/e2e.py [--shell ./cscshell] [--runs 10] [--only NAME]
+"""
+
+import argparse
+import datetime
+import hashlib
+import json
+import math
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+RESULTS_DIR = os.path.join(HERE, "results")
+
+# two-sided 95% t critical values by degrees of freedom
+T95 = {1: 12.706, 2: 4.303, 3: 3.182, 4: 2.776, 5: 2.571, 6: 2.447,
+       7: 2.365, 8: 2.306, 9: 2.262, 10: 2.228, 12: 2.179, 15: 2.131,
+       20: 2.086, 25: 2.060, 30: 2.042}
+
+
+def t95(dof):
+    if dof <= 0:
+        return float("nan")
+    for d in sorted(T95):
+        if dof <= d:
+            return T95[d]
+    return 1.960
+
+
+# --------------------------------------------------------------------------
+# Corpus. Each generator returns the script text; {tmp} is a scratch dir.
+# --------------------------------------------------------------------------
+
+def fork_heavy(tmp):
+    # the shape of a loop body: one short external command per line
+    lines = ["# fork-heavy: 400 short external commands"]
+    for i in range(400):
+        lines.append("true" if i % 2 else "echo %d > /dev/null" % i)
+    return "\n".join(lines) + "\n"
+
+
+def long_pipelines(tmp):
+    lines = ["# long pipelines: 6-8 stage pipelines over small inputs"]
+    for i in range(40):
+        lines.append("seq 1 2000 | sort -r | head -n 1500 | tail -n 1000 "
+                     "| grep 1 | sort -n | wc -l > /dev/null")
+    return "\n".join(lines) + "\n"
+
+
+def variable_heavy(tmp):
+    lines = ["# variable-heavy expansion"]
+    for i in range(300):
+        lines.append("V%s=value%d" % (chr(65 + i % 26) * (1 + i // 26), i))
+    for i in range(100):
+        names = [chr(65 + (i + k) % 26) for k in range(8)]
+        lines.append("X=" + "".join("${%s}" % n for n in names))
+        lines.append("echo $X " + " ".join("$V" + n for n in names)
+                     + " > /dev/null")
+    # the V* names above are VA, VB, ...; define the single letters too
+    header = ["%s=%s" % (chr(65 + k), chr(97 + k) * 16) for k in range(26)]
+    return "\n".join(header + lines) + "\n"
+
+
+def large_redirects(tmp):
+    big = os.path.join(tmp, "big.txt")
+    out = os.path.join(tmp, "out.txt")
+    lines = [
+        "# large redirects: ~7 MB written, copied and read back",
+        "seq 1 1000000 > %s" % big,
+        "cat %s > %s" % (big, out),
+        "cat %s >> %s" % (big, out),
+        "wc -l < %s" % out,
+        "sort -n %s > %s" % (big, out),
+        "wc -c < %s" % out,
+    ]
+    return "\n".join(lines) + "\n"
+
+
+CORPUS = {
+    "fork_heavy": fork_heavy,
+    "long_pipelines": long_pipelines,
+    "variable_heavy": variable_heavy,
+    "large_redirects": large_redirects,
+}
+
+
+# --------------------------------------------------------------------------
+# Measurement
+# --------------------------------------------------------------------------
+
+def run_once(measure, argv, cwd):
+    # bench/measure does the fork/exec/wait4 so RSS is the shell's own
+    result_path = os.path.join(cwd, "measure.json")
+    with tempfile.TemporaryFile() as out:
+        subprocess.run([measure, result_path] + argv, cwd=cwd, check=True,
+                       stdin=subprocess.DEVNULL, stdout=out,
+                       stderr=subprocess.STDOUT)
+        out.seek(0)
+        digest = hashlib.sha1(out.read()).hexdigest()
+    with open(result_path) as f:
+        result = json.load(f)
+    result["output"] = digest
+    return result
+
+
+def summarize(samples):
+    n = len(samples)
+    mean = statistics.fmean(samples)
+    stdev = statistics.stdev(samples) if n > 1 else 0.0
+    ci = t95(n - 1) * stdev / math.sqrt(n) if n > 1 else float("nan")
+    return {"mean": mean, "stdev": stdev, "ci95": ci,
+            "min": min(samples), "max": max(samples), "n": n}
+
+
+def shell_argv(shell, init, script):
+    if os.path.basename(shell).startswith("cscshell"):
+        return [shell, "-i", init, script]
+    return [shell, script]
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(
+            ["git", "rev-parse", "--short", "HEAD"], cwd=HERE,
+            stderr=subprocess.DEVNULL, text=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def previous_result():
+    if not os.path.isdir(RESULTS_DIR):
+        return None
+    runs = sorted(f for f in os.listdir(RESULTS_DIR) if f.endswith(".json"))
+    if not runs:
+        return None
+    with open(os.path.join(RESULTS_DIR, runs[-1])) as prev:
+        return json.load(prev)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("--shell", default=os.path.join(HERE, "..", "cscshell"))
+    parser.add_argument("--measure", default=os.path.join(HERE, "measure"))
+    parser.add_argument("--runs", type=int, default=10)
+    parser.add_argument("--warmup", type=int, default=1)
+    parser.add_argument("--only", action="append", choices=sorted(CORPUS))
+    parser.add_argument("--no-save", action="store_true")
+    args = parser.parse_args()
+
+    shells = {"cscshell": os.path.abspath(args.shell),
+              "sh": "/bin/sh", "bash": "/bin/bash"}
+    shells = {name: path for name, path in shells.items()
+              if os.access(path, os.X_OK)}
+    if "cscshell" not in shells:
+        sys.exit("cscshell binary not found at %s, run make first" % args.shell)
+    measure = os.path.abspath(args.measure)
+    if not os.access(measure, os.X_OK):
+        sys.exit("%s not found, run make bench-e2e" % args.measure)
+
+    names = args.only or sorted(CORPUS)
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="cscshell-bench-") as tmp:
+        init = os.path.join(tmp, "init")
+        with open(init, "w") as f:
+            f.write("PATH=%s\n" % os.environ.get("PATH", "/usr/bin:/bin"))
+
+        for name in names:
+            script = os.path.join(tmp, name + ".sh")
+            with open(script, "w") as f:
+                f.write(CORPUS[name](tmp))
+
+            results[name] = {}
+            outputs = {}
+            for shell, path in shells.items():
+                argv = shell_argv(path, init, script)
+                for _ in range(args.warmup):
+                    run_once(measure, argv, tmp)
+                runs = [run_once(measure, argv, tmp) for _ in range(args.runs)]
+                failed = [r["status"] for r in runs if r["status"] != 0]
+                if failed:
+                    print("warning: %s/%s exited with %s"
+                          % (name, shell, failed[0]), file=sys.stderr)
+                outputs[shell] = runs[-1]["output"]
+                results[name][shell] = {
+                    metric: summarize([r[metric] for r in runs])
+                    for metric in ("wall", "cpu", "maxrss_kb", "forks")
+                }
+            if len(set(outputs.values())) > 1:
+                print("warning: %s produced different output across shells: %s"
+                      % (name, outputs), file=sys.stderr)
+
+    previous = previous_result()
+    print("%-16s %-9s %18s %18s %10s %8s  %s" % (
+        "script", "shell", "wall ms (±95%)", "cpu ms (±95%)",
+        "rss KiB", "forks", "vs prev"))
+    for name in names:
+        for shell, metrics in results[name].items():
+            wall, cpu = metrics["wall"], metrics["cpu"]
+            delta = ""
+            if shell == "cscshell" and previous:
+                prev = previous.get("results", {}).get(name, {}).get(shell)
+                if prev:
+                    change = wall["mean"] / prev["wall"]["mean"] - 1
+                    noise = wall["ci95"] + prev["wall"]["ci95"]
+                    flag = " REGRESSION" if (
+                        wall["mean"] - prev["wall"]["mean"] > noise) else ""
+                    delta = "%+.1f%%%s" % (100 * change, flag)
+            print("%-16s %-9s %10.2f ±%6.2f %10.2f ±%6.2f %10.0f %8.1f  %s" % (
+                name, shell, 1e3 * wall["mean"], 1e3 * wall["ci95"],
+                1e3 * cpu["mean"], 1e3 * cpu["ci95"],
+                metrics["maxrss_kb"]["max"], metrics["forks"]["mean"], delta))
+
+    if not args.no_save:
+        os.makedirs(RESULTS_DIR, exist_ok=True)
+        stamp = datetime.datetime.now().strftime("%Y%m%dT%H%M%S")
+        record = {
+            "timestamp": stamp,
+            "revision": git_revision(),
+            "host": os.uname().nodename,
+            "runs": args.runs,
+            "shells": shells,
+            "results": results,
+        }
+        path = os.path.join(RESULTS_DIR, "e2e-%s.json" % stamp)
+        with open(path, "w") as f:
+            json.dump(record, f, indent=2, sort_keys=True)
+        print("saved %s" % os.path.relpath(path))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,93 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+/*
+** Runs one command and writes its wall time, CPU time, peak RSS and the
+** number of processes forked meanwhile to RESULT-FILE as JSON.
+**
+** This has to be a small exec'd program rather than part of the Python
+** driver: a child forked from the driver starts with the driver's RSS,
+** which would swamp the peak RSS of the shell being measured.
+**
+** Usage: measure RESULT-FILE COMMAND [ARG]...
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+
+static long long forks_since_boot(void){
+    // system-wide counter; meaningful on a quiet host
+    FILE *stat = fopen("/proc/stat", "r");
+    if (stat == NULL) {
+        return 0;
+    }
+    char line[256];
+    long long processes = 0;
+    while (fgets(line, sizeof(line), stat) != NULL) {
+        if (sscanf(line, "processes %lld", &processes) == 1) {
+            break;
+        }
+    }
+    fclose(stat);
+    return processes;
+}
+
+
+int main(int argc, char *argv[]){
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s RESULT-FILE COMMAND [ARG]...\n", argv[0]);
+        return 2;
+    }
+
+    long long forks_before = forks_since_boot();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 2;
+    }
+    if (pid == 0) {
+        execvp(argv[2], argv + 2);
+        perror("execvp");
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == -1) {
+        perror("wait4");
+        return 2;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long forks = forks_since_boot() - forks_before - 1;
+
+    FILE *result = fopen(argv[1], "w");
+    if (result == NULL) {
+        perror("fopen");
+        return 2;
+    }
+    fprintf(result,
+            "{\"wall\": %.9f, \"cpu\": %.6f, \"maxrss_kb\": %ld, "
+            "\"forks\": %lld, \"status\": %d}\n",
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+            usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+            usage.ru_maxrss, forks,
+            WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    fclose(result);
+    return 0;
+}
@@ -0,0 +1,371 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+
+static int builtin_cd(Command *command){
+    return cd_cscshell(command->args[1]);
+}
+
+
+static int builtin_export(Command *command){
+    if (command->variables == NULL) {
+        return -1;
+    }
+
+    // no arguments: list what children currently receive
+    if (command->args[1] == NULL) {
+        for (Variable *var = *command->variables; var != NULL; var = var->next) {
+            if (var->exported) {
+                dprintf(command->stdout_fd, "export %s=%s\n",
+                        var->name, var->value);
+            }
+        }
+        return 0;
+    }
+
+    for (int i = 1; command->args[i] != NULL; i++) {
+        char *arg = command->args[i];
+        char *eq = strchr(arg, '=');
+        size_t name_len = eq ? (size_t) (eq - arg) : strlen(arg);
+        if (name_len == 0) {
+            ERR_PRINT(ERR_VAR_START);
+            return -1;
+        }
+
+        char var_name[name_len + 1];
+        strncpy(var_name, arg, name_len);
+        var_name[name_len] = '\0';
+        for (size_t j = 0; j < name_len; j++) {
+            if (!isalpha((unsigned char) var_name[j]) && var_name[j] != '_') {
+                ERR_PRINT(ERR_VAR_NAME, var_name);
+                return -1;
+            }
+        }
+
+        Variable *var = find_variable(*command->variables, var_name);
+        if (eq != NULL || var == NULL) {
+            var = update_linked_list_variable(command->variables, var_name,
+                                              eq ? eq + 1 : "");
+            if (var == NULL) {
+                return -1;
+            }
+        }
+        var->exported = 1;
+        mark_environment_dirty();
+    }
+    return 0;
+}
+
+
+typedef struct ShellOption {
+    const char *name;
+    bool *value;
+} ShellOption;
+
+static const ShellOption options[] = {
+    {"errexit", &shell_state.errexit},
+    {"pipefail", &shell_state.pipefail},
+    {"cpuspread", &shell_state.cpuspread},
+    {NULL, NULL}
+};
+
+
+static bool *find_option(const char *name){
+    for (int i = 0; options[i].name != NULL; i++) {
+        if (strcmp(options[i].name, name) == 0) {
+            return options[i].value;
+        }
+    }
+    return NULL;
+}
+
+
+static int builtin_set(Command *command){
+    // set [-e|+e] [-o|+o NAME]...; '-' turns an option on, '+' off
+    if (command->args[1] == NULL) {
+        // no arguments: the variables, as they can be assigned back
+        for (Variable *var = *command->variables; var != NULL; var = var->next) {
+            dprintf(command->stdout_fd, "%s=%s\n", var->name, var->value);
+        }
+        return 0;
+    }
+
+    for (int i = 1; command->args[i] != NULL; i++) {
+        char *arg = command->args[i];
+        bool on = arg[0] == '-';
+        bool *option = NULL;
+        if ((arg[0] != '-' && arg[0] != '+') || arg[1] == '\0' || arg[2] != '\0') {
+            ERR_PRINT(ERR_SET_USAGE);
+            return -1;
+        }
+        if (arg[1] == 'e') {
+            option = &shell_state.errexit;
+        }
+        else if (arg[1] == 'o' && command->args[i + 1] == NULL) {
+            // set -o alone lists the options
+            for (int j = 0; options[j].name != NULL; j++) {
+                dprintf(command->stdout_fd, "%s\t%s\n", options[j].name,
+                        *options[j].value ? "on" : "off");
+            }
+            continue;
+        }
+        else if (arg[1] == 'o') {
+            option = find_option(command->args[++i]);
+        }
+        if (option == NULL) {
+            ERR_PRINT(ERR_SET_USAGE);
+            return -1;
+        }
+        *option = on;
+    }
+    return 0;
+}
+
+
+static int builtin_read(Command *command){
+    /**
+     * read [-r] [NAME]...: one line from stdin, split on blanks into the
+     * names in turn, the last taking the rest; REPLY with no names.
+     * Backslashes are not special, as with -r. Fails at end of input,
+     * after assigning any unterminated last line.
+    */
+    char **names = command->args + 1;
+    if (names[0] != NULL && strcmp(names[0], "-r") == 0) {
+        names++;
+    }
+    for (int i = 0; names[i] != NULL; i++) {
+        for (const char *c = names[i]; *c != '\0'; c++) {
+            if (!isalpha((unsigned char) *c) && *c != '_') {
+                ERR_PRINT(ERR_VAR_NAME, names[i]);
+                return -1;
+            }
+        }
+    }
+    char *reply[] = {READ_DEFAULT_VAR, NULL};
+    if (names[0] == NULL) {
+        names = reply;
+    }
+
+    const char *line;
+    size_t len;
+    int ret = read_fd_line(command->stdin_fd, &line, &len);
+    if (ret == -1 || (ret == 0 && len == 0)) {
+        return -1;
+    }
+
+    // the value of each name is a slice of the line
+    size_t pos = 0;
+    for (int i = 0; names[i] != NULL; i++) {
+        while (pos < len && (line[pos] == ' ' || line[pos] == '\t')) {
+            pos++;
+        }
+        size_t end = pos;
+        if (names[i + 1] != NULL) {
+            while (end < len && line[end] != ' ' && line[end] != '\t') {
+                end++;
+            }
+        }
+        else {
+            end = len;
+            while (end > pos && (line[end - 1] == ' ' || line[end - 1] == '\t')) {
+                end--;
+            }
+        }
+        char value[end - pos + 1];
+        memcpy(value, line + pos, end - pos);
+        value[end - pos] = '\0';
+        if (update_linked_list_variable(command->variables, names[i], value) == NULL) {
+            return -1;
+        }
+        pos = end;
+    }
+    return ret == 1 ? 0 : -1;
+}
+
+
+static int builtin_test(Command *command){
+    // test EXPR and [ EXPR ]: the status is the answer
+    bool brackets = strcmp(command->args[0], TEST_BRACKET) == 0;
+    return eval_test(command->args + 1, brackets);
+}
+
+
+static int builtin_local(Command *command){
+    // local NAME[=VALUE]...: set until the function returns
+    if (!in_function() || command->variables == NULL) {
+        ERR_PRINT(ERR_LOCAL_USAGE);
+        return -1;
+    }
+    for (int i = 1; command->args[i] != NULL; i++) {
+        char *arg = command->args[i];
+        char *eq = strchr(arg, '=');
+        size_t name_len = eq ? (size_t) (eq - arg) : strlen(arg);
+        char var_name[name_len + 1];
+        memcpy(var_name, arg, name_len);
+        var_name[name_len] = '\0';
+        if (name_len == 0) {
+            ERR_PRINT(ERR_VAR_START);
+            return -1;
+        }
+        for (size_t j = 0; j < name_len; j++) {
+            if (!isalpha((unsigned char) var_name[j]) && var_name[j] != '_') {
+                ERR_PRINT(ERR_VAR_NAME, var_name);
+                return -1;
+            }
+        }
+        if (declare_local(command->variables, var_name, eq ? eq + 1 : NULL) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int builtin_return(Command *command){
+    // return [N]: N, or the last status, as the function's status
+    char *arg = command->args[1];
+    long status = shell_state.last_status;
+    if (arg != NULL) {
+        char *end = NULL;
+        status = strtol(arg, &end, 10);
+        if (end == arg || *end != '\0' || status < 0 || status > 255) {
+            ERR_PRINT(ERR_RETURN_USAGE);
+            return -1;
+        }
+    }
+    if (!in_function() || (arg != NULL && command->args[2] != NULL)) {
+        ERR_PRINT(ERR_RETURN_USAGE);
+        return -1;
+    }
+    shell_state.returning = true;
+    return (int) status;
+}
+
+
+static int builtin_exec(Command *command){
+    /**
+     * exec CMD [ARG]...: CMD replaces the shell, with the redirections of
+     * the exec. exec alone keeps them for the shell from now on.
+    */
+    if (command->args[1] == NULL) {
+        fflush(stdout);
+        if ((command->stdin_fd != STDIN_FILENO &&
+             dup2(command->stdin_fd, STDIN_FILENO) == -1) ||
+            (command->stdout_fd != STDOUT_FILENO &&
+             dup2(command->stdout_fd, STDOUT_FILENO) == -1)) {
+            perror("dup2");
+            return -1;
+        }
+        return 0;
+    }
+    if (find_builtin(command->args[1]) != NULL || find_function(command->args[1]) != NULL) {
+        ERR_PRINT(ERR_EXEC_USAGE);
+        return -1;
+    }
+
+    Command *target = command_from_words(command->args + 1, command->variables);
+    char **envp = environ;
+    if (target != NULL && command->variables != NULL) {
+        envp = exported_environment(*command->variables);
+    }
+    if (target == NULL || envp == NULL) {
+        free_command(target);
+        return STATUS_NOT_FOUND;
+    }
+    target->stdin_fd = command->stdin_fd;
+    target->stdout_fd = command->stdout_fd;
+    target->sched = command->sched;
+    command->sched = NULL;
+    fflush(stdout);
+    fflush(stderr);
+    shell_stats.execs++;
+    exec_command(target, envp);
+    return -1;
+}
+
+
+static int builtin_pmap(Command *command){
+    // pmap [-g] [-j N] cmd ...: N defaults to the CPUs the shell may use
+    char **words = command->args + 1;
+    int num_jobs = 0;
+    bool grep_status = false;
+    while (words[0] != NULL && words[0][0] == '-') {
+        if (strcmp(words[0], "-g") == 0) {
+            grep_status = true;
+            words++;
+            continue;
+        }
+        char *end = NULL;
+        long jobs = 0;
+        if (strcmp(words[0], "-j") == 0 && words[1] != NULL) {
+            jobs = strtol(words[1], &end, 10);
+        }
+        if (end == NULL || end == words[1] || *end != '\0' || jobs < 1 ||
+            jobs > PMAP_MAX_JOBS) {
+            ERR_PRINT(ERR_PMAP_USAGE);
+            return -1;
+        }
+        num_jobs = (int) jobs;
+        words += 2;
+    }
+    if (words[0] == NULL) {
+        ERR_PRINT(ERR_PMAP_USAGE);
+        return -1;
+    }
+    if (num_jobs == 0) {
+        cpu_set_t allowed;
+        num_jobs = sched_getaffinity(0, sizeof(allowed), &allowed) == 0 ?
+            CPU_COUNT(&allowed) : 1;
+    }
+    return run_pmap(command, num_jobs, grep_status, words);
+}
+
+
+static int builtin_stats(Command *command){
+    // stats [-j|--json]
+    char *format = command->args[1];
+    bool json = format != NULL &&
+        (strcmp(format, "-j") == 0 || strcmp(format, "--json") == 0);
+    if (format != NULL && !json) {
+        ERR_PRINT(ERR_STATS_USAGE);
+        return -1;
+    }
+    return write_stats(command->stdout_fd, json);
+}
+
+
+static const Builtin builtins[] = {
+    {CD, builtin_cd},
+    {EXPORT, builtin_export},
+    {STATS, builtin_stats},
+    {SET, builtin_set},
+    {READ, builtin_read},
+    {TEST, builtin_test},
+    {TEST_BRACKET, builtin_test},
+    {PMAP, builtin_pmap},
+    {LOCAL, builtin_local},
+    {RETURN, builtin_return},
+    {EXEC, builtin_exec},
+    {NULL, NULL}
+};
+
+
+void for_each_builtin(void (*visit)(const char *name, void *arg), void *arg){
+    for (int i = 0; builtins[i].name != NULL; i++) {
+        visit(builtins[i].name, arg);
+    }
+}
+
+
+builtin_fn find_builtin(const char *name){
+    for (int i = 0; builtins[i].name != NULL; i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return builtins[i].fn;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,382 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <pthread.h>
+
+/*
+** Prefix trie of command names. Children are kept in a sorted sibling
+** list, which stays small for real PATHs and keeps listings in order.
+*/
+typedef struct TrieNode {
+    char key;
+    bool terminal;              // a command name ends here
+    uint32_t count;             // command names in this subtree
+    struct TrieNode *child;
+    struct TrieNode *sibling;
+} TrieNode;
+
+typedef struct CommandTrie {
+    TrieNode root;
+    char *path_value;           // PATH this trie is (being) built for
+    pthread_t builder;
+    bool building;
+    volatile bool cancel;
+} CommandTrie;
+
+// Interactive completion only ever reads; the builder thread inserts.
+static pthread_mutex_t trie_lock = PTHREAD_MUTEX_INITIALIZER;
+static CommandTrie *command_trie = NULL;
+
+// Stage prefixes, which are neither builtins nor on PATH
+static const char *shell_prefixes[] = {TIMEOUT, SCHED, NULL};
+
+// What complete_command needs to add the functions' names
+typedef struct FunctionMatch {
+    const char *prefix;
+    size_t len;
+    Completion *comp;
+} FunctionMatch;
+
+
+static void trie_free_nodes(TrieNode *node){
+    // siblings iteratively, children recursively (bounded by name length)
+    while (node != NULL) {
+        TrieNode *next = node->sibling;
+        trie_free_nodes(node->child);
+        free(node);
+        node = next;
+    }
+}
+
+
+static int trie_insert(TrieNode *root, const char *name){
+    // names come from d_name, so the path down is at most NAME_MAX long
+    TrieNode *path[NAME_MAX + 2];
+    size_t depth = 0;
+    TrieNode *node = root;
+    path[depth++] = node;
+    for (const char *c = name; *c != '\0' && depth <= NAME_MAX; c++) {
+        TrieNode **link = &node->child;
+        while (*link != NULL && (*link)->key < *c) {
+            link = &(*link)->sibling;
+        }
+        if (*link == NULL || (*link)->key != *c) {
+            TrieNode *added = (TrieNode *) calloc(1, sizeof(TrieNode));
+            if (added == NULL) {
+                return -1;
+            }
+            added->key = *c;
+            added->sibling = *link;
+            *link = added;
+        }
+        node = *link;
+        path[depth++] = node;
+    }
+    if (!node->terminal) {
+        // same name in a later PATH directory: nothing new to count
+        node->terminal = true;
+        while (depth > 0) {
+            path[--depth]->count++;
+        }
+    }
+    return 0;
+}
+
+
+static void trie_insert_name(const char *name, void *root){
+    trie_insert((TrieNode *) root, name);
+}
+
+
+static TrieNode *trie_find(TrieNode *root, const char *prefix, size_t len){
+    TrieNode *node = root;
+    for (size_t i = 0; i < len && node != NULL; i++) {
+        TrieNode *child = node->child;
+        while (child != NULL && child->key < prefix[i]) {
+            child = child->sibling;
+        }
+        node = (child != NULL && child->key == prefix[i]) ? child : NULL;
+    }
+    return node;
+}
+
+
+static void *build_trie(void *arg){
+    CommandTrie *trie = (CommandTrie *) arg;
+
+    // builtins[] is constant, so the builder may walk it too
+    pthread_mutex_lock(&trie_lock);
+    for_each_builtin(trie_insert_name, &trie->root);
+    for (int i = 0; shell_prefixes[i] != NULL; i++) {
+        trie_insert(&trie->root, shell_prefixes[i]);
+    }
+    pthread_mutex_unlock(&trie_lock);
+
+    // Same directories resolve_executable scans, one at a time, so that
+    // completion can use whatever has been inserted so far
+    char *path_to_toke = strdup(trie->path_value);
+    if (path_to_toke == NULL) {
+        return NULL;
+    }
+    char *saveptr;
+    for (char *dir_name = strtok_r(path_to_toke, ":", &saveptr);
+         dir_name != NULL && !trie->cancel;
+         dir_name = strtok_r(NULL, ":", &saveptr)) {
+        DIR *dir = opendir(dir_name);
+        if (dir == NULL) {
+            continue;
+        }
+        struct dirent *entry;
+        while (!trie->cancel && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            pthread_mutex_lock(&trie_lock);
+            trie_insert(&trie->root, entry->d_name);
+            pthread_mutex_unlock(&trie_lock);
+        }
+        closedir(dir);
+    }
+    free(path_to_toke);
+    return NULL;
+}
+
+
+static void discard_trie(CommandTrie *trie){
+    if (trie == NULL) {
+        return;
+    }
+    if (trie->building) {
+        trie->cancel = true;
+        pthread_join(trie->builder, NULL);
+    }
+    trie_free_nodes(trie->root.child);
+    free(trie->path_value);
+    free(trie);
+}
+
+
+void refresh_completion(const char *path_value){
+    if (path_value == NULL) {
+        path_value = "";
+    }
+    if (command_trie != NULL && strcmp(command_trie->path_value, path_value) == 0) {
+        return;
+    }
+
+    CommandTrie *trie = (CommandTrie *) calloc(1, sizeof(CommandTrie));
+    if (trie == NULL) {
+        return;
+    }
+    trie->path_value = strdup(path_value);
+    if (trie->path_value == NULL) {
+        free(trie);
+        return;
+    }
+
+    // the old trie's builder only ever touches the old trie
+    CommandTrie *old = command_trie;
+    pthread_mutex_lock(&trie_lock);
+    command_trie = trie;
+    pthread_mutex_unlock(&trie_lock);
+    discard_trie(old);
+
+    trie->building = pthread_create(&trie->builder, NULL, build_trie, trie) == 0;
+    if (!trie->building) {
+        // no thread: build it right here
+        build_trie(trie);
+    }
+}
+
+
+void free_completion(void){
+    discard_trie(command_trie);
+    command_trie = NULL;
+}
+
+
+static void add_match(Completion *comp, const char *word, size_t len, bool is_dir){
+    if (comp->num_matches < MAX_COMPLETIONS) {
+        char *match = (char *) malloc(len + 2);
+        if (match == NULL) {
+            return;
+        }
+        memcpy(match, word, len);
+        match[len] = is_dir ? '/' : '\0';
+        match[len + is_dir] = '\0';
+        comp->matches[comp->num_matches++] = match;
+    }
+    comp->total_matches++;
+
+    // shrink the extension to what this match shares with the others
+    if (comp->total_matches == 1) {
+        comp->common_len = len + is_dir;
+        memcpy(comp->common, word, len < MAX_SINGLE_LINE ? len : MAX_SINGLE_LINE - 1);
+        if (is_dir && len + 1 < MAX_SINGLE_LINE) {
+            comp->common[len] = '/';
+        }
+    }
+    else {
+        size_t i = 0;
+        while (i < comp->common_len && i < len && comp->common[i] == word[i]) {
+            i++;
+        }
+        comp->common_len = i;
+    }
+}
+
+
+static void collect_commands(TrieNode *node, char *name, size_t len, Completion *comp){
+    if (node->terminal) {
+        add_match(comp, name, len, false);
+    }
+    for (TrieNode *child = node->child; child != NULL; child = child->sibling) {
+        if (len + 1 >= MAX_SINGLE_LINE || comp->num_matches == MAX_COMPLETIONS) {
+            break;
+        }
+        name[len] = child->key;
+        collect_commands(child, name, len + 1, comp);
+    }
+}
+
+
+static void add_function_match(const char *name, void *arg){
+    // functions come and go, so they are looked at here rather than in
+    // the trie; one that shadows a PATH name is already listed
+    FunctionMatch *match = (FunctionMatch *) arg;
+    size_t name_len = strlen(name);
+    if (strncmp(name, match->prefix, match->len) != 0 || name_len >= MAX_SINGLE_LINE) {
+        return;
+    }
+    TrieNode *node = command_trie != NULL ?
+        trie_find(&command_trie->root, name, name_len) : NULL;
+    if (node == NULL || !node->terminal) {
+        add_match(match->comp, name, name_len, false);
+    }
+}
+
+
+static void complete_command(const char *prefix, size_t len, Completion *comp){
+    pthread_mutex_lock(&trie_lock);
+    if (command_trie != NULL) {
+        TrieNode *node = trie_find(&command_trie->root, prefix, len);
+        if (node != NULL) {
+            char name[MAX_SINGLE_LINE];
+            memcpy(name, prefix, len);
+            collect_commands(node, name, len, comp);
+
+            // Only the listed names were visited; the subtree counts give
+            // the total, and the shared extension is the chain of single
+            // children below the prefix
+            comp->total_matches = node->count;
+            memcpy(comp->common, prefix, len);
+            comp->common_len = len;
+            while (!node->terminal && node->child != NULL &&
+                   node->child->sibling == NULL &&
+                   comp->common_len + 1 < MAX_SINGLE_LINE) {
+                node = node->child;
+                comp->common[comp->common_len++] = node->key;
+            }
+        }
+    }
+    FunctionMatch match = {prefix, len, comp};
+    for_each_function(add_function_match, &match);
+    pthread_mutex_unlock(&trie_lock);
+}
+
+
+static void complete_file(const char *word, size_t len, Completion *comp){
+    // split into the directory to list and the prefix of the entry
+    const char *slash = memrchr(word, '/', len);
+    char dir_name[MAX_PATH_STR];
+    const char *base = word;
+    if (slash == NULL) {
+        strcpy(dir_name, ".");
+    }
+    else {
+        size_t dir_len = slash - word;
+        if (dir_len + 2 > sizeof(dir_name)) {
+            return;
+        }
+        memcpy(dir_name, word, dir_len + 1);
+        dir_name[dir_len + 1] = '\0';
+        base = slash + 1;
+    }
+    size_t base_len = len - (base - word);
+
+    DIR *dir = opendir(dir_name);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char match[MAX_SINGLE_LINE];
+    size_t dir_part = base - word;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, base, base_len) != 0 ||
+            strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            (entry->d_name[0] == '.' && base_len == 0)) {
+            continue;
+        }
+        size_t name_len = strlen(entry->d_name);
+        if (dir_part + name_len + 2 > sizeof(match)) {
+            continue;
+        }
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st;
+            is_dir = fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 &&
+                S_ISDIR(st.st_mode);
+        }
+        // matches keep the directory part the user typed
+        memcpy(match, word, dir_part);
+        memcpy(match + dir_part, entry->d_name, name_len);
+        add_match(comp, match, dir_part + name_len, is_dir);
+    }
+    closedir(dir);
+}
+
+
+static int compare_strings(const void *a, const void *b){
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+
+int complete_word(const char *line, size_t word_start, size_t word_end,
+                  Completion *comp){
+    comp->num_matches = 0;
+    comp->total_matches = 0;
+    comp->common_len = 0;
+
+    // a word in command position is the first one, or the first after
+    // '|', ';', '&&' or '||'; unless it is already a path, that means a
+    // command name
+    size_t i = word_start;
+    while (i > 0 && isspace((unsigned char) line[i - 1])) {
+        i--;
+    }
+    bool command_position = i == 0 || line[i - 1] == '|' || line[i - 1] == ';' ||
+        (i >= 2 && line[i - 1] == '&' && line[i - 2] == '&');
+    const char *word = line + word_start;
+    size_t len = word_end - word_start;
+
+    if (command_position && memchr(word, '/', len) == NULL) {
+        complete_command(word, len, comp);
+    }
+    else {
+        complete_file(word, len, comp);
+    }
+    qsort(comp->matches, comp->num_matches, sizeof(char *), compare_strings);
+    return comp->total_matches;
+}
+
+
+void free_completion_matches(Completion *comp){
+    for (size_t i = 0; i < comp->num_matches; i++) {
+        free(comp->matches[i]);
+    }
+    comp->num_matches = 0;
+}
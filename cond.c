@@ -0,0 +1,231 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** `test EXPR` and `[ EXPR ]`, evaluated in the shell.
+**
+**   -e -f -d -s -L -h -p -S -b -c -u -g -k -r -w -x FILE
+**   -z STR, -n STR, STR, STR = STR, STR != STR
+**   N -eq -ne -lt -le -gt -ge N
+**   FILE -nt -ot -ef FILE
+**   ! EXPR, EXPR -a EXPR, EXPR -o EXPR, ( EXPR )
+**
+** File tests are one fstatat (or faccessat for -r -w -x) each. A lone
+** word is true when it is not empty, so `[ -n ]` is true as in sh.
+*/
+typedef struct TestParser {
+    char **args;
+    int argc;
+    int pos;
+    bool failed;
+} TestParser;
+
+static bool test_or(TestParser *p);
+
+
+static void test_error(TestParser *p, const char *what, const char *arg){
+    if (!p->failed) {
+        ERR_PRINT(ERR_TEST, what, arg != NULL ? arg : "");
+    }
+    p->failed = true;
+}
+
+
+static bool file_test(char op, const char *path){
+    struct stat st;
+    if (op == 'r' || op == 'w' || op == 'x') {
+        int mode = op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK;
+        return faccessat(AT_FDCWD, path, mode, AT_EACCESS) == 0;
+    }
+    int flags = op == 'L' || op == 'h' ? AT_SYMLINK_NOFOLLOW : 0;
+    if (fstatat(AT_FDCWD, path, &st, flags) == -1) {
+        return false;
+    }
+    switch (op) {
+    case 'e': return true;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'L':
+    case 'h': return S_ISLNK(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'k': return (st.st_mode & S_ISVTX) != 0;
+    default: return false;
+    }
+}
+
+
+static bool is_unary(const char *arg){
+    return arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0' &&
+        strchr("efdsLhpSbcugkrwxzn", arg[1]) != NULL;
+}
+
+
+static bool is_binary(const char *arg){
+    static const char *const ops[] = {
+        "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef", NULL
+    };
+    for (int i = 0; ops[i] != NULL; i++) {
+        if (strcmp(arg, ops[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool parse_integer(TestParser *p, const char *arg, long long *value){
+    char *end;
+    errno = 0;
+    *value = strtoll(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno == ERANGE) {
+        test_error(p, "integer expected: ", arg);
+        return false;
+    }
+    return true;
+}
+
+
+static bool binary_test(TestParser *p, const char *left, const char *op, const char *right){
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+        return strcmp(left, right) == 0;
+    }
+    if (strcmp(op, "!=") == 0) {
+        return strcmp(left, right) != 0;
+    }
+    if (op[1] == 'n' || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')) {
+        // -nt -ot -ef: a file that does not exist is older than any other
+        struct stat a, b;
+        bool has_a = stat(left, &a) == 0;
+        bool has_b = stat(right, &b) == 0;
+        if (op[1] == 'e') {
+            return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+        }
+        if (!has_a || !has_b) {
+            return op[1] == 'n' ? has_a : has_b;
+        }
+        struct timespec *newer = op[1] == 'n' ? &a.st_mtim : &b.st_mtim;
+        struct timespec *older = op[1] == 'n' ? &b.st_mtim : &a.st_mtim;
+        return newer->tv_sec > older->tv_sec ||
+            (newer->tv_sec == older->tv_sec && newer->tv_nsec > older->tv_nsec);
+    }
+
+    long long a, b;
+    if (!parse_integer(p, left, &a) || !parse_integer(p, right, &b)) {
+        return false;
+    }
+    if (strcmp(op, "-eq") == 0) return a == b;
+    if (strcmp(op, "-ne") == 0) return a != b;
+    if (strcmp(op, "-lt") == 0) return a < b;
+    if (strcmp(op, "-le") == 0) return a <= b;
+    if (strcmp(op, "-gt") == 0) return a > b;
+    return a >= b;
+}
+
+
+static bool test_primary(TestParser *p){
+    int left = p->argc - p->pos;
+    if (left <= 0) {
+        test_error(p, "argument expected", NULL);
+        return false;
+    }
+    char **arg = p->args + p->pos;
+
+    // a binary operator in second place wins, so `[ -f = -f ]` compares
+    if (left >= 3 && is_binary(arg[1])) {
+        p->pos += 3;
+        return binary_test(p, arg[0], arg[1], arg[2]);
+    }
+    if (strcmp(arg[0], "(") == 0 && left >= 2) {
+        p->pos++;
+        bool value = test_or(p);
+        if (p->pos >= p->argc || strcmp(p->args[p->pos], ")") != 0) {
+            test_error(p, "missing ')'", NULL);
+            return false;
+        }
+        p->pos++;
+        return value;
+    }
+    if (is_unary(arg[0]) && left >= 2) {
+        p->pos += 2;
+        if (arg[0][1] == 'z') {
+            return arg[1][0] == '\0';
+        }
+        if (arg[0][1] == 'n') {
+            return arg[1][0] != '\0';
+        }
+        return file_test(arg[0][1], arg[1]);
+    }
+    p->pos++;
+    return arg[0][0] != '\0';
+}
+
+
+static bool test_not(TestParser *p){
+    if (p->pos < p->argc - 1 && strcmp(p->args[p->pos], "!") == 0) {
+        p->pos++;
+        return !test_not(p);
+    }
+    return test_primary(p);
+}
+
+
+static bool test_and(TestParser *p){
+    bool value = test_not(p);
+    while (!p->failed && p->pos < p->argc && strcmp(p->args[p->pos], "-a") == 0) {
+        p->pos++;
+        // both sides are parsed either way; nothing here has side effects
+        bool right = test_not(p);
+        value = value && right;
+    }
+    return value;
+}
+
+
+static bool test_or(TestParser *p){
+    bool value = test_and(p);
+    while (!p->failed && p->pos < p->argc && strcmp(p->args[p->pos], "-o") == 0) {
+        p->pos++;
+        bool right = test_and(p);
+        value = value || right;
+    }
+    return value;
+}
+
+
+int eval_test(char **args, bool brackets){
+    int argc = 0;
+    while (args[argc] != NULL) {
+        argc++;
+    }
+    if (brackets) {
+        if (argc == 0 || strcmp(args[argc - 1], "]") != 0) {
+            ERR_PRINT(ERR_TEST, "missing ']'", "");
+            return STATUS_SYNTAX;
+        }
+        argc--;
+    }
+
+    TestParser p = {args, argc, 0, false};
+    if (argc == 0) {
+        return 1;
+    }
+    bool value = test_or(&p);
+    if (!p.failed && p.pos < argc) {
+        test_error(&p, "unexpected argument: ", args[p.pos]);
+    }
+    if (p.failed) {
+        return STATUS_SYNTAX;
+    }
+    return value ? 0 : 1;
+}
@@ -12,6 +12,13 @@ void print_help(){
     printf("Options:\n");
     printf("  -h, --help\t\t\tDisplay this help message\n");
     printf("  -i, --init-file=FILE\t\tUse a specific init file. Default is ~/.cscshell_init\n");
+    printf("  -m, --alloc-report\t\tReport heap growth across each line to stderr\n");
+    printf("  -c COMMAND\t\t\tRun the lines of COMMAND instead of a script\n");
+    printf("      --incremental[=FILE]\tSkip script lines whose output files are up to date,\n");
+    printf("\t\t\t\tkeeping state in FILE (default SCRIPT" MEMO_STATE_SUFFIX ")\n");
+    printf("      --server SOCKET\t\tRun the init file once, then serve requests on SOCKET\n");
+    printf("      --client SOCKET [-c COMMAND | SCRIPT] [ARG]...\n");
+    printf("\t\t\t\tHave the server on SOCKET run COMMAND or SCRIPT\n");
     printf("If no script file is given, cscshell will run in interactive mode\n");
 }
 
@@ -29,8 +36,10 @@ char *prompt(char *line, size_t line_length){
         return (char *) -1;
     }
 
-    printf("%s@<%s> %s", user_buff, cwd_buff, PROMPT_STR);
-    return fgets(line, line_length, stdin);
+    char prompt_buff[MAX_PATH_STR + MAX_USER_BUF + 8];
+    snprintf(prompt_buff, sizeof(prompt_buff), "%s@<%s> %s",
+             user_buff, cwd_buff, PROMPT_STR);
+    return read_line_edit(prompt_buff, line, line_length);
 }
 
 
@@ -42,32 +51,62 @@ int run_interactive(Variable **root){
     printf("Interactive CSCSHELL starting...\n");
     #endif
 
-    while ((error = (long) prompt(line, MAX_SINGLE_LINE)) > 0) {
+    bool editing = isatty(STDIN_FILENO);
+    if (editing) {
+        history_open();
+    }
+    long line_number = 0;
+    // the lines of a compound command typed so far
+    char *pending = NULL;
+    while (1) {
+        if (editing) {
+            // no-op unless PATH changed since the trie was started
+            Variable *path = find_variable(*root, PATH_VAR_NAME);
+            refresh_completion(path != NULL ? path->value : NULL);
+        }
+        error = pending != NULL ?
+            (long) read_line_edit(CONTINUE_PROMPT_STR, line, MAX_SINGLE_LINE) :
+            (long) prompt(line, MAX_SINGLE_LINE);
+        if (error <= 0) {
+            break;
+        }
+        line_number++;
+        if (pending == NULL) {
+            alloc_line_begin();
+        }
         // kill the newline
-        line[strlen(line) - 1] = '\0';
+        line[strcspn(line, "\n")] = '\0';
+        if (editing) {
+            history_add(line);
+        }
 
-        Command *commands = parse_line(line, root);
-        if (commands == (Command *) -1){
-            ERR_PRINT(ERR_PARSING_LINE);
+        if (append_line(&pending, line) == -1) {
+            error = -1;
+            break;
+        }
+        if (needs_more_lines(pending)) {
             continue;
         }
-        if (commands == NULL) continue;
-
-        int *last_ret_code_pt = execute_line(commands);
-        if (last_ret_code_pt == (int *) -1){
-            ERR_PRINT(ERR_EXECUTE_LINE);
-            free(last_ret_code_pt);
-            return -1;
+        run_line(pending, root);
+        free(pending);
+        pending = NULL;
+        alloc_line_end("<stdin>", line_number);
+        if (shell_state.exit_requested){
+            // set -e: the failing status is what the shell exits with
+            error = shell_state.last_status;
+            break;
         }
-        free(last_ret_code_pt);
     }
+    free(pending);
     printf("\n");
+    free_completion();
+    history_close();
 
     #ifdef DEBUG
     printf("\nInteractive CSCSHELL exiting...\n");
     #endif
 
-    // 0 on EOF, -1 on other errors
+    // 0 on EOF, -1 on other errors, the status if set -e tripped
     return (int) error;
 }
 
@@ -76,6 +115,11 @@ int main(int argc, char *argv[]){
 
     int num_args_parsed = 0;
     char *init_file = DEFAULT_INIT;
+    char *command_string = NULL;
+    char *server_socket = NULL;
+    bool incremental = false;
+    bool alloc_report = false;
+    char *memo_state = NULL;
 
     for (int i=1; i < argc; i++){
         if (strcmp(argv[i], "-h") == 0 ||
@@ -84,7 +128,51 @@ int main(int argc, char *argv[]){
             return 0;
         }
 
-        if (strcmp(argv[i], "-i") == 0){
+        if (strcmp(argv[i], "-m") == 0 ||
+            strcmp(argv[i], LONG_ALLOC_ARG) == 0){
+            alloc_accounting_enable();
+            alloc_report = true;
+            num_args_parsed++;
+        }
+
+        else if (strncmp(argv[i], LONG_INCREMENTAL_ARG,
+                         strlen(LONG_INCREMENTAL_ARG)) == 0 &&
+                 (argv[i][strlen(LONG_INCREMENTAL_ARG)] == '\0' ||
+                  argv[i][strlen(LONG_INCREMENTAL_ARG)] == '=')){
+            incremental = true;
+            if (argv[i][strlen(LONG_INCREMENTAL_ARG)] == '='){
+                memo_state = argv[i] + strlen(LONG_INCREMENTAL_ARG) + 1;
+            }
+            num_args_parsed++;
+        }
+
+        else if (strcmp(argv[i], LONG_CLIENT_ARG) == 0){
+            // the client never runs anything itself, so needs no init
+            if (i + 1 >= argc){
+                ERR_PRINT(ERR_ARG_MISSING, argv[i]);
+                return -1;
+            }
+            int status = run_client(argv[i + 1], argc - i - 2, argv + i + 2);
+            return status < 0 ? 1 : status;
+        }
+
+        else if (strcmp(argv[i], "-c") == 0 ||
+                 strcmp(argv[i], LONG_SERVER_ARG) == 0){
+            if (i + 1 >= argc){
+                ERR_PRINT(ERR_ARG_MISSING, argv[i]);
+                return -1;
+            }
+            if (argv[i][1] == 'c'){
+                command_string = argv[i + 1];
+            }
+            else{
+                server_socket = argv[i + 1];
+            }
+            i++;
+            num_args_parsed += 2;
+        }
+
+        else if (strcmp(argv[i], "-i") == 0){
             if (i + 1 < argc){
                 init_file = argv[i + 1];
                 i++;
@@ -103,29 +191,92 @@ int main(int argc, char *argv[]){
         }
     }
 
+    // fopen does not expand '~'
+    char init_path[MAX_PATH_STR];
+    if (strncmp(init_file, "~/", 2) == 0 && getenv("HOME") != NULL){
+        snprintf(init_path, MAX_PATH_STR, "%s%s", getenv("HOME"), init_file + 1);
+        init_file = init_path;
+    }
+
     #ifdef DEBUG
     printf("Using init file at: %s\n", init_file);
     #endif
 
     Variable *start_of_vars = NULL;
-    if (run_script(init_file, &start_of_vars) < 0){
+    if (import_environment(&start_of_vars) < 0){
+        free_variable(start_of_vars, NON_ZERO_BYTE);
+        return -1;
+    }
+
+    // A valid snapshot stands in for running the init script
+    int snapshot = load_init_snapshot(init_file, &start_of_vars);
+    if (snapshot < 0){
         ERR_PRINT(ERR_INIT_SCRIPT, init_file);
         return -1;
     }
+    if (snapshot == 0){
+        if (run_script(init_file, &start_of_vars) < 0){
+            ERR_PRINT(ERR_INIT_SCRIPT, init_file);
+            return -1;
+        }
+        if (init_snapshot_allowed(init_file)){
+            save_init_snapshot(init_file, start_of_vars);
+        }
+    }
 
     if ((start_of_vars == NULL) ||
         strcmp(start_of_vars->name, PATH_VAR_NAME) > 0) {
         ERR_PRINT(ERR_PATH_INIT, init_file);
     }
 
+    // Unless there is a report to write at exit, nothing is left to do
+    // after a script's last command: it can take the shell's place
+    const char *stats_path = getenv(STATS_ENV_NAME);
+    bool exec_last = !alloc_report && (stats_path == NULL || stats_path[0] == '\0');
+
     int ret_code;
-    if (num_args_parsed < argc-1){
-        ret_code = run_script(argv[argc-1], &start_of_vars);
+    if (incremental && (server_socket != NULL || command_string != NULL ||
+                        num_args_parsed >= argc-1)){
+        ERR_PRINT(ERR_MEMO_USAGE);
+        ret_code = -1;
+    }
+    else if (server_socket != NULL){
+        ret_code = run_server(server_socket, &start_of_vars);
+    }
+    else if (command_string != NULL){
+        script_argc = 1;
+        script_argv = &command_string;
+        shell_state.exec_last = exec_last;
+        ret_code = run_command_string(command_string, &start_of_vars);
+    }
+    else if (num_args_parsed < argc-1){
+        script_argc = 1;
+        script_argv = &argv[argc-1];
+        char state_path[MAX_PATH_STR];
+        if (incremental && memo_state == NULL){
+            snprintf(state_path, sizeof(state_path), "%s" MEMO_STATE_SUFFIX, argv[argc-1]);
+            memo_state = state_path;
+        }
+        if (incremental && memo_open(memo_state) == -1){
+            ret_code = -1;
+        }
+        else{
+            shell_state.exec_last = exec_last && !incremental;
+            ret_code = run_script(argv[argc-1], &start_of_vars);
+        }
+        // a run cut short by set -e or exit never got to the later lines
+        memo_close(ret_code != -1 && !shell_state.exit_requested);
     }
     else{
         ret_code = run_interactive(&start_of_vars);
     }
 
+    dump_stats_on_exit();
     free_variable(start_of_vars, NON_ZERO_BYTE);
+    free_environment();
+    free_init_snapshot();
+    free_read_buffers();
+    free_functions();
+    free_interned();
     return ret_code;
 }
@@ -9,17 +9,24 @@
 #ifndef CSCSHELL_H
 #define CSCSHELL_H
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <sched.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 
 #include <dirent.h>
@@ -29,19 +36,61 @@
 // Arg help
 #define LONG_HELP_ARG "--help"
 #define LONG_INIT_ARG "--init-file="
+#define LONG_ALLOC_ARG "--alloc-report"
+#define LONG_SERVER_ARG "--server"
+#define LONG_CLIENT_ARG "--client"
+#define LONG_INCREMENTAL_ARG "--incremental"
 #define DEFAULT_INIT "~/.cscshell_init"
+#define SNAPSHOT_MAGIC "CSCSNAP2"
+#define MEMO_MAGIC "CSCMEMO1"
+#define MEMO_STATE_SUFFIX ".state"
 
 // Buffer sizes
 #define MAX_USER_BUF 128
 #define MAX_PATH_STR 4096
 #define MAX_SINGLE_LINE 4096
+#define PIPE_READ_CHUNK 65536
+#define READ_BUFFER_SIZE 65536
+#define STATS_REPORT_BUF 2048
+#define SERVER_MAX_REQUEST 65536
+#define MAX_COMPLETIONS 256
 
 // Prompt config
 #define PROMPT_STR "<:"
+#define CONTINUE_PROMPT_STR "> "
 
 // other strings and values
 #define PATH_VAR_NAME "PATH"
+#define PIPE_SIZE_VAR_NAME "PIPE_BUFFER_SIZE"
+#define TIMEOUT_VAR_NAME "CMD_TIMEOUT"
+#define TIMEOUT "timeout"
+#define TIMEOUT_STATUS 124
+#define SCHED_VAR_NAME "CMD_SCHED"
+#define SCHED "sched"
+#define SCHED_MAX_LIMITS 8
+#define FANOUT "fanout"
+#define PMAP "pmap"
+#define PMAP_PIPE_SIZE (1 << 20)
+#define PMAP_MAX_JOBS 1024
+#define KILL_GRACE_MS 1000
+#define SUPERVISE_MAX_EVENTS 16
 #define CD "cd"
+#define EXPORT "export"
+#define STATS "stats"
+#define SET "set"
+#define READ "read"
+#define READ_DEFAULT_VAR "REPLY"
+#define TEST "test"
+#define TEST_BRACKET "["
+#define LOCAL "local"
+#define RETURN "return"
+#define EXEC "exec"
+#define FUNCTION_MAX_DEPTH 100
+#define STATUS_SYNTAX 2
+#define STATUS_NOT_FOUND 127
+#define STATS_ENV_NAME "CSCSHELL_STATS"
+#define HISTORY_FILE ".cscshell_history"
+#define HISTORY_ENV_NAME "CSCSHELL_HISTORY"
 #define VARIABLE_PARSE_MARKER '$'
 #define PARSING_START_MARKER '<'
 #define PARSING_END_MARKER '>'
@@ -63,6 +112,42 @@ of the variable list."
 #define ERR_VAR_USAGE "Variable could not be parsed from %s\n"
 #define ERR_VAR_NOT_FOUND "Could not find variable: <%s>\n"
 #define ERR_READ_PIPE "Could not read from pipe.\n"
+#define ERR_LIST_SYNTAX "Missing command around '%s'\n"
+#define ERR_LIST_KEYWORD "Unexpected '%s'\n"
+#define ERR_LIST_INCOMPLETE "Unexpected end of input inside a compound command\n"
+#define ERR_SET_USAGE "Usage: set [-e|+e] [-o|+o errexit|pipefail|cpuspread]...\n"
+#define ERR_SCHED_USAGE "Usage: sched [-c CPUS] [-n N] [-i CLASS[:N]] [-l RES=VAL]... \
+COMMAND\n"
+#define ERR_SCHED_VALUE "Invalid value for sched %s: %s\n"
+#define ERR_STATS_USAGE "Usage: stats [-j|--json]\n"
+#define ERR_TIMED_OUT "Timed out after %d ms, killing the line.\n"
+#define ERR_BAD_TIMEOUT "Invalid " TIMEOUT_VAR_NAME " value: %s\n"
+#define ERR_BAD_PIPE_SIZE "Invalid " PIPE_SIZE_VAR_NAME " value: %s\n"
+#define ERR_REDIR_FILE "Missing file name after '%c'\n"
+#define ERR_ARG_MISSING "Missing value after argument: '%s'\n"
+#define ERR_SOCKET_PATH "Socket path too long: %s\n"
+#define ERR_SOCKET_EXISTS "%s exists and is not a socket\n"
+#define ERR_SOCKET_IN_USE "A server is already listening on %s\n"
+#define ERR_BAD_REQUEST "Malformed server request.\n"
+#define ERR_NO_REPLY "Server closed the connection without a status.\n"
+#define ERR_CLIENT_USAGE "Usage: cscshell " LONG_CLIENT_ARG " SOCKET \
+[-c COMMAND | SCRIPT] [ARG]...\n"
+#define ERR_SUBST_USAGE "Unterminated command substitution in %s\n"
+#define ERR_ARITH "Arithmetic error in $((%s)): %s\n"
+#define ERR_TEST "test: %s%s\n"
+#define ERR_MEMO_STATE "%s is not an incremental state file\n"
+#define ERR_MEMO_USAGE LONG_INCREMENTAL_ARG " needs a script file\n"
+#define ERR_PMAP_USAGE "Usage: pmap [-g] [-j N] COMMAND [ARG]... < FILE, COMMAND not a builtin or function\n"
+#define ERR_PMAP_INPUT "pmap needs a regular file as its input\n"
+#define ERR_BAD_SUBST "Bad substitution: ${%.*s}\n"
+#define ERR_FUNCTION_BODY "Missing '{' after %s()\n"
+#define ERR_FUNCTION_DEPTH "Functions nested more than %d deep\n"
+#define ERR_LOCAL_USAGE "Usage: local NAME[=VALUE]..., inside a function\n"
+#define ERR_RETURN_USAGE "Usage: return [N], inside a function\n"
+#define ERR_EXEC_USAGE "Usage: exec [COMMAND [ARG]...], COMMAND not a builtin or function\n"
+
+#define ALLOC_GROWTH_FMT "alloc: %s:%ld: live +%lld bytes (now %lld), \
+line peak +%lld, overall peak %lld\n"
 
 #define ERR_PRINT(...) fprintf(stderr, "ERROR: ");\
     fprintf(stderr, __VA_ARGS__);
@@ -79,22 +164,111 @@ of the variable list."
 **    connected by pipes.
 */
 typedef struct Variable{
-    char *name;
+    const char *name;       // interned, never freed with the variable
     char *value;
+    uint8_t exported;       // passed on to children through envp
     struct Variable *next;
 } Variable;
 
+/*
+** Where and how a child runs (see sched.c), from a `sched` prefix or
+** CMD_SCHED. Applied in the child between fork and exec.
+*/
+typedef struct SchedSpec {
+    bool has_cpus;
+    bool has_nice;
+    bool has_ioprio;
+    cpu_set_t cpus;
+    int nice;               // added to the niceness
+    int ioprio;             // packed class and level for ioprio_set
+    int num_limits;
+    struct {
+        int resource;
+        struct rlimit limit;
+    } limits[SCHED_MAX_LIMITS];
+} SchedSpec;
+
+// one '>' or '>>' of a command, in the order written
+typedef struct Redirect {
+    char *path;
+    uint8_t append;
+    struct Redirect *next;
+} Redirect;
+
 typedef struct Command {
-    char *exec_path;
+    const char *exec_path;  // args[0], or once found on PATH an interned path
     char **args;
     struct Command *next;
     uint32_t stdin_fd;      // file descriptor for input redirection
     uint32_t stdout_fd;     // file descriptor for output redirection
     char *redir_in_path;    // path to file for input redirection
-    char *redir_out_path;   // path to file for output redirection
-    uint8_t redir_append;   
+    Redirect *redir_out;    // files for output redirection, NULL = none
+    bool fanout;            // copies stdin into redir_out, see fanout.c
+    int pipe_size;          // F_SETPIPE_SZ for the pipe to next, 0 = default
+    Variable **variables;   // shell variables, for builtins that need them
+    int timeout_ms;         // `timeout` prefix or CMD_TIMEOUT, 0 = none
+    SchedSpec *sched;       // `sched` prefix or CMD_SCHED, NULL = none
+    pid_t pgid;             // group to join, 0 = new group, -1 = the shell's
+    pid_t pid;              // running child, 0 once reaped or if none
+    int pidfd;              // used while supervising the child
+    int status;             // exit status, 128+N if killed by signal N
+    uint64_t started_ns;    // when the child was forked
 } Command;
 
+/*
+** Always-on runtime counters (see stats.c). Plain increments on a global,
+** cheap enough to leave in every path. Times are in nanoseconds.
+*/
+typedef struct ShellStats {
+    uint64_t lines_parsed;
+    uint64_t parse_ns;              // outermost parse_line or instantiate_pipeline,
+                                    // incl. expansion
+    uint64_t expand_ns;             // outermost replace_variables_mk_line
+    uint64_t resolve_calls;
+    uint64_t resolve_dir_entries;   // readdir entries looked at resolving
+    uint64_t forks;
+    uint64_t execs;                 // forks made to exec an external command
+    uint64_t pipes_opened;
+    uint64_t children_reaped;
+    uint64_t child_wall_ns;         // fork to reap, summed over children
+    uint64_t child_user_ns;
+    uint64_t child_sys_ns;
+    uint64_t bytes_allocated;       // running total asked of malloc and co.
+    uint64_t lines_skipped;         // up to date under --incremental
+} ShellStats;
+
+extern ShellStats shell_stats;
+
+/*
+** State shared by every line (see list.c). Options are changed with the
+** `set` builtin.
+*/
+typedef struct ShellState {
+    int last_status;        // $?, of the last pipeline that ran
+    int subst_status;       // of the last $(...); a line of assignments'
+    bool errexit;           // set -e: stop at the first untested failure
+    bool pipefail;          // a pipeline fails if any stage does
+    bool cpuspread;         // pin each stage of a pipeline to its own CPU
+    bool exit_requested;    // stop reading lines (set -e tripped)
+    bool returning;         // `return` ran: unwind to the function's caller
+    bool exec_last;         // what runs next is the last thing main's script
+                            // or -c does: exec it instead of forking
+} ShellState;
+
+extern ShellState shell_state;
+
+/*
+** Builtins run inside the shell process instead of being exec'd.
+** They write to command->stdout_fd and return 0 on success, -1 on error,
+** or the status itself for the few (test) that have more than two.
+*/
+typedef int (*builtin_fn)(Command *command);
+
+typedef struct Builtin {
+    const char *name;
+    builtin_fn fn;
+} Builtin;
+
 
 /*
 ** The following functions are provided for you in _shell.c
@@ -124,6 +298,21 @@ typedef struct Command {
 */
 Command *parse_line(char *line, Variable **variables);
 
+/*
+** A pipeline parsed once and expanded each time it runs, for the bodies
+** of loops and functions (see parse.c). compile_pipeline returns NULL if
+** the line has to go through parse_line every time instead, which is
+** also how errors in it are reported. instantiate_pipeline returns what
+** parse_line would; free_pipeline releases the template.
+*/
+typedef struct PipelineTemplate PipelineTemplate;
+
+PipelineTemplate *compile_pipeline(const char *text);
+
+Command *instantiate_pipeline(const PipelineTemplate *tmpl, Variable **variables);
+
+void free_pipeline(PipelineTemplate *tmpl);
+
 /*
 ** WARNING: this is a challenging string parsing task.
 **
@@ -162,13 +351,118 @@ int cd_cscshell(const char *target_dir);
 */
 char *resolve_executable(const char *command_name, Variable *path);
 
+/*
+** Resolves the command names of a whole pipeline against PATH at once.
+** parse_line leaves each stage's exec_path as the bare name in args[0];
+** this makes one pass over the PATH directories for all of them, trying
+** each name in a directory with faccessat before reading the directory.
+** Only the full paths found this way are interned, so names that come
+** and go with expansion (`./out/$i/run`, `cmd$i`) do not pile up.
+**
+** Returns 0, or -1 (after printing which) if a name could not be found.
+*/
+int resolve_line(Command *head);
+
+/*
+** Whether name in the directory dirfd is something execve would run for
+** us: executable, and not a directory. Used by resolve_line and for the
+** startup snapshot's index of PATH.
+*/
+bool is_executable_at(int dirfd, const char *name);
+
+/*
+** Runs a line, or several joined by newlines: pipelines joined by ';',
+** '&&' and '||' and grouped by while loops, each one parsed with
+** parse_line and executed with execute_line only when reached.
+** Sets shell_state.last_status, and exit_requested if set -e trips.
+** With shell_state.exec_last set, the last pipeline of the line (if it
+** is reached) may replace the shell.
+**
+** Returns the status of the last pipeline run (2 on a syntax error).
+*/
+int run_line(const char *line, Variable **root);
+
+/*
+** A parsed command list (see list.c), as kept for a function body.
+** run_body runs it like run_line would; free_body releases it.
+*/
+typedef struct ListNode ListNode;
+
+int run_body(ListNode *body, Variable **root);
+
+void free_body(ListNode *body);
+
+/*
+** Shell functions (see func.c). define_function takes over body, which
+** may be NULL if copying it failed, and returns 0 or 1 like a command.
+** find_function returns the function called name, or NULL, and
+** for_each_function calls visit with each defined name and arg.
+**
+** call_function runs fn in the shell with command's args as $1... and
+** its stdin_fd and stdout_fd as the standard streams, and returns its
+** status. declare_local gives name a value (value may be NULL for "")
+** that lasts until the innermost call returns; in_function tells whether
+** there is one.
+*/
+typedef struct Function Function;
+
+int define_function(const char *name, ListNode *body);
+
+Function *find_function(const char *name);
+
+void for_each_function(void (*visit)(const char *name, void *arg), void *arg);
+
+int call_function(Function *fn, Command *command);
+
+int declare_local(Variable **variables, const char *name, const char *value);
+
+bool in_function(void);
+
+void free_functions(void);
+
+/*
+** Whether text opens a compound command it does not close, so that the
+** caller should append the next line (see append_line) before run_line.
+*/
+bool needs_more_lines(const char *text);
+
+/*
+** Whether text is one pipeline on its own: no ';', '&&' or '||', and no
+** compound command (while, if, a function definition).
+*/
+bool is_single_pipeline(const char *text);
+
+/*
+** Appends line to the heap string *text (which may be NULL), after a
+** newline if *text is not empty. Returns 0, or -1 on error.
+*/
+int append_line(char **text, const char *line);
+
+/*
+** Reads one line from fd for the `read` builtin, through a buffer kept
+** per fd (see input.c). *line points into that buffer, without the
+** newline, until the next call.
+**
+** Returns 1 for a line, 0 at end of input (*len is then the length of an
+** unterminated last line, if any), or -1 on error.
+*/
+int read_fd_line(int fd, const char **line, size_t *len);
+
+void free_read_buffers(void);
+
+/*
+** Whether line needs run_line: more than one pipeline, or a syntax error.
+*/
+bool is_command_list(const char *line);
+
 /*
 ** Executes a single "line" of commands (through pipes)
 ** If a command fails, the rest of the line should not be executed.
 **
 ** The error code from the last command is returned through a pointer
-** to a heap integer on success. If the line is a `cd` command, the
-** return value of `cd_cscshell` is stored by the heap int.
+** to a heap integer on success; with set -o pipefail, that of the last
+** stage that failed. A builtin that failed has status 1, and a line
+** naming a command that is not on PATH has status 127 and runs nothing.
 ** -- If there are no commands to execute, returns NULL
 ** -- If there were any errors starting any commands,
 **    returns (pointer value) -1
@@ -178,20 +472,149 @@ int *execute_line(Command *head);
 /*
 ** Forks a new process and execs the command
 ** making sure all file descriptors are set up correctly.
+** The child is not waited for; see supervise_line.
 **
+** Parent process returns the child's pid, or 0 if the command was a
+** builtin run in-process (its result is in command->status).
 ** Parent process returns -1 on error.
 ** Any child processes should not return.
 */
 int run_command(Command *command);
 
 /*
-** Executes an entire script line-by-line.
-** Stops and indicates an error as soon as any line fails.
+** Waits for every child started for the line at head, storing each exit
+** status in its Command. Children are watched through pidfds on a single
+** epoll instance. If timeout_ms is positive and runs out, the line is
+** sent SIGTERM, then SIGKILL after KILL_GRACE_MS: the whole process group
+** if pgid is positive, each child otherwise. Killed stages get status 124.
+**
+** Returns 0.
+*/
+int supervise_line(Command *head, pid_t pgid, int timeout_ms);
+
+/*
+** Parses "1.5", "500ms", "30s", "2m", "1h" or "1d" (plain numbers are
+** seconds). Returns milliseconds, or -1 if not a duration.
+*/
+int parse_duration_ms(const char *duration);
+
+/*
+** Evaluates the arithmetic expression expr (the inside of a $((...)),
+** already expanded) into *result; see arith.c for what is supported.
+**
+** Returns 0, or -1 (after printing why) if it is invalid.
+*/
+int eval_arith(const char *expr, Variable *variables, int64_t *result);
+
+/*
+** Evaluates the arguments of `test`, or of `[` when brackets is set, in
+** which case the last one has to be "]"; see cond.c for the operators.
+**
+** Returns 0 if true, 1 if false, or STATUS_SYNTAX (after printing why).
+*/
+int eval_test(char **args, bool brackets);
+
+/*
+** Expands the body of a ${...}, body_len characters at body: ${V} or one
+** of the operators in param.c.
+**
+** Returns a heap string, or NULL (after printing why) on error.
+*/
+char *expand_parameter(const char *body, size_t body_len, Variable *variables);
+
+/*
+** The value of the special parameter name: ?, the script's (or function
+** call's) 0, 1, ... 10, ..., # and @ or *, these two joined by spaces.
+**
+** Returns a heap string, or NULL on error.
+*/
+char *special_parameter(const char *name);
+
+/*
+** --incremental, see memo.c. memo_open loads the state file at path and
+** starts recording into it; memo_close closes it, compacting it first if
+** the script ran to its end (finished).
+** Both return 0, or -1 (after printing why).
+*/
+int memo_open(const char *path);
+int memo_close(bool finished);
+
+/*
+** Called by execute_line once head is resolved: true if the line is up
+** to date and should not run. *fingerprint is what to hand to
+** memo_record_line once it has succeeded, 0 if it is never skipped.
+*/
+bool memo_skip_line(Command *head, uint64_t *fingerprint);
+void memo_record_line(Command *head, uint64_t fingerprint);
+
+/*
+** 64-bit FNV-1a of len bytes at data, continuing from hash (start from
+** 0xcbf29ce484222325).
+*/
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len);
+
+/*
+** A command with more than one output file writes into a pipe instead,
+** and a fan-out stage inserted after it copies the pipe into each file
+** (see fanout.c). insert_fanout adds that stage behind command, taking
+** over its redir_out; run_fanout is what the stage's child runs.
 **
-** Returns 0 on success, -1 on error
+** Both return 0, or -1 (after printing why).
+*/
+int insert_fanout(Command *command);
+int run_fanout(Command *fanout);
+
+/*
+** The `pmap` builtin: runs num_jobs copies of the command in words, each
+** on its own newline-aligned part of command's stdin, a regular file;
+** see pmap.c.
+**
+** Returns the highest status of the copies, or -1 (after printing why).
+** With grep_status, a copy's 1 ("no match") only counts if no other copy
+** returned 0, so `pmap -g grep ...` exits like grep over the whole file.
+*/
+int run_pmap(Command *command, int num_jobs, bool grep_status, char **words);
+
+/*
+** Parses the `sched` options at the start of words into spec, stopping
+** at the first word that is not an option.
+**
+** Returns the number of words used, or -1 (after printing why).
+*/
+int parse_sched_options(char **words, SchedSpec *spec);
+
+/*
+** Parses the value of CMD_SCHED. Returns a heap SchedSpec, NULL if the
+** value is empty, or (SchedSpec *) -1 if it is invalid.
+*/
+SchedSpec *parse_sched_var(const char *value);
+
+/*
+** For set -o cpuspread: gives each stage of the pipeline at head that
+** has no CPUs of its own a different one of the CPUs the shell may use.
+** Returns 0, or -1 on error.
+*/
+int spread_line_cpus(Command *head);
+
+/*
+** Applies spec (which may be NULL) to the calling process. Only for
+** children: nothing here can be undone. Returns 0, or -1 on error.
+*/
+int apply_sched(const SchedSpec *spec);
+
+/*
+** Executes an entire script line-by-line, stopping early only if
+** set -e trips.
+**
+** Returns the status of the last pipeline run, or -1 on error
 */
 int run_script(char *file_path, Variable **root);
 
+/*
+** Like run_script, for the lines of a `-c` command string.
+*/
+int run_command_string(const char *text, Variable **root);
+
 /*
 ** Implement the following function that frees all the
 ** heap memory associated with a particular command.
@@ -210,20 +633,286 @@ int count_word(const char *str);
 
 void trim_white_space(char *str);
 
-void update_linked_list_variable(Variable **variables, const char *var_name, const char *var_val);
+Variable *update_linked_list_variable(Variable **variables, const char *var_name, const char *var_val);
 
 Command *set_command(char **args, Variable *path, 
 struct Command *next, uint32_t stdin_fd, uint32_t stdout_fd,
-char *redir_in_path, char *redir_out_path, uint8_t redir_append);
+char *redir_in_path, Redirect *redir_out);
 
 void extract_commands(char **args, char *str);
 
+/*
+** The '#' that starts a comment in line (one at the start of a word),
+** or NULL if there is none.
+*/
+char *find_comment(const char *line);
+
 Variable *find_variable(Variable *variables, const char *var_name);
 
 char *extract_file_name(char *line, int index);
 
+/*
+** Reads fd until EOF and splits everything read on whitespace.
+** *args is set to a NULL-terminated heap array of heap strings.
+**
+** Returns the number of words read, or -1 on error.
+*/
 int read_from_pipe(int fd, char ***args);
 
+/*
+** Runs cmd_line as a command substitution and returns its output on the
+** heap, word-split and joined back with single spaces. A lone builtin
+** runs in-process; anything else runs in a forked child. Its exit status
+** goes in shell_state.subst_status.
+**
+** Returns NULL on error.
+*/
+char *run_substitution(const char *cmd_line, Variable *variables);
+
+/*
+** Child side of run_command: sets up stdin/stdout and execs the command.
+** Also called in the shell itself by `exec` and for a command in tail
+** position (see execute_line). Never returns.
+*/
+void exec_command(Command *command, char **envp);
+
+/*
+** A lone command running a copy of words, resolved against PATH, for
+** builtins that run another command (pmap, exec).
+**
+** Returns NULL (after printing why) on error.
+*/
+Command *command_from_words(char **words, Variable **variables);
+
 void trim_leading_white_space(char *str);
 
+/*
+** Returns the builtin implementing `name`, or NULL if it is not one.
+*/
+builtin_fn find_builtin(const char *name);
+
+/*
+** Calls visit with the name of every builtin, and arg.
+*/
+void for_each_builtin(void (*visit)(const char *name, void *arg), void *arg);
+
+/*
+** stats_now_ns returns CLOCK_MONOTONIC in nanoseconds.
+**
+** stats_child_reaped accounts a child forked at started_ns whose
+** resource usage came back from wait4.
+**
+** write_stats writes every counter to fd, one "name value" per line or
+** as a single JSON object. Returns 0 on success, -1 on error.
+**
+** dump_stats_on_exit appends the JSON form to the file named by
+** $CSCSHELL_STATS, if set. Returns 0 on success, -1 on error.
+*/
+uint64_t stats_now_ns(void);
+
+void stats_child_reaped(uint64_t started_ns, const struct rusage *usage);
+
+int write_stats(int fd, bool json);
+
+int dump_stats_on_exit(void);
+
+/*
+** Allocation accounting (see alloc.c). shell_stats.bytes_allocated is
+** always kept; the rest is off unless enabled.
+**
+** Once enabled, live and peak heap bytes are tracked. Bracketing a line
+** with alloc_line_begin/alloc_line_end reports to stderr any growth in
+** live bytes across that line, along with the line's peak.
+*/
+void alloc_accounting_enable(void);
+
+void alloc_line_begin(void);
+
+void alloc_line_end(const char *source, long line_number);
+
+/*
+** Exported environment (see env.c).
+**
+** import_environment copies environ into the variable list, marking
+** every entry exported. Returns 0 on success, -1 on error.
+**
+** exported_environment returns the envp for execve. The array is cached
+** and only rebuilt after mark_environment_dirty() was called, i.e. when
+** an exported variable was added or changed. Returns NULL on error.
+*/
+int import_environment(Variable **variables);
+
+void mark_environment_dirty(void);
+
+char **exported_environment(Variable *variables);
+
+void free_environment(void);
+
+/*
+** Startup snapshot of the init file (see snapshot.c).
+**
+** The variables the init file sets and an index of every executable on
+** PATH are written to $XDG_CACHE_HOME/cscshell (or ~/.cache/cscshell),
+** one file per init file path. It is only used while the init file, the
+** PATH directories and the environment variables the init file reads
+** are what they were when it was written.
+**
+** load_init_snapshot applies the init file's variables on top of the
+** imported environment in *variables.
+** Returns 1 if loaded, 0 if there is no valid snapshot, -1 on error.
+**
+** init_snapshot_allowed returns 1 if the init file only assigns and
+** exports variables, so that a snapshot can stand in for running it.
+**
+** save_init_snapshot returns 0 on success, -1 on error.
+**
+** lookup_exec_index returns a heap path for command_name if the index
+** was built for path_value and holds it, and the file there is still
+** executable; NULL otherwise.
+*/
+int load_init_snapshot(const char *init_file, Variable **variables);
+
+int init_snapshot_allowed(const char *init_file);
+
+int save_init_snapshot(const char *init_file, Variable *variables);
+
+char *lookup_exec_index(const char *command_name, const char *path_value);
+
+void free_init_snapshot(void);
+
+/*
+** File descriptor bookkeeping for the line being executed (see fd.c).
+**
+** Every pipe end and redirection file opened while executing a line
+** is created O_CLOEXEC and tracked, so fd_release_line() can close
+** whatever is still open once the line finishes or fails.
+**
+** fd_track and fd_close return 0 on success, -1 on error.
+** open_line_pipe returns 0 on success, -1 on error; a positive
+** pipe_size is applied with F_SETPIPE_SZ.
+** open_line_file returns the new fd, or -1 on error.
+*/
+int fd_track(int fd);
+
+int fd_close(int fd);
+
+void fd_release_line(void);
+
+int open_line_pipe(int fds[2], int pipe_size);
+
+int open_line_file(const char *path, int flags);
+
+/*
+** Called in a child right before exec: closes every fd above stderr.
+*/
+void close_inherited_fds(void);
+
+/*
+** Shell server and client (see server.c).
+**
+** run_server only returns, with -1, if the socket cannot be set up or
+** accept fails. run_client returns the request's exit status, or -1 on
+** error; argv is `-c COMMAND [ARG]...` or `SCRIPT [ARG]...`.
+**
+** script_argv holds the script (or command string) and its arguments
+** for the request being served, script_argc how many there are.
+*/
+int run_server(const char *socket_path, Variable **root);
+
+int run_client(const char *socket_path, int argc, char **argv);
+
+extern int script_argc;
+extern char **script_argv;
+
+/*
+** String interning (see intern.c). Interned strings are stored once,
+** live until free_interned(), and compare equal by pointer.
+**
+** intern and intern_n return the interned copy, or NULL on error.
+** intern_lookup returns it only if str was interned before, NULL if not.
+*/
+const char *intern(const char *str);
+
+const char *intern_n(const char *str, size_t len);
+
+const char *intern_lookup(const char *str);
+
+void free_interned(void);
+
+/*
+** Filename globbing (see glob.c).
+**
+** expand_globs replaces each word of the NULL terminated heap array
+** *args holding '*', '?' or '[...]' with the sorted paths it matches;
+** *args may be reallocated. Directories read are cached until
+** glob_release_line(), which parse_line calls once a line is parsed.
+** Returns 0 on success, or -1 with every word freed and (*args)[0] NULL.
+*/
+int expand_globs(char ***args);
+
+/*
+** Whether the len characters at str match the glob pattern, as a whole.
+*/
+bool glob_match_n(const char *pattern, size_t pattern_len, const char *str, size_t len);
+
+void glob_release_line(void);
+
+/*
+** Interactive line editing and tab completion (see lineedit.c and
+** complete.c).
+**
+** read_line_edit behaves like fgets on a terminal in raw mode: it
+** returns line, holding the edited text and a newline, or NULL on EOF.
+**
+** refresh_completion (re)starts building the command name trie in a
+** background thread when path_value differs from the one it was built
+** for; completions use whatever has been inserted so far.
+**
+** complete_word fills comp with the candidates for line[start..end),
+** command names (builtins, functions and PATH) in command position, that
+** is at the start of a pipeline, and file names elsewhere, and
+** returns how many there are. Only the first MAX_COMPLETIONS are kept
+** in comp->matches, which free_completion_matches releases.
+*/
+typedef struct Completion {
+    char *matches[MAX_COMPLETIONS];
+    size_t num_matches;
+    size_t total_matches;
+    char common[MAX_SINGLE_LINE];   // prefix shared by every candidate
+    size_t common_len;
+} Completion;
+
+char *read_line_edit(const char *prompt_str, char *line, size_t line_length);
+
+void refresh_completion(const char *path_value);
+
+int complete_word(const char *line, size_t word_start, size_t word_end,
+                  Completion *comp);
+
+void free_completion_matches(Completion *comp);
+
+void free_completion(void);
+
+/*
+** Persistent history (see history.c), in $CSCSHELL_HISTORY or
+** ~/.cscshell_history. Entries are numbered from the newest, 0.
+**
+** history_open returns 0 on success, -1 if there is no history file.
+** history_get returns entry index, which is *len bytes and not NUL
+** terminated, or NULL past the oldest entry.
+** history_search looks at entries from, from + direction, ... for one
+** that starts with (prefix) or contains needle; returns its index or -1.
+** history_add returns 0 on success, -1 on error.
+*/
+int history_open(void);
+
+const char *history_get(size_t index, size_t *len);
+
+long history_search(const char *needle, size_t needle_len, long from,
+                    int direction, bool prefix);
+
+int history_add(const char *line);
+
+void history_close(void);
+
 #endif
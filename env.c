@@ -0,0 +1,101 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+extern char **environ;
+
+// envp handed to every execve; rebuilt only after an exported variable changed
+static char **envp_cache = NULL;
+static bool envp_dirty = true;
+
+
+static void free_envp(char **envp){
+    if (envp == NULL) {
+        return;
+    }
+    for (int i = 0; envp[i] != NULL; i++) {
+        free(envp[i]);
+    }
+    free(envp);
+}
+
+
+void mark_environment_dirty(void){
+    envp_dirty = true;
+}
+
+
+int import_environment(Variable **variables){
+    for (int i = 0; environ[i] != NULL; i++) {
+        char *eq = strchr(environ[i], '=');
+        if (eq == NULL || eq == environ[i]) {
+            continue;
+        }
+
+        char var_name[eq - environ[i] + 1];
+        strncpy(var_name, environ[i], eq - environ[i]);
+        var_name[eq - environ[i]] = '\0';
+
+        Variable *var = update_linked_list_variable(variables, var_name, eq + 1);
+        if (var == NULL) {
+            return -1;
+        }
+        var -> exported = 1;
+    }
+    mark_environment_dirty();
+    return 0;
+}
+
+
+char **exported_environment(Variable *variables){
+    if (!envp_dirty && envp_cache != NULL) {
+        return envp_cache;
+    }
+
+    size_t count = 0;
+    for (Variable *var = variables; var != NULL; var = var -> next) {
+        if (var -> exported) {
+            count++;
+        }
+    }
+
+    char **envp = (char **) malloc(sizeof(char *) * (count + 1));
+    if (envp == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    size_t i = 0;
+    for (Variable *var = variables; var != NULL; var = var -> next) {
+        if (!var -> exported) {
+            continue;
+        }
+        // +1 for '=', +1 null term
+        size_t len = strlen(var -> name) + strlen(var -> value) + 2;
+        envp[i] = (char *) malloc(len);
+        if (envp[i] == NULL) {
+            perror("malloc");
+            envp[i] = NULL;
+            free_envp(envp);
+            return NULL;
+        }
+        snprintf(envp[i], len, "%s=%s", var -> name, var -> value);
+        i++;
+    }
+    envp[i] = NULL;
+
+    free_envp(envp_cache);
+    envp_cache = envp;
+    envp_dirty = false;
+    return envp_cache;
+}
+
+
+void free_environment(void){
+    free_envp(envp_cache);
+    envp_cache = NULL;
+    envp_dirty = true;
+}
@@ -0,0 +1,162 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <limits.h>
+
+/*
+** `cmd > a >> b > c`: cmd writes into a pipe, and a fan-out stage copies
+** what arrives into every file without it passing through user space.
+**
+** Each round, tee(2) duplicates the data waiting in the input pipe into
+** an empty copy pipe per extra file, and splice(2) then moves each copy
+** into its file and the input itself into the last one. A copy pipe is
+** as big as the input pipe, so it always takes all of a round's data.
+** Targets splice cannot write to, '>>' files among them, fall back to
+** read and write.
+*/
+typedef struct FanoutTarget {
+    int fd;
+    bool append;            // O_APPEND, so only written with write(2)
+    int copy[2];            // -1 for the last target, fed from the input
+} FanoutTarget;
+
+
+int insert_fanout(Command *command){
+    char **args = (char **) malloc(2 * sizeof(char *));
+    char *name = strdup(FANOUT);
+    if (args == NULL || name == NULL) {
+        perror("malloc");
+        free(args);
+        free(name);
+        return -1;
+    }
+    args[0] = name;
+    args[1] = NULL;
+    Command *fanout = set_command(args, NULL, command->next, STDIN_FILENO,
+                                  STDOUT_FILENO, NULL, command->redir_out);
+    if (fanout == (Command *) -1) {
+        free(name);
+        free(args);
+        return -1;
+    }
+    fanout->fanout = true;
+    command->redir_out = NULL;
+    command->next = fanout;
+    return 0;
+}
+
+
+static int copy_out(int from, int to, size_t len, bool use_splice){
+    // splice len bytes from the pipe from into to
+    while (len > 0) {
+        ssize_t moved = -1;
+        errno = EINVAL;
+        if (use_splice) {
+            moved = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+        }
+        if (moved == -1 && errno == EINTR) {
+            continue;
+        }
+        if (moved == -1 && errno == EINVAL) {
+            // not something splice writes to (e.g. a terminal or '>>')
+            char buf[PIPE_BUF];
+            moved = read(from, buf, len < sizeof(buf) ? len : sizeof(buf));
+            if (moved > 0 && write(to, buf, moved) != moved) {
+                moved = -1;
+            }
+        }
+        if (moved <= 0) {
+            return -1;
+        }
+        len -= moved;
+    }
+    return 0;
+}
+
+
+static int open_target(Redirect *out){
+    /**
+     * '>>' keeps O_APPEND so other writers to the file still interleave
+     * with us; splice refuses such files, so copy_out writes them.
+    */
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (out->append ? O_APPEND : O_TRUNC);
+    int fd = open(out->path, flags, 0666);
+    if (fd == -1) {
+        perror(out->path);
+    }
+    return fd;
+}
+
+
+int run_fanout(Command *fanout){
+    int num_targets = 0;
+    for (Redirect *out = fanout->redir_out; out != NULL; out = out->next) {
+        num_targets++;
+    }
+    FanoutTarget targets[num_targets];
+    int in = fanout->stdin_fd;
+    int pipe_size = fcntl(in, F_GETPIPE_SZ);
+
+    int i = 0;
+    for (Redirect *out = fanout->redir_out; out != NULL; out = out->next, i++) {
+        targets[i].copy[0] = targets[i].copy[1] = -1;
+        targets[i].fd = open_target(out);
+        targets[i].append = out->append;
+        if (targets[i].fd == -1) {
+            return -1;
+        }
+        if (out->next == NULL) {
+            break;
+        }
+        if (pipe2(targets[i].copy, O_CLOEXEC) == -1) {
+            perror("pipe2");
+            return -1;
+        }
+        if (pipe_size > 0 && fcntl(targets[i].copy[1], F_SETPIPE_SZ, pipe_size) == -1) {
+            perror("fcntl");
+        }
+    }
+
+    int last = num_targets - 1;
+    while (1) {
+        // everything in the input, at most a pipe's worth, into each copy
+        ssize_t len;
+        while ((len = tee(in, targets[0].copy[1], INT_MAX, 0)) == -1 && errno == EINTR);
+        if (len == -1) {
+            perror("tee");
+            return -1;
+        }
+        if (len == 0) {
+            // the writer is done
+            return 0;
+        }
+        for (i = 1; i < last; i++) {
+            ssize_t copied;
+            while ((copied = tee(in, targets[i].copy[1], len, 0)) == -1 && errno == EINTR);
+            if (copied != len) {
+                // short only if a copy could not be made as big as the input
+                if (copied == -1) {
+                    perror("tee");
+                }
+                return -1;
+            }
+        }
+
+        for (i = 0; i < last; i++) {
+            if (copy_out(targets[i].copy[0], targets[i].fd, len,
+                         !targets[i].append) == -1) {
+                perror("write");
+                return -1;
+            }
+        }
+        // the input itself goes last, which also consumes it
+        if (copy_out(in, targets[last].fd, len, !targets[last].append) == -1) {
+            perror("write");
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+// fds opened on behalf of the line currently being executed
+static int *line_fds = NULL;
+static size_t line_fds_count = 0;
+static size_t line_fds_cap = 0;
+
+
+int fd_track(int fd){
+    if (line_fds_count == line_fds_cap) {
+        size_t new_cap = line_fds_cap ? line_fds_cap * 2 : 16;
+        int *grown = (int *) realloc(line_fds, new_cap * sizeof(int));
+        if (grown == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        line_fds = grown;
+        line_fds_cap = new_cap;
+    }
+    line_fds[line_fds_count++] = fd;
+    return 0;
+}
+
+
+int fd_close(int fd){
+    if (fd <= STDERR_FILENO) {
+        // never ours to close
+        return 0;
+    }
+    for (size_t i = 0; i < line_fds_count; i++) {
+        if (line_fds[i] == fd) {
+            // order does not matter, swap the last one in
+            line_fds[i] = line_fds[--line_fds_count];
+            return close(fd);
+        }
+    }
+    // untracked, leave it to whoever opened it
+    return 0;
+}
+
+
+void fd_release_line(void){
+    while (line_fds_count > 0) {
+        close(line_fds[--line_fds_count]);
+    }
+}
+
+
+int open_line_pipe(int fds[2], int pipe_size){
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return -1;
+    }
+    shell_stats.pipes_opened++;
+    if (fd_track(fds[0]) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (fd_track(fds[1]) == -1) {
+        fd_close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    // The kernel rounds up to a page multiple; failing to grow the pipe
+    // (e.g. above /proc/sys/fs/pipe-max-size) is not fatal.
+    if (pipe_size > 0 && fcntl(fds[1], F_SETPIPE_SZ, pipe_size) == -1) {
+        perror("fcntl");
+    }
+    return 0;
+}
+
+
+int open_line_file(const char *path, int flags){
+    int fd = open(path, flags | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+    if (fd_track(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+void close_inherited_fds(void){
+    // Only the three standard streams survive into the exec'd program
+    if (close_range(STDERR_FILENO + 1, ~0U, 0) == -1) {
+        // old kernels: everything we open is CLOEXEC anyway
+        for (int fd = STDERR_FILENO + 1; fd < sysconf(_SC_OPEN_MAX); fd++) {
+            close(fd);
+        }
+    }
+}
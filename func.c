@@ -0,0 +1,277 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** Shell functions: `NAME() { LIST; }` keeps the parsed LIST, and a
+** command named NAME runs it in the shell itself, without a fork, an
+** open or a parse of its own. Each pipeline in it is still expanded when
+** reached, like any other, so it sees the call's $1... and variables.
+**
+** A call swaps script_argv for its own arguments and, for as long as it
+** runs, holds a reference to the function: redefining it from inside its
+** own body only frees the old body once the call is done. Variables made
+** with `local` are set back, or removed, when the call returns.
+*/
+struct Function {
+    const char *name;       // interned
+    ListNode *body;
+    int refs;               // the table's, plus one per running call
+    struct Function *next;
+};
+
+// what a variable was before `local` changed it
+typedef struct SavedLocal {
+    const char *name;       // interned
+    char *value;            // NULL if it was not set
+    uint8_t exported;
+    struct SavedLocal *next;
+} SavedLocal;
+
+static Function *functions = NULL;
+static SavedLocal **call_locals = NULL;     // innermost call's, NULL outside
+static int call_depth = 0;
+
+
+static void release_function(Function *fn){
+    if (--fn->refs == 0) {
+        free_body(fn->body);
+        free(fn);
+    }
+}
+
+
+int define_function(const char *name, ListNode *body){
+    if (body == NULL) {
+        return 1;
+    }
+    Function *fn = (Function *) malloc(sizeof(Function));
+    if (fn == NULL || (fn->name = intern(name)) == NULL) {
+        if (fn == NULL) {
+            perror("malloc");
+        }
+        free(fn);
+        free_body(body);
+        return 1;
+    }
+    fn->body = body;
+    fn->refs = 1;
+
+    // a new definition takes the old one's place in the table
+    Function **link = &functions;
+    while (*link != NULL && (*link)->name != fn->name) {
+        link = &(*link)->next;
+    }
+    fn->next = *link != NULL ? (*link)->next : NULL;
+    if (*link != NULL) {
+        release_function(*link);
+    }
+    *link = fn;
+    return 0;
+}
+
+
+Function *find_function(const char *name){
+    // a name that was never interned cannot be a function
+    const char *interned = intern_lookup(name);
+    if (interned == NULL) {
+        return NULL;
+    }
+    for (Function *fn = functions; fn != NULL; fn = fn->next) {
+        if (fn->name == interned) {
+            return fn;
+        }
+    }
+    return NULL;
+}
+
+
+void for_each_function(void (*visit)(const char *name, void *arg), void *arg){
+    for (Function *fn = functions; fn != NULL; fn = fn->next) {
+        visit(fn->name, arg);
+    }
+}
+
+
+int declare_local(Variable **variables, const char *name, const char *value){
+    if (call_locals == NULL) {
+        ERR_PRINT(ERR_LOCAL_USAGE);
+        return -1;
+    }
+    const char *interned = intern(name);
+    if (interned == NULL) {
+        return -1;
+    }
+
+    // only the value from before the first `local` of the call is kept
+    bool saved = false;
+    for (SavedLocal *s = *call_locals; s != NULL && !saved; s = s->next) {
+        saved = s->name == interned;
+    }
+    if (!saved) {
+        SavedLocal *s = (SavedLocal *) malloc(sizeof(SavedLocal));
+        if (s == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        Variable *var = find_variable(*variables, interned);
+        s->name = interned;
+        s->value = var != NULL ? strdup(var->value) : NULL;
+        s->exported = var != NULL ? var->exported : 0;
+        if (var != NULL && s->value == NULL) {
+            perror("malloc");
+            free(s);
+            return -1;
+        }
+        s->next = *call_locals;
+        *call_locals = s;
+    }
+    return update_linked_list_variable(variables, interned, value != NULL ? value : "")
+        == NULL ? -1 : 0;
+}
+
+
+static void remove_variable(Variable **variables, const char *name){
+    for (Variable **link = variables; *link != NULL; link = &(*link)->next) {
+        if ((*link)->name == name) {
+            Variable *var = *link;
+            *link = var->next;
+            if (var->exported) {
+                mark_environment_dirty();
+            }
+            free_variable(var, 0);
+            return;
+        }
+    }
+}
+
+
+static void restore_locals(Variable **variables, SavedLocal *locals){
+    while (locals != NULL) {
+        SavedLocal *next = locals->next;
+        if (locals->value == NULL) {
+            remove_variable(variables, locals->name);
+        }
+        else {
+            Variable *var = update_linked_list_variable(variables, locals->name,
+                                                        locals->value);
+            if (var != NULL && var->exported != locals->exported) {
+                var->exported = locals->exported;
+                mark_environment_dirty();
+            }
+            free(locals->value);
+        }
+        free(locals);
+        locals = next;
+    }
+}
+
+
+static int redirect_stream(int fd, int target, int *saved){
+    // target becomes fd, the old target is kept in *saved
+    *saved = -1;
+    if (fd == target) {
+        return 0;
+    }
+    *saved = fcntl(target, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+    if (*saved == -1 || dup2(fd, target) == -1) {
+        perror("dup2");
+        if (*saved != -1) {
+            close(*saved);
+            *saved = -1;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+
+static void restore_stream(int target, int saved){
+    if (saved != -1) {
+        dup2(saved, target);
+        close(saved);
+    }
+}
+
+
+bool in_function(void){
+    return call_depth > 0;
+}
+
+
+int call_function(Function *fn, Command *command){
+    if (call_depth >= FUNCTION_MAX_DEPTH) {
+        ERR_PRINT(ERR_FUNCTION_DEPTH, FUNCTION_MAX_DEPTH);
+        return 1;
+    }
+    Variable **variables = command->variables;
+    if (variables == NULL) {
+        return 1;
+    }
+
+    // $0 stays the script's; the call's arguments are $1...
+    int argc = 0;
+    while (command->args[argc] != NULL) {
+        argc++;
+    }
+    char **argv = (char **) malloc((argc + 1) * sizeof(char *));
+    if (argv == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    memcpy(argv, command->args, (argc + 1) * sizeof(char *));
+    if (script_argc > 0 && script_argv != NULL) {
+        argv[0] = script_argv[0];
+    }
+
+    // what the body writes goes where the call's output goes
+    fflush(stdout);
+    int saved_stdin, saved_stdout;
+    if (redirect_stream(command->stdin_fd, STDIN_FILENO, &saved_stdin) == -1) {
+        free(argv);
+        return 1;
+    }
+    if (redirect_stream(command->stdout_fd, STDOUT_FILENO, &saved_stdout) == -1) {
+        restore_stream(STDIN_FILENO, saved_stdin);
+        free(argv);
+        return 1;
+    }
+
+    int outer_argc = script_argc;
+    char **outer_argv = script_argv;
+    SavedLocal **outer_locals = call_locals;
+    SavedLocal *locals = NULL;
+    script_argc = argc;
+    script_argv = argv;
+    call_locals = &locals;
+    call_depth++;
+    fn->refs++;
+
+    int status = run_body(fn->body, variables);
+    shell_state.returning = false;
+
+    release_function(fn);
+    call_depth--;
+    call_locals = outer_locals;
+    script_argc = outer_argc;
+    script_argv = outer_argv;
+    restore_locals(variables, locals);
+
+    fflush(stdout);
+    restore_stream(STDOUT_FILENO, saved_stdout);
+    restore_stream(STDIN_FILENO, saved_stdin);
+    free(argv);
+    return status;
+}
+
+
+void free_functions(void){
+    while (functions != NULL) {
+        Function *next = functions->next;
+        release_function(functions);
+        functions = next;
+    }
+}
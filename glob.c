@@ -0,0 +1,567 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** Filename globbing for command arguments: '*', '?' and '[...]' (with
+** '!' or '^' to negate and a-z ranges); a backslash makes the next
+** character literal. A word that matches nothing, or has no wildcard,
+** is left as it is, less those backslashes.
+**
+** Every directory a pattern looks into is read once with getdents64 and
+** kept until the line has been parsed, so several globs over the same
+** directory cost one scan.
+*/
+#define GLOB_DENTS_BUF (1 << 18)
+
+enum GlobKind {GLOB_CHAR, GLOB_ANY, GLOB_STAR, GLOB_CLASS};
+
+typedef struct GlobToken {
+    uint8_t kind;
+    unsigned char c;            // GLOB_CHAR
+    uint8_t set[32];            // GLOB_CLASS, one bit per byte value
+} GlobToken;
+
+// One path component, compiled
+typedef struct GlobPattern {
+    GlobToken *tokens;
+    size_t len;
+    char prefix[NAME_MAX + 1];  // the literal characters before the first
+    size_t prefix_len;          // wildcard, checked with one memcmp
+    bool match_dot;             // pattern itself starts with '.'
+} GlobPattern;
+
+typedef struct DirListing {
+    char *path;
+    char *names;                // every name, NUL separated
+    size_t *offsets;
+    unsigned char *types;       // d_type of each name
+    size_t count;
+} DirListing;
+
+// Listings read while parsing the current line
+static DirListing *listings = NULL;
+static size_t listings_count = 0;
+static size_t listings_cap = 0;
+static char *dents_buf = NULL;
+
+typedef struct GlobMatches {
+    char **paths;
+    size_t count;
+    size_t cap;
+} GlobMatches;
+
+
+static bool has_glob(const char *str, size_t len){
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '\\' && i + 1 < len) {
+            i++;
+        }
+        else if (str[i] == '*' || str[i] == '?') {
+            return true;
+        }
+        else if (str[i] == '[' && memchr(str + i + 1, ']', len - i - 1) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static size_t compile_class(const char *str, size_t len, GlobToken *token){
+    /**
+     * str points just past '['. Returns how many characters the class
+     * used, up to and including ']', or 0 if it is not closed.
+    */
+    size_t i = 0;
+    bool negate = i < len && (str[i] == '!' || str[i] == '^');
+    i += negate;
+    memset(token->set, 0, sizeof(token->set));
+    size_t first = i;
+    while (i < len && (str[i] != ']' || i == first)) {
+        unsigned char lo = str[i];
+        unsigned char hi = lo;
+        if (i + 2 < len && str[i + 1] == '-' && str[i + 2] != ']') {
+            hi = str[i + 2];
+            i += 2;
+        }
+        for (unsigned int c = lo; c <= hi; c++) {
+            token->set[c >> 3] |= 1 << (c & 7);
+        }
+        i++;
+    }
+    if (i >= len) {
+        return 0;
+    }
+    if (negate) {
+        for (size_t b = 0; b < sizeof(token->set); b++) {
+            token->set[b] = ~token->set[b];
+        }
+    }
+    token->kind = GLOB_CLASS;
+    return i + 1;
+}
+
+
+static size_t next_token(const char *str, size_t len, GlobToken *token){
+    /**
+     * Reads the token at the start of str, other than '*'. Returns how
+     * many characters it used.
+    */
+    size_t used;
+    if (str[0] == '?') {
+        token->kind = GLOB_ANY;
+        return 1;
+    }
+    if (str[0] == '[' && (used = compile_class(str + 1, len - 1, token)) > 0) {
+        return used + 1;
+    }
+    bool escaped = str[0] == '\\' && len > 1;
+    token->kind = GLOB_CHAR;
+    token->c = str[escaped];
+    return 1 + escaped;
+}
+
+
+static int compile_pattern(const char *str, size_t len, GlobPattern *pattern){
+    pattern->tokens = (GlobToken *) malloc(sizeof(GlobToken) * (len + 1));
+    if (pattern->tokens == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    pattern->len = 0;
+    pattern->prefix_len = 0;
+    pattern->match_dot = len > 0 && str[0] == '.';
+    bool literal_run = true;
+
+    for (size_t i = 0; i < len; ) {
+        GlobToken *token = &pattern->tokens[pattern->len];
+        if (str[i] == '*') {
+            i++;
+            // consecutive stars are one star
+            if (pattern->len > 0 && token[-1].kind == GLOB_STAR) {
+                continue;
+            }
+            token->kind = GLOB_STAR;
+        }
+        else {
+            i += next_token(str + i, len - i, token);
+        }
+
+        if (token->kind == GLOB_CHAR && literal_run && pattern->prefix_len < NAME_MAX) {
+            pattern->prefix[pattern->prefix_len++] = token->c;
+        }
+        else {
+            literal_run = false;
+        }
+        pattern->len++;
+    }
+    return 0;
+}
+
+
+static inline bool token_matches(const GlobToken *token, unsigned char c){
+    switch (token->kind) {
+        case GLOB_CHAR:
+            return token->c == c;
+        case GLOB_ANY:
+            return true;
+        case GLOB_CLASS:
+            return token->set[c >> 3] & (1 << (c & 7));
+        default:
+            return false;
+    }
+}
+
+
+static bool glob_match(const GlobPattern *pattern, const char *name){
+    if (name[0] == '.' && !pattern->match_dot) {
+        return false;
+    }
+    if (strncmp(name, pattern->prefix, pattern->prefix_len) != 0) {
+        return false;
+    }
+
+    // Greedy with one backtrack point: on a mismatch, the latest '*'
+    // swallows one more character and matching resumes after it
+    const GlobToken *tokens = pattern->tokens;
+    size_t t = 0;
+    const char *s = name;
+    size_t star_t = SIZE_MAX;
+    const char *star_s = NULL;
+    while (*s != '\0') {
+        if (t < pattern->len && tokens[t].kind == GLOB_STAR) {
+            star_t = ++t;
+            star_s = s;
+        }
+        else if (t < pattern->len && token_matches(&tokens[t], *s)) {
+            t++;
+            s++;
+        }
+        else if (star_t != SIZE_MAX) {
+            t = star_t;
+            s = ++star_s;
+        }
+        else {
+            return false;
+        }
+    }
+    while (t < pattern->len && tokens[t].kind == GLOB_STAR) {
+        t++;
+    }
+    return t == pattern->len;
+}
+
+
+bool glob_match_n(const char *pattern, size_t pattern_len, const char *str, size_t len){
+    // glob_match without compiling: the pattern is read as it is used
+    size_t p = 0, s = 0;
+    size_t star_p = SIZE_MAX, star_s = 0;
+    GlobToken token;
+    while (s < len) {
+        if (p < pattern_len && pattern[p] == '*') {
+            star_p = ++p;
+            star_s = s;
+            continue;
+        }
+        size_t used = p < pattern_len ? next_token(pattern + p, pattern_len - p, &token) : 0;
+        if (used > 0 && token_matches(&token, str[s])) {
+            p += used;
+            s++;
+        }
+        else if (star_p != SIZE_MAX) {
+            p = star_p;
+            s = ++star_s;
+        }
+        else {
+            return false;
+        }
+    }
+    while (p < pattern_len && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern_len;
+}
+
+
+static int read_listing(const char *path, DirListing *listing){
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    if (dents_buf == NULL && (dents_buf = (char *) malloc(GLOB_DENTS_BUF)) == NULL) {
+        perror("malloc");
+        close(fd);
+        return -1;
+    }
+
+    size_t names_size = 0, names_cap = 0, entries_cap = 0;
+    ssize_t got;
+    while ((got = getdents64(fd, dents_buf, GLOB_DENTS_BUF)) > 0) {
+        for (ssize_t off = 0; off < got; ) {
+            struct dirent64 *entry = (struct dirent64 *) (dents_buf + off);
+            off += entry->d_reclen;
+            size_t name_len = strlen(entry->d_name) + 1;
+
+            if (names_size + name_len > names_cap) {
+                names_cap = names_cap ? names_cap * 2 : 4096;
+                names_cap = names_cap < names_size + name_len ? names_size + name_len : names_cap;
+                char *grown = (char *) realloc(listing->names, names_cap);
+                if (grown == NULL) {
+                    goto listing_error;
+                }
+                listing->names = grown;
+            }
+            if (listing->count == entries_cap) {
+                entries_cap = entries_cap ? entries_cap * 2 : 64;
+                size_t *offsets = (size_t *) realloc(listing->offsets,
+                                                     entries_cap * sizeof(size_t));
+                if (offsets == NULL) {
+                    goto listing_error;
+                }
+                listing->offsets = offsets;
+                unsigned char *types = (unsigned char *) realloc(listing->types, entries_cap);
+                if (types == NULL) {
+                    goto listing_error;
+                }
+                listing->types = types;
+            }
+            memcpy(listing->names + names_size, entry->d_name, name_len);
+            listing->offsets[listing->count] = names_size;
+            listing->types[listing->count] = entry->d_type;
+            listing->count++;
+            names_size += name_len;
+        }
+    }
+    close(fd);
+    return 0;
+
+listing_error:
+    perror("realloc");
+    close(fd);
+    return -1;
+}
+
+
+static DirListing *get_listing(const char *path){
+    for (size_t i = 0; i < listings_count; i++) {
+        if (strcmp(listings[i].path, path) == 0) {
+            return &listings[i];
+        }
+    }
+
+    if (listings_count == listings_cap) {
+        size_t new_cap = listings_cap ? listings_cap * 2 : 8;
+        DirListing *grown = (DirListing *) realloc(listings, new_cap * sizeof(DirListing));
+        if (grown == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        listings = grown;
+        listings_cap = new_cap;
+    }
+    DirListing *listing = &listings[listings_count];
+    memset(listing, 0, sizeof(DirListing));
+    listing->path = strdup(path);
+    if (listing->path == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    // an unreadable directory is cached too, as empty
+    if (read_listing(path, listing) == -1) {
+        listing->count = 0;
+    }
+    listings_count++;
+    return listing;
+}
+
+
+void glob_release_line(void){
+    for (size_t i = 0; i < listings_count; i++) {
+        free(listings[i].path);
+        free(listings[i].names);
+        free(listings[i].offsets);
+        free(listings[i].types);
+    }
+    free(listings);
+    free(dents_buf);
+    listings = NULL;
+    dents_buf = NULL;
+    listings_count = listings_cap = 0;
+}
+
+
+static int add_path(GlobMatches *matches, const char *path){
+    if (matches->count == matches->cap) {
+        size_t new_cap = matches->cap ? matches->cap * 2 : 16;
+        char **grown = (char **) realloc(matches->paths, new_cap * sizeof(char *));
+        if (grown == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        matches->paths = grown;
+        matches->cap = new_cap;
+    }
+    if ((matches->paths[matches->count] = strdup(path)) == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    matches->count++;
+    return 0;
+}
+
+
+static bool is_directory(const char *dir_path, const char *name, unsigned char type){
+    if (type == DT_DIR) {
+        return true;
+    }
+    if (type != DT_LNK && type != DT_UNKNOWN) {
+        return false;
+    }
+    char path[MAX_PATH_STR];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", dir_path, name);
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+
+static int glob_walk(char *path, size_t path_len, const char *rest, GlobMatches *matches){
+    /**
+     * path[0..path_len) is what has been matched so far, rest is what
+     * is left of the word. Appends every full match to matches.
+    */
+    while (*rest == '/') {
+        rest++;
+    }
+    if (*rest == '\0') {
+        path[path_len] = '\0';
+        return add_path(matches, path);
+    }
+    const char *slash = strchr(rest, '/');
+    size_t comp_len = slash ? (size_t) (slash - rest) : strlen(rest);
+
+    if (!has_glob(rest, comp_len)) {
+        // literal component, without its escapes
+        for (size_t i = 0; i < comp_len; i++) {
+            if (rest[i] == '\\' && i + 1 < comp_len) {
+                i++;
+            }
+            if (path_len + 2 >= MAX_PATH_STR) {
+                return 0;
+            }
+            path[path_len++] = rest[i];
+        }
+        path[path_len] = '\0';
+        // a directory to go through may be a symlink to one, as for
+        // is_directory; the last component only has to exist
+        struct stat st;
+        if ((slash != NULL ? stat(path, &st) : lstat(path, &st)) == -1 ||
+            (slash != NULL && !S_ISDIR(st.st_mode))) {
+            return 0;
+        }
+        if (slash != NULL) {
+            path[path_len++] = '/';
+        }
+        return glob_walk(path, path_len, rest + comp_len, matches);
+    }
+
+    GlobPattern pattern;
+    if (compile_pattern(rest, comp_len, &pattern) == -1) {
+        return -1;
+    }
+    path[path_len] = '\0';
+    char dir_path[MAX_PATH_STR];
+    strcpy(dir_path, path_len > 0 ? path : ".");
+    DirListing *listing = get_listing(dir_path);
+    int ret = listing == NULL ? -1 : 0;
+
+    for (size_t i = 0; ret == 0 && i < listing->count; i++) {
+        const char *name = listing->names + listing->offsets[i];
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            !glob_match(&pattern, name)) {
+            continue;
+        }
+        if (slash != NULL && !is_directory(dir_path, name, listing->types[i])) {
+            continue;
+        }
+        size_t name_len = strlen(name);
+        if (path_len + name_len + 2 >= MAX_PATH_STR) {
+            continue;
+        }
+        memcpy(path + path_len, name, name_len);
+        size_t new_len = path_len + name_len;
+        if (slash != NULL) {
+            path[new_len++] = '/';
+        }
+        ret = glob_walk(path, new_len, rest + comp_len, matches);
+        // get_listing may have moved the listings array
+        listing = get_listing(dir_path);
+    }
+    free(pattern.tokens);
+    return ret;
+}
+
+
+static void remove_escapes(char *word){
+    char *out = word;
+    for (const char *c = word; *c != '\0'; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+        }
+        *out++ = *c;
+    }
+    *out = '\0';
+}
+
+
+static int compare_paths(const void *a, const void *b){
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+
+int expand_globs(char ***args){
+    char **words = *args;
+    size_t count = 0;
+    while (words[count] != NULL) {
+        count++;
+    }
+
+    char **expanded = NULL;
+    size_t expanded_count = 0;
+    size_t expanded_cap = 0;
+    bool changed = false;
+    char path[MAX_PATH_STR];
+
+    for (size_t i = 0; i < count; i++) {
+        GlobMatches matches = {NULL, 0, 0};
+        if (has_glob(words[i], strlen(words[i]))) {
+            size_t start = 0;
+            if (words[i][0] == '/') {
+                path[start++] = '/';
+            }
+            if (glob_walk(path, start, words[i], &matches) == -1) {
+                for (size_t j = 0; j < matches.count; j++) {
+                    free(matches.paths[j]);
+                }
+                free(matches.paths);
+                goto expand_error;
+            }
+        }
+
+        size_t adding = matches.count ? matches.count : 1;
+        if (expanded_count + adding + 1 > expanded_cap) {
+            expanded_cap = (expanded_count + adding + 1) * 2;
+            char **grown = (char **) realloc(expanded, expanded_cap * sizeof(char *));
+            if (grown == NULL) {
+                perror("realloc");
+                for (size_t j = 0; j < matches.count; j++) {
+                    free(matches.paths[j]);
+                }
+                free(matches.paths);
+                goto expand_error;
+            }
+            expanded = grown;
+        }
+
+        if (matches.count == 0) {
+            // no match, or no pattern: the word is passed on as written
+            remove_escapes(words[i]);
+            expanded[expanded_count++] = words[i];
+            words[i] = NULL;
+            continue;
+        }
+        qsort(matches.paths, matches.count, sizeof(char *), compare_paths);
+        memcpy(expanded + expanded_count, matches.paths, matches.count * sizeof(char *));
+        expanded_count += matches.count;
+        free(matches.paths);
+        free(words[i]);
+        words[i] = NULL;
+        changed = true;
+    }
+    expanded[expanded_count] = NULL;
+
+    if (!changed) {
+        // the same words, in the same order: keep the original array
+        memcpy(words, expanded, (count + 1) * sizeof(char *));
+        free(expanded);
+        return 0;
+    }
+    free(words);
+    *args = expanded;
+    return 0;
+
+expand_error:
+    // callers see an empty argument list, like extract_commands failing
+    for (size_t i = 0; i < expanded_count; i++) {
+        free(expanded[i]);
+    }
+    free(expanded);
+    for (size_t i = 0; i < count; i++) {
+        free(words[i]);
+        words[i] = NULL;
+    }
+    return -1;
+}
@@ -0,0 +1,336 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** Persistent history. The file is one entry per line and only ever
+** appended to, one write(2) per entry on an O_APPEND fd, so shells
+** running side by side interleave whole entries. What was in the file at
+** startup is mapped read-only and indexed lazily from the end: walking
+** back N entries only ever touches the last N lines of the file.
+**
+** Searching is the exception: the first search for three or more bytes
+** that reaches the file indexes all of it and builds a trigram map, so
+** later searches (one per Ctrl-R keystroke) skip the blocks of entries
+** that cannot contain the needle instead of rescanning every line.
+*/
+typedef struct HistoryEntry {
+    size_t offset;
+    size_t len;
+} HistoryEntry;
+
+static int history_fd = -1;
+static const char *history_map = NULL;
+static size_t history_map_size = 0;
+
+// entries found so far in the map, newest first
+static HistoryEntry *file_index = NULL;
+static size_t file_indexed = 0;
+static size_t file_index_cap = 0;
+static size_t scan_end = 0;         // the map before this is not indexed yet
+
+// entries added by this shell, oldest first
+static char **session = NULL;
+static size_t session_count = 0;
+static size_t session_cap = 0;
+
+/*
+** The trigram map is a bit per (trigram bucket, block of file entries):
+** set if some entry in the block has a trigram hashing to the bucket.
+** An entry containing the needle lies in a block that has the bits of
+** all the needle's trigrams; other blocks are skipped unread.
+*/
+#define TRIGRAM_BUCKETS 8192
+#define TRIGRAM_BLOCK 32            // file entries per block
+#define TRIGRAM_MAX_PROBES 16       // needle trigrams checked per block
+
+static uint64_t *trigram_bits = NULL;   // TRIGRAM_BUCKETS rows of block_words
+static size_t block_words = 0;
+static bool trigram_tried = false;
+
+
+static int history_path(char *path, size_t size){
+    char *custom = getenv(HISTORY_ENV_NAME);
+    if (custom != NULL && custom[0] != '\0') {
+        return snprintf(path, size, "%s", custom) < (int) size ? 0 : -1;
+    }
+    char *home = getenv("HOME");
+    if (home == NULL) {
+        return -1;
+    }
+    return snprintf(path, size, "%s/%s", home, HISTORY_FILE) < (int) size ? 0 : -1;
+}
+
+
+int history_open(void){
+    char path[MAX_PATH_STR];
+    if (history_fd != -1 || history_path(path, sizeof(path)) == -1) {
+        return -1;
+    }
+    history_fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history_fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(history_fd, &st) == -1 || st.st_size == 0) {
+        return 0;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, history_fd, 0);
+    if (map == MAP_FAILED) {
+        // still record this session, just without the older entries
+        perror("mmap");
+        return 0;
+    }
+    history_map = (const char *) map;
+    history_map_size = st.st_size;
+    scan_end = history_map_size;
+    return 0;
+}
+
+
+static bool index_next_entry(void){
+    // Step back over one line; blank lines are not entries
+    while (scan_end > 0) {
+        size_t end = scan_end;
+        if (history_map[end - 1] == '\n') {
+            end--;
+        }
+        const char *nl = (const char *) memrchr(history_map, '\n', end);
+        size_t start = nl != NULL ? (size_t) (nl - history_map) + 1 : 0;
+        scan_end = start;
+        if (end == start) {
+            continue;
+        }
+
+        if (file_indexed == file_index_cap) {
+            size_t new_cap = file_index_cap ? file_index_cap * 2 : 256;
+            HistoryEntry *grown = (HistoryEntry *) realloc(
+                file_index, new_cap * sizeof(HistoryEntry));
+            if (grown == NULL) {
+                scan_end = 0;
+                return false;
+            }
+            file_index = grown;
+            file_index_cap = new_cap;
+        }
+        file_index[file_indexed].offset = start;
+        file_index[file_indexed].len = end - start;
+        file_indexed++;
+        return true;
+    }
+    return false;
+}
+
+
+const char *history_get(size_t index, size_t *len){
+    if (index < session_count) {
+        const char *entry = session[session_count - 1 - index];
+        *len = strlen(entry);
+        return entry;
+    }
+    index -= session_count;
+    while (file_indexed <= index && index_next_entry());
+    if (index >= file_indexed) {
+        return NULL;
+    }
+    *len = file_index[index].len;
+    return history_map + file_index[index].offset;
+}
+
+
+static size_t trigram_bucket(const char *p){
+    uint32_t gram = (uint32_t) (unsigned char) p[0] << 16 |
+                    (uint32_t) (unsigned char) p[1] << 8 |
+                    (unsigned char) p[2];
+    return (gram * 2654435761u) >> 19;  // top 13 bits, TRIGRAM_BUCKETS
+}
+
+
+static void build_trigram_index(void){
+    trigram_tried = true;
+    while (index_next_entry());
+    if (file_indexed == 0) {
+        return;
+    }
+    size_t blocks = (file_indexed + TRIGRAM_BLOCK - 1) / TRIGRAM_BLOCK;
+    block_words = (blocks + 63) / 64;
+    trigram_bits = (uint64_t *) calloc(TRIGRAM_BUCKETS * block_words,
+                                       sizeof(uint64_t));
+    if (trigram_bits == NULL) {
+        // searches still work, by scanning
+        perror("calloc");
+        return;
+    }
+    for (size_t i = 0; i < file_indexed; i++) {
+        const char *entry = history_map + file_index[i].offset;
+        size_t block = i / TRIGRAM_BLOCK;
+        uint64_t bit = (uint64_t) 1 << (block % 64);
+        for (size_t j = 0; j + 3 <= file_index[i].len; j++) {
+            trigram_bits[trigram_bucket(entry + j) * block_words + block / 64] |= bit;
+        }
+    }
+}
+
+
+static bool entry_matches(const char *entry, size_t len, const char *needle,
+                          size_t needle_len, bool prefix){
+    return prefix ?
+        len >= needle_len && memcmp(entry, needle, needle_len) == 0 :
+        memmem(entry, len, needle, needle_len) != NULL;
+}
+
+
+/*
+** history_search over the file entries alone, i being a file index.
+*/
+static long search_file(const char *needle, size_t needle_len, long i,
+                        int direction, bool prefix){
+    if (needle_len >= 3 && !trigram_tried) {
+        build_trigram_index();
+    }
+    if (needle_len < 3 || trigram_bits == NULL) {
+        for (; i >= 0; i += direction) {
+            while (file_indexed <= (size_t) i && index_next_entry());
+            if ((size_t) i >= file_indexed) {
+                break;
+            }
+            if (entry_matches(history_map + file_index[i].offset,
+                              file_index[i].len, needle, needle_len, prefix)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Spread the probes over the needle, so a long one still checks its end
+    size_t rows[TRIGRAM_MAX_PROBES];
+    size_t grams = needle_len - 2;
+    size_t probes = grams < TRIGRAM_MAX_PROBES ? grams : TRIGRAM_MAX_PROBES;
+    for (size_t p = 0; p < probes; p++) {
+        size_t at = probes > 1 ? p * (grams - 1) / (probes - 1) : 0;
+        rows[p] = trigram_bucket(needle + at) * block_words;
+    }
+
+    while (i >= 0 && (size_t) i < file_indexed) {
+        size_t block = i / TRIGRAM_BLOCK;
+        uint64_t bit = (uint64_t) 1 << (block % 64);
+        bool possible = true;
+        for (size_t p = 0; p < probes && possible; p++) {
+            possible = (trigram_bits[rows[p] + block / 64] & bit) != 0;
+        }
+        if (!possible) {
+            i = direction > 0 ? (long) ((block + 1) * TRIGRAM_BLOCK) :
+                                (long) (block * TRIGRAM_BLOCK) - 1;
+            continue;
+        }
+        if (entry_matches(history_map + file_index[i].offset,
+                          file_index[i].len, needle, needle_len, prefix)) {
+            return i;
+        }
+        i += direction;
+    }
+    return -1;
+}
+
+
+long history_search(const char *needle, size_t needle_len, long from,
+                    int direction, bool prefix){
+    long session_end = (long) session_count;
+    if (from < 0) {
+        return -1;
+    }
+    // Walking back toward the newest, the file entries come first
+    if (direction < 0 && from >= session_end) {
+        long found = search_file(needle, needle_len, from - session_end,
+                                 direction, prefix);
+        if (found != -1) {
+            return found + session_end;
+        }
+        from = session_end - 1;
+    }
+    for (long i = from; i >= 0 && i < session_end; i += direction) {
+        const char *entry = session[session_count - 1 - i];
+        if (entry_matches(entry, strlen(entry), needle, needle_len, prefix)) {
+            return i;
+        }
+    }
+    if (direction > 0) {
+        long start = from > session_end ? from - session_end : 0;
+        long found = search_file(needle, needle_len, start, direction, prefix);
+        if (found != -1) {
+            return found + session_end;
+        }
+    }
+    return -1;
+}
+
+
+int history_add(const char *line){
+    size_t len = strlen(line);
+    size_t last_len;
+    const char *last = history_get(0, &last_len);
+    if (len == 0 || (last != NULL && last_len == len && memcmp(last, line, len) == 0)) {
+        return 0;
+    }
+
+    if (session_count == session_cap) {
+        size_t new_cap = session_cap ? session_cap * 2 : 64;
+        char **grown = (char **) realloc(session, new_cap * sizeof(char *));
+        if (grown == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        session = grown;
+        session_cap = new_cap;
+    }
+    char *entry = (char *) malloc(len + 2);
+    if (entry == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    memcpy(entry, line, len);
+    entry[len] = '\0';
+    session[session_count++] = entry;
+
+    if (history_fd == -1) {
+        return 0;
+    }
+    // the newline goes out in the same write, so it cannot be split off
+    entry[len] = '\n';
+    ssize_t written = write(history_fd, entry, len + 1);
+    entry[len] = '\0';
+    if (written != (ssize_t) len + 1) {
+        perror("write");
+        return -1;
+    }
+    return 0;
+}
+
+
+void history_close(void){
+    if (history_map != NULL) {
+        munmap((void *) history_map, history_map_size);
+        history_map = NULL;
+    }
+    if (history_fd != -1) {
+        close(history_fd);
+        history_fd = -1;
+    }
+    for (size_t i = 0; i < session_count; i++) {
+        free(session[i]);
+    }
+    free(session);
+    free(file_index);
+    free(trigram_bits);
+    session = NULL;
+    file_index = NULL;
+    trigram_bits = NULL;
+    block_words = 0;
+    trigram_tried = false;
+    session_count = session_cap = 0;
+    file_indexed = file_index_cap = scan_end = 0;
+}
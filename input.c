@@ -0,0 +1,160 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** Line input for the `read` builtin. Reading a byte at a time is the only
+** way to never read past the newline, and costs a syscall per byte, so
+** a seekable fd gets a buffer filled READ_BUFFER_SIZE bytes at a time
+** instead.
+**
+** It is read ahead with pread and then moved just past the line with
+** lseek, as if only the line had been read, so a command run between two
+** reads starts at the right place; the buffer is kept, and used again as
+** long as the offset is still where it was left. A pipe cannot be
+** rewound, and whatever reads it after `read` must get the rest of it,
+** so a pipe is read a byte at a time, as POSIX asks.
+*/
+typedef struct ReadBuffer {
+    dev_t dev;                  // what the fd was when the buffer was filled
+    ino_t ino;
+    bool seekable;
+    off_t end_offset;           // seekable: file offset of data + len
+    char *data;
+    size_t start;               // next unread byte
+    size_t len;
+} ReadBuffer;
+
+static ReadBuffer *buffers = NULL;
+static int num_buffers = 0;
+
+
+static ReadBuffer *buffer_for(int fd){
+    /**
+     * The buffer for fd, emptied if fd is not what it was the last time
+     * or, when seekable, was moved since.
+    */
+    if (fd >= num_buffers) {
+        int new_count = fd + 1 > 2 * num_buffers ? fd + 1 : 2 * num_buffers;
+        ReadBuffer *grown = (ReadBuffer *) realloc(buffers, new_count * sizeof(ReadBuffer));
+        if (grown == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        memset(grown + num_buffers, 0, (new_count - num_buffers) * sizeof(ReadBuffer));
+        buffers = grown;
+        num_buffers = new_count;
+    }
+    ReadBuffer *buf = &buffers[fd];
+    if (buf->data == NULL) {
+        buf->data = (char *) malloc(READ_BUFFER_SIZE);
+        if (buf->data == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        return NULL;
+    }
+    bool seekable = S_ISREG(st.st_mode) || S_ISBLK(st.st_mode);
+    off_t offset = seekable ? lseek(fd, 0, SEEK_CUR) : 0;
+    if (offset == -1) {
+        perror("lseek");
+        return NULL;
+    }
+    bool same = buf->dev == st.st_dev && buf->ino == st.st_ino &&
+        buf->seekable == seekable;
+    if (same && seekable) {
+        // the offset was left at the first unread byte
+        same = offset == buf->end_offset - (off_t) (buf->len - buf->start);
+    }
+    if (!same) {
+        buf->dev = st.st_dev;
+        buf->ino = st.st_ino;
+        buf->seekable = seekable;
+        buf->start = buf->len = 0;
+        buf->end_offset = offset;
+    }
+    return buf;
+}
+
+
+int read_fd_line(int fd, const char **line, size_t *len){
+    ReadBuffer *buf = buffer_for(fd);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    // seekable: where the fd is now
+    off_t offset = buf->end_offset - (off_t) (buf->len - buf->start);
+    size_t scanned = buf->start;
+    char *nl;
+    while ((nl = memchr(buf->data + scanned, '\n', buf->len - scanned)) == NULL) {
+        // keep the partial line, make room behind it and read more
+        if (buf->start > 0) {
+            memmove(buf->data, buf->data + buf->start, buf->len - buf->start);
+            buf->len -= buf->start;
+            buf->start = 0;
+        }
+        scanned = buf->len;
+        if (buf->len == READ_BUFFER_SIZE) {
+            // a line longer than the buffer comes back in pieces
+            break;
+        }
+        // a seekable fd is read past where it is, so its offset stays put;
+        // anything else is never read past the newline
+        ssize_t got;
+        while ((got = buf->seekable ?
+                pread(fd, buf->data + buf->len, READ_BUFFER_SIZE - buf->len, buf->end_offset) :
+                read(fd, buf->data + buf->len, 1)) == -1 &&
+               errno == EINTR);
+        if (got == -1) {
+            perror("read");
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        buf->len += got;
+        buf->end_offset += got;
+    }
+
+    *line = buf->data + buf->start;
+    size_t used;
+    int ret;
+    if (nl != NULL) {
+        *len = nl - *line;
+        used = *len + 1;
+        ret = 1;
+    }
+    else {
+        // EOF, or a full buffer: whatever is there is the line
+        *len = buf->len - buf->start;
+        used = *len;
+        ret = buf->len == READ_BUFFER_SIZE ? 1 : 0;
+    }
+    buf->start += used;
+
+    off_t consumed = buf->end_offset - (off_t) (buf->len - buf->start);
+    if (buf->seekable && consumed != offset && lseek(fd, consumed, SEEK_SET) == -1) {
+        perror("lseek");
+        return -1;
+    }
+    return ret;
+}
+
+
+void free_read_buffers(void){
+    for (int i = 0; i < num_buffers; i++) {
+        free(buffers[i].data);
+    }
+    free(buffers);
+    buffers = NULL;
+    num_buffers = 0;
+}
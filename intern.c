@@ -0,0 +1,149 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** String interner. Each distinct string is stored once, packed into
+** large chunks, and lives until free_interned(); two interned strings
+** are equal exactly when the pointers are. The table is open addressed
+** and kept at most half full.
+*/
+#define INTERN_CHUNK_SIZE 65536
+#define INTERN_MIN_SLOTS 256
+
+typedef struct InternSlot {
+    const char *str;
+    uint32_t hash;
+    uint32_t len;
+} InternSlot;
+
+typedef struct InternChunk {
+    struct InternChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} InternChunk;
+
+static InternSlot *slots = NULL;
+static size_t slots_mask = 0;       // slot count - 1, a power of two
+static size_t interned = 0;
+static InternChunk *chunks = NULL;
+
+
+static uint32_t hash_string(const char *str, size_t len){
+    // FNV-1a, as for the snapshot key
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+static InternSlot *find_slot(const char *str, size_t len, uint32_t hash){
+    // the table is never full, so this stops at an empty slot
+    for (size_t i = hash & slots_mask; ; i = (i + 1) & slots_mask) {
+        InternSlot *slot = &slots[i];
+        if (slot->str == NULL ||
+            (slot->hash == hash && slot->len == len &&
+             memcmp(slot->str, str, len) == 0)) {
+            return slot;
+        }
+    }
+}
+
+
+static int grow_table(void){
+    size_t new_count = slots ? (slots_mask + 1) * 2 : INTERN_MIN_SLOTS;
+    InternSlot *old = slots;
+    size_t old_count = slots ? slots_mask + 1 : 0;
+
+    slots = (InternSlot *) calloc(new_count, sizeof(InternSlot));
+    if (slots == NULL) {
+        perror("calloc");
+        slots = old;
+        return -1;
+    }
+    slots_mask = new_count - 1;
+    for (size_t i = 0; i < old_count; i++) {
+        if (old[i].str != NULL) {
+            *find_slot(old[i].str, old[i].len, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+
+static char *chunk_alloc(size_t size){
+    if (chunks == NULL || chunks->size - chunks->used < size) {
+        size_t data_size = size > INTERN_CHUNK_SIZE ? size : INTERN_CHUNK_SIZE;
+        InternChunk *chunk = (InternChunk *) malloc(sizeof(InternChunk) + data_size);
+        if (chunk == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+        chunk->next = chunks;
+        chunk->used = 0;
+        chunk->size = data_size;
+        chunks = chunk;
+    }
+    char *ptr = chunks->data + chunks->used;
+    chunks->used += size;
+    return ptr;
+}
+
+
+const char *intern_n(const char *str, size_t len){
+    if ((interned + 1) * 2 > (slots ? slots_mask + 1 : 0) && grow_table() == -1) {
+        return NULL;
+    }
+    uint32_t hash = hash_string(str, len);
+    InternSlot *slot = find_slot(str, len, hash);
+    if (slot->str != NULL) {
+        return slot->str;
+    }
+
+    char *copy = chunk_alloc(len + 1);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    slot->str = copy;
+    slot->hash = hash;
+    slot->len = (uint32_t) len;
+    interned++;
+    return copy;
+}
+
+
+const char *intern(const char *str){
+    return intern_n(str, strlen(str));
+}
+
+
+const char *intern_lookup(const char *str){
+    if (slots == NULL) {
+        return NULL;
+    }
+    size_t len = strlen(str);
+    return find_slot(str, len, hash_string(str, len))->str;
+}
+
+
+void free_interned(void){
+    while (chunks != NULL) {
+        InternChunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+    free(slots);
+    slots = NULL;
+    slots_mask = 0;
+    interned = 0;
+}
@@ -0,0 +1,467 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+
+// The line being edited; buf is always NUL terminated
+typedef struct LineState {
+    const char *prompt;
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t pos;
+    long history_index;         // entry being shown, -1 for the new line
+    char *saved;                // the new line, while browsing history
+    size_t saved_len;
+} LineState;
+
+static int read_escape(LineState *ls);
+
+
+static int write_all(const char *data, size_t len){
+    while (len > 0) {
+        ssize_t written = write(STDOUT_FILENO, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+
+static int enable_raw_mode(struct termios *saved){
+    if (tcgetattr(STDIN_FILENO, saved) == -1) {
+        return -1;
+    }
+    struct termios raw = *saved;
+    // byte at a time, no echo, Ctrl-C/Ctrl-Z/Ctrl-V arrive as keys;
+    // output processing stays on, so "\n" is written as "\r\n"
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+}
+
+
+static void refresh_line(LineState *ls){
+    // one write per redraw: prompt, text, clear the rest, put the cursor back
+    char out[MAX_SINGLE_LINE + MAX_PATH_STR + 64];
+    int n = snprintf(out, sizeof(out), "\r%s%s\x1b[K", ls->prompt, ls->buf);
+    if (n < 0 || (size_t) n >= sizeof(out)) {
+        n = sizeof(out) - 1;
+    }
+    if (ls->pos < ls->len) {
+        n += snprintf(out + n, sizeof(out) - n, "\x1b[%zuD", ls->len - ls->pos);
+    }
+    write_all(out, n);
+}
+
+
+static bool insert_text(LineState *ls, const char *text, size_t len){
+    if (ls->len + len + 1 >= ls->cap) {
+        write_all("\a", 1);
+        return false;
+    }
+    memmove(ls->buf + ls->pos + len, ls->buf + ls->pos, ls->len - ls->pos + 1);
+    memcpy(ls->buf + ls->pos, text, len);
+    ls->len += len;
+    ls->pos += len;
+    return true;
+}
+
+
+static void delete_range(LineState *ls, size_t from, size_t to){
+    memmove(ls->buf + from, ls->buf + to, ls->len - to + 1);
+    ls->len -= to - from;
+    ls->pos = from;
+}
+
+
+static void set_text(LineState *ls, const char *text, size_t len){
+    len = len < ls->cap - 1 ? len : ls->cap - 1;
+    memmove(ls->buf, text, len);
+    ls->buf[len] = '\0';
+    ls->len = ls->pos = len;
+}
+
+
+static void history_step(LineState *ls, int direction){
+    // Up/Down only visit entries starting with what had been typed
+    if (ls->history_index == -1) {
+        if (direction < 0) {
+            return;
+        }
+        memcpy(ls->saved, ls->buf, ls->len + 1);
+        ls->saved_len = ls->len;
+    }
+    long found = -1;
+    if (direction > 0 || ls->history_index > 0) {
+        found = history_search(ls->saved, ls->saved_len,
+                               ls->history_index + direction, direction, true);
+    }
+    if (found == -1) {
+        if (direction > 0) {
+            write_all("\a", 1);
+        }
+        else {
+            // past the newest entry: back to the line being typed
+            ls->history_index = -1;
+            set_text(ls, ls->saved, ls->saved_len);
+        }
+        return;
+    }
+    size_t len;
+    const char *entry = history_get(found, &len);
+    ls->history_index = found;
+    set_text(ls, entry, len);
+}
+
+
+static int reverse_search(LineState *ls){
+    /**
+     * Ctrl-R: incremental search back through history for a substring.
+     * Returns 1 if the match was accepted with Enter, 0 when back to
+     * editing, -1 on EOF.
+    */
+    char query[MAX_SINGLE_LINE];
+    size_t query_len = 0;
+    long match = -1;
+    memcpy(ls->saved, ls->buf, ls->len + 1);
+    ls->saved_len = ls->len;
+
+    while (1) {
+        size_t len = 0;
+        const char *entry = match >= 0 ? history_get(match, &len) : "";
+        char out[MAX_SINGLE_LINE * 2 + 64];
+        int n = snprintf(out, sizeof(out), "\r(reverse-i-search)`%.*s': %.*s\x1b[K",
+                         (int) query_len, query, (int) len, entry);
+        write_all(out, n < (int) sizeof(out) ? (size_t) n : sizeof(out) - 1);
+
+        char c;
+        ssize_t got = read(STDIN_FILENO, &c, 1);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return -1;
+        }
+
+        if (c == KEY_CTRL('r')) {
+            long older = query_len > 0 ?
+                history_search(query, query_len, match + 1, 1, false) : -1;
+            if (older == -1) {
+                write_all("\a", 1);
+            }
+            match = older != -1 ? older : match;
+            continue;
+        }
+        if (c == KEY_CTRL('g') || c == KEY_CTRL('c')) {
+            set_text(ls, ls->saved, ls->saved_len);
+            return 0;
+        }
+        if (c == KEY_BACKSPACE || c == KEY_CTRL('h')) {
+            query_len -= query_len > 0;
+            match = query_len > 0 ? history_search(query, query_len, 0, 1, false) : -1;
+            continue;
+        }
+        if ((unsigned char) c >= ' ' && query_len + 1 < sizeof(query)) {
+            // a longer query can still match the current entry
+            query[query_len++] = c;
+            long found = history_search(query, query_len, match > 0 ? match : 0, 1, false);
+            if (found == -1) {
+                write_all("\a", 1);
+                query_len--;
+            }
+            match = found != -1 ? found : match;
+            continue;
+        }
+
+        // anything else takes the match and goes back to editing
+        if (match >= 0) {
+            set_text(ls, entry, len);
+            ls->history_index = match;
+        }
+        if (c == '\r' || c == '\n') {
+            return 1;
+        }
+        if (c == KEY_ESC) {
+            return read_escape(ls) == -1 ? -1 : 0;
+        }
+        return 0;
+    }
+}
+
+
+static void list_matches(LineState *ls, Completion *comp){
+    struct winsize ws;
+    size_t width = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+        width = ws.ws_col;
+    }
+    size_t widest = 0;
+    for (size_t i = 0; i < comp->num_matches; i++) {
+        size_t len = strlen(comp->matches[i]);
+        widest = len > widest ? len : widest;
+    }
+    size_t columns = width / (widest + 2);
+    columns = columns ? columns : 1;
+
+    write_all("\n", 1);
+    for (size_t i = 0; i < comp->num_matches; i++) {
+        char cell[MAX_SINGLE_LINE + 4];
+        bool last = (i + 1) % columns == 0 || i + 1 == comp->num_matches;
+        int n = snprintf(cell, sizeof(cell), "%-*s%s", last ? 0 : (int) (widest + 2),
+                         comp->matches[i], last ? "\n" : "");
+        write_all(cell, n < (int) sizeof(cell) ? (size_t) n : sizeof(cell) - 1);
+    }
+    if (comp->total_matches > comp->num_matches) {
+        char more[64];
+        int n = snprintf(more, sizeof(more), "... and %zu more\n",
+                         comp->total_matches - comp->num_matches);
+        write_all(more, n);
+    }
+    refresh_line(ls);
+}
+
+
+static void complete_at_cursor(LineState *ls){
+    size_t start = ls->pos;
+    // words also end at the operators that need no spaces around them
+    while (start > 0 && !isspace((unsigned char) ls->buf[start - 1]) &&
+           ls->buf[start - 1] != '|' && ls->buf[start - 1] != ';' &&
+           !(start >= 2 && ls->buf[start - 1] == '&' && ls->buf[start - 2] == '&')) {
+        start--;
+    }
+
+    Completion *comp = (Completion *) malloc(sizeof(Completion));
+    if (comp == NULL) {
+        return;
+    }
+    size_t word_len = ls->pos - start;
+    int found = complete_word(ls->buf, start, ls->pos, comp);
+
+    if (found == 0) {
+        write_all("\a", 1);
+    }
+    else if (comp->common_len > word_len) {
+        // extend the word as far as every candidate agrees
+        insert_text(ls, comp->common + word_len, comp->common_len - word_len);
+        if (found == 1 && comp->common[comp->common_len - 1] != '/') {
+            insert_text(ls, " ", 1);
+        }
+        refresh_line(ls);
+    }
+    else if (found == 1) {
+        if (comp->common_len > 0 && comp->common[comp->common_len - 1] != '/') {
+            insert_text(ls, " ", 1);
+            refresh_line(ls);
+        }
+    }
+    else {
+        list_matches(ls, comp);
+    }
+    free_completion_matches(comp);
+    free(comp);
+}
+
+
+static int read_escape(LineState *ls){
+    char seq[3];
+    if (read(STDIN_FILENO, &seq[0], 1) != 1 || read(STDIN_FILENO, &seq[1], 1) != 1) {
+        return -1;
+    }
+    if (seq[0] == '[' && isdigit((unsigned char) seq[1])) {
+        // ESC [ n ~
+        if (read(STDIN_FILENO, &seq[2], 1) != 1 || seq[2] != '~') {
+            return 0;
+        }
+        if (seq[1] == '1' || seq[1] == '7') {
+            ls->pos = 0;
+        }
+        else if (seq[1] == '4' || seq[1] == '8') {
+            ls->pos = ls->len;
+        }
+        else if (seq[1] == '3' && ls->pos < ls->len) {
+            delete_range(ls, ls->pos, ls->pos + 1);
+        }
+        return 0;
+    }
+    if (seq[0] != '[' && seq[0] != 'O') {
+        return 0;
+    }
+    switch (seq[1]) {
+        case 'A':
+            history_step(ls, 1);
+            break;
+        case 'B':
+            history_step(ls, -1);
+            break;
+        case 'C':
+            ls->pos += ls->pos < ls->len;
+            break;
+        case 'D':
+            ls->pos -= ls->pos > 0;
+            break;
+        case 'H':
+            ls->pos = 0;
+            break;
+        case 'F':
+            ls->pos = ls->len;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+
+static char *edit_line(LineState *ls){
+    refresh_line(ls);
+    while (1) {
+        char c;
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return NULL;
+        }
+
+        switch (c) {
+            case '\r':
+            case '\n':
+                write_all("\n", 1);
+                return ls->buf;
+            case '\t':
+                complete_at_cursor(ls);
+                continue;
+            case KEY_CTRL('c'):
+                // drop the line, start over on a fresh prompt
+                write_all("^C\n", 3);
+                ls->len = ls->pos = 0;
+                ls->buf[0] = '\0';
+                break;
+            case KEY_CTRL('d'):
+                if (ls->len == 0) {
+                    return NULL;
+                }
+                if (ls->pos < ls->len) {
+                    delete_range(ls, ls->pos, ls->pos + 1);
+                }
+                break;
+            case KEY_BACKSPACE:
+            case KEY_CTRL('h'):
+                if (ls->pos > 0) {
+                    delete_range(ls, ls->pos - 1, ls->pos);
+                }
+                break;
+            case KEY_CTRL('a'):
+                ls->pos = 0;
+                break;
+            case KEY_CTRL('e'):
+                ls->pos = ls->len;
+                break;
+            case KEY_CTRL('b'):
+                ls->pos -= ls->pos > 0;
+                break;
+            case KEY_CTRL('f'):
+                ls->pos += ls->pos < ls->len;
+                break;
+            case KEY_CTRL('k'):
+                delete_range(ls, ls->pos, ls->len);
+                ls->pos = ls->len;
+                break;
+            case KEY_CTRL('u'):
+                delete_range(ls, 0, ls->pos);
+                break;
+            case KEY_CTRL('w'): {
+                size_t from = ls->pos;
+                while (from > 0 && isspace((unsigned char) ls->buf[from - 1])) {
+                    from--;
+                }
+                while (from > 0 && !isspace((unsigned char) ls->buf[from - 1])) {
+                    from--;
+                }
+                delete_range(ls, from, ls->pos);
+                break;
+            }
+            case KEY_CTRL('p'):
+                history_step(ls, 1);
+                break;
+            case KEY_CTRL('n'):
+                history_step(ls, -1);
+                break;
+            case KEY_CTRL('r'): {
+                int accepted = reverse_search(ls);
+                if (accepted == -1) {
+                    return NULL;
+                }
+                if (accepted == 1) {
+                    refresh_line(ls);
+                    write_all("\n", 1);
+                    return ls->buf;
+                }
+                break;
+            }
+            case KEY_CTRL('l'):
+                write_all("\x1b[H\x1b[2J", 7);
+                break;
+            case KEY_ESC:
+                if (read_escape(ls) == -1) {
+                    return NULL;
+                }
+                break;
+            default:
+                if ((unsigned char) c < ' ') {
+                    continue;
+                }
+                insert_text(ls, &c, 1);
+                break;
+        }
+        refresh_line(ls);
+    }
+}
+
+
+char *read_line_edit(const char *prompt_str, char *line, size_t line_length){
+    struct termios saved;
+    if (!isatty(STDIN_FILENO) || enable_raw_mode(&saved) == -1) {
+        fputs(prompt_str, stdout);
+        fflush(stdout);
+        return fgets(line, line_length, stdin);
+    }
+    fflush(stdout);
+
+    // keep room for the newline fgets would have left
+    char saved_line[MAX_SINGLE_LINE];
+    if (line_length > sizeof(saved_line)) {
+        line_length = sizeof(saved_line);
+    }
+    LineState ls = {prompt_str, line, line_length - 1, 0, 0, -1, saved_line, 0};
+    line[0] = '\0';
+    char *ret = edit_line(&ls);
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+    if (ret == NULL) {
+        return NULL;
+    }
+    line[ls.len] = '\n';
+    line[ls.len + 1] = '\0';
+    return line;
+}
@@ -0,0 +1,811 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** Command lists: pipelines joined by ';', newlines, '&&' and '||', and
+** the compound commands built out of them:
+**
+**   while LIST; do LIST; done [< FILE]
+**   if LIST; then LIST; [elif LIST; then LIST;]... [else LIST;] fi
+**   NAME() { LIST; }
+**
+** Text is split into its pipelines once, up front, and the keywords then
+** group them into a tree; each pipeline is only expanded and parsed when
+** the list reaches it, so `cd dir && ls *` globs in dir and `A=1; echo $A`
+** sees the new value.
+*/
+ShellState shell_state = {0, 0, false, false, false, false, false, false};
+
+typedef enum ListOp {LIST_SEQ, LIST_AND, LIST_OR} ListOp;
+
+typedef struct CommandList {
+    char *text;                 // one pipeline, as written
+    ListOp op;                  // how it joins the one before it
+    struct CommandList *next;
+} CommandList;
+
+typedef enum NodeKind {NODE_PIPELINE, NODE_WHILE, NODE_IF, NODE_FUNCTION} NodeKind;
+
+struct ListNode {
+    NodeKind kind;
+    ListOp op;                  // how it joins the one before it
+    char *text;                 // NODE_PIPELINE; NODE_FUNCTION: the name
+    struct ListNode *cond;      // NODE_WHILE: runs the body while this is 0
+    struct ListNode *body;      // NODE_IF: runs the body if this is 0;
+                                // NODE_FUNCTION: what a call runs
+    struct ListNode *alt;       // NODE_IF: else this; an elif is a NODE_IF here
+    char *redir_in_path;        // `done < FILE`, expanded when the loop starts
+    PipelineTemplate *pipeline; // NODE_PIPELINE: text, parsed the first time
+    bool compiled;              // it runs; NULL then means parse it every time
+    struct ListNode *next;
+};
+
+// set -e is off in whatever a tested command runs, function bodies included
+static bool errexit_ignored = false;
+
+// the pipeline that may replace the shell, see run_line
+static const struct ListNode *exec_node = NULL;
+
+// needs_more_lines only looks: run_line will report the same errors
+static bool checking_only = false;
+#define SYNTAX_ERROR(...) if (!checking_only) { ERR_PRINT(__VA_ARGS__); }
+
+// what build_sequence ran into
+typedef enum BuildStatus {BUILD_OK, BUILD_INCOMPLETE, BUILD_ERROR} BuildStatus;
+
+
+static void free_list(CommandList *list){
+    while (list != NULL) {
+        CommandList *next = list->next;
+        free(list->text);
+        free(list);
+        list = next;
+    }
+}
+
+
+static int add_item(CommandList ***tail, const char *start, const char *end, ListOp op){
+    /**
+     * Appends [start, end) joined by op. Blank pipelines are only valid
+     * around ';'. Returns 0, or -1 on a syntax or allocation error.
+    */
+    bool blank = true;
+    for (const char *c = start; c < end && blank; c++) {
+        blank = isspace((unsigned char) *c);
+    }
+    if (blank) {
+        if (op != LIST_SEQ) {
+            SYNTAX_ERROR(ERR_LIST_SYNTAX, op == LIST_AND ? "&&" : "||");
+            return -1;
+        }
+        return 0;
+    }
+
+    CommandList *item = (CommandList *) malloc(sizeof(CommandList));
+    if (item == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    item->text = strndup(start, end - start);
+    if (item->text == NULL) {
+        perror("malloc");
+        free(item);
+        return -1;
+    }
+    item->op = op;
+    item->next = NULL;
+    **tail = item;
+    *tail = &item->next;
+    return 0;
+}
+
+
+static CommandList *parse_list(const char *line){
+    /**
+     * Splits line at every ';', newline, '&&' and '||' outside of $(...),
+     * leaving out comments. Returns the list, NULL if there is nothing to
+     * run, or (CommandList *) -1 on error.
+    */
+    CommandList *head = NULL;
+    CommandList **tail = &head;
+    ListOp op = LIST_SEQ;
+    const char *start = line;
+    int depth = 0;
+
+    for (const char *c = line; ; c++) {
+        bool comment = depth == 0 && *c == '#' &&
+            (c == line || isspace((unsigned char) c[-1]));
+        if (*c == '\0' || comment) {
+            // a trailing '&&' or '||' is caught as a blank pipeline
+            if (add_item(&tail, start, c, op) == -1) {
+                free_list(head);
+                return (CommandList *) -1;
+            }
+            // a comment runs to the end of its line
+            const char *eol = comment ? strchr(c, '\n') : NULL;
+            if (eol == NULL) {
+                return head;
+            }
+            op = LIST_SEQ;
+            c = eol;
+            start = c + 1;
+            continue;
+        }
+        if (*c == '$' && c[1] == '(') {
+            depth++;
+            c++;
+            continue;
+        }
+        if (depth > 0) {
+            depth += *c == '(';
+            depth -= *c == ')';
+            continue;
+        }
+
+        ListOp next_op;
+        if (*c == ';' || *c == '\n') {
+            next_op = LIST_SEQ;
+        }
+        else if ((*c == '&' && c[1] == '&') || (*c == '|' && c[1] == '|')) {
+            next_op = *c == '&' ? LIST_AND : LIST_OR;
+        }
+        else {
+            continue;
+        }
+        // the pipeline before an operator has to be there
+        CommandList **before = tail;
+        if (add_item(&tail, start, c, op) == -1) {
+            free_list(head);
+            return (CommandList *) -1;
+        }
+        if (next_op != LIST_SEQ && tail == before) {
+            SYNTAX_ERROR(ERR_LIST_SYNTAX, next_op == LIST_AND ? "&&" : "||");
+            free_list(head);
+            return (CommandList *) -1;
+        }
+        op = next_op;
+        c += next_op != LIST_SEQ;
+        start = c + 1;
+    }
+}
+
+
+static int run_pipeline(ListNode *node, Variable **root, bool exec_last){
+    // a loop or function body is only cut up once, then just expanded
+    if (!node->compiled) {
+        node->pipeline = compile_pipeline(node->text);
+        node->compiled = true;
+    }
+    shell_state.subst_status = 0;
+    Command *commands = node->pipeline != NULL ?
+        instantiate_pipeline(node->pipeline, root) : parse_line(node->text, root);
+    if (commands == (Command *) -1) {
+        ERR_PRINT(ERR_PARSING_LINE);
+        return 1;
+    }
+    if (commands == NULL) {
+        // an assignment or a comment: `X=$(false)` fails like false
+        return shell_state.subst_status;
+    }
+
+    // only now: a $(...) expanded above must not take it
+    shell_state.exec_last = exec_last;
+    int *ret_code = execute_line(commands);
+    if (ret_code == NULL || *ret_code == -1) {
+        // could not start the line; it failed, the shell carries on
+        ERR_PRINT(ERR_EXECUTE_LINE);
+        free(ret_code);
+        return 1;
+    }
+    int status = *ret_code;
+    free(ret_code);
+    return status;
+}
+
+
+static void free_nodes(ListNode *node){
+    while (node != NULL) {
+        ListNode *next = node->next;
+        free(node->text);
+        free_nodes(node->cond);
+        free_nodes(node->body);
+        free_nodes(node->alt);
+        free(node->redir_in_path);
+        free_pipeline(node->pipeline);
+        free(node);
+        node = next;
+    }
+}
+
+
+static ListNode *copy_nodes(const ListNode *node){
+    // a function keeps its own copy of the body it was defined with
+    ListNode *head = NULL;
+    ListNode **tail = &head;
+    for (; node != NULL; node = node->next) {
+        ListNode *copy = (ListNode *) calloc(1, sizeof(ListNode));
+        if (copy == NULL) {
+            perror("calloc");
+            free_nodes(head);
+            return NULL;
+        }
+        *tail = copy;
+        tail = &copy->next;
+        copy->kind = node->kind;
+        copy->op = node->op;
+        if ((node->text != NULL && (copy->text = strdup(node->text)) == NULL) ||
+            (node->redir_in_path != NULL &&
+             (copy->redir_in_path = strdup(node->redir_in_path)) == NULL)) {
+            perror("malloc");
+            free_nodes(head);
+            return NULL;
+        }
+        copy->cond = copy_nodes(node->cond);
+        copy->body = copy_nodes(node->body);
+        copy->alt = copy_nodes(node->alt);
+        if ((node->cond != NULL && copy->cond == NULL) ||
+            (node->body != NULL && copy->body == NULL) ||
+            (node->alt != NULL && copy->alt == NULL)) {
+            free_nodes(head);
+            return NULL;
+        }
+    }
+    return head;
+}
+
+
+static const char *skip_keyword(const char *text, const char *keyword){
+    /**
+     * If the first word of text is keyword, returns what follows it,
+     * else NULL.
+    */
+    while (isspace((unsigned char) *text)) {
+        text++;
+    }
+    size_t len = strlen(keyword);
+    if (strncmp(text, keyword, len) != 0 ||
+        (text[len] != '\0' && !isspace((unsigned char) text[len]))) {
+        return NULL;
+    }
+    return text + len;
+}
+
+
+static bool is_blank(const char *text){
+    while (isspace((unsigned char) *text)) {
+        text++;
+    }
+    return *text == '\0';
+}
+
+
+static const char *const keywords[] = {
+    "while", "do", "done", "if", "then", "elif", "else", "fi", "{", "}", NULL
+};
+
+// the keywords that can end each part of a compound
+static const char *const until_do[] = {"do", NULL};
+static const char *const until_done[] = {"done", NULL};
+static const char *const until_then[] = {"then", NULL};
+static const char *const until_branch[] = {"elif", "else", "fi", NULL};
+static const char *const until_fi[] = {"fi", NULL};
+static const char *const until_brace[] = {"}", NULL};
+
+
+static const char *leading_keyword(const CommandList *item){
+    for (int i = 0; keywords[i] != NULL; i++) {
+        if (skip_keyword(item->text, keywords[i]) != NULL) {
+            return keywords[i];
+        }
+    }
+    return NULL;
+}
+
+
+static void drop_keyword(CommandList **items, const char *keyword){
+    /**
+     * Cuts keyword off the front of the first item; what is left is a
+     * pipeline of its own, or nothing at all.
+    */
+    CommandList *item = *items;
+    const char *rest = skip_keyword(item->text, keyword);
+    if (is_blank(rest)) {
+        *items = item->next;
+        return;
+    }
+    memmove(item->text, rest, strlen(rest) + 1);
+    item->op = LIST_SEQ;
+}
+
+
+static ListNode *build_sequence(CommandList **items, const char *const *until,
+                                BuildStatus *status);
+
+
+static ListNode *build_while(CommandList **items, BuildStatus *status){
+    // while COND; do BODY; done [< FILE]
+    ListNode *node = (ListNode *) calloc(1, sizeof(ListNode));
+    if (node == NULL) {
+        perror("calloc");
+        *status = BUILD_ERROR;
+        return NULL;
+    }
+    node->kind = NODE_WHILE;
+    node->op = (*items)->op;
+    drop_keyword(items, "while");
+
+    node->cond = build_sequence(items, until_do, status);
+    if (*status == BUILD_OK) {
+        drop_keyword(items, "do");
+        node->body = build_sequence(items, until_done, status);
+    }
+    if (*status != BUILD_OK) {
+        free_nodes(node);
+        return NULL;
+    }
+
+    // `done`, and maybe `< FILE` after it
+    CommandList *done = *items;
+    *items = done->next;
+    const char *rest = skip_keyword(done->text, "done");
+    while (isspace((unsigned char) *rest)) {
+        rest++;
+    }
+    if (*rest == '<') {
+        rest++;
+        while (isspace((unsigned char) *rest)) {
+            rest++;
+        }
+        size_t len = strcspn(rest, " \t\n");
+        if (len == 0 || !is_blank(rest + len)) {
+            SYNTAX_ERROR(ERR_REDIR_FILE, '<');
+            *status = BUILD_ERROR;
+            free_nodes(node);
+            return NULL;
+        }
+        node->redir_in_path = strndup(rest, len);
+    }
+    else if (*rest != '\0') {
+        SYNTAX_ERROR(ERR_LIST_KEYWORD, "done");
+        *status = BUILD_ERROR;
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+static ListNode *build_if(CommandList **items, const char *keyword, BuildStatus *status){
+    /**
+     * if COND; then BODY; [elif ...] [else ALT;] fi, keyword being "if" or
+     * "elif". An elif is built as an if nested in the else, which ends at
+     * the same fi.
+    */
+    ListNode *node = (ListNode *) calloc(1, sizeof(ListNode));
+    if (node == NULL) {
+        perror("calloc");
+        *status = BUILD_ERROR;
+        return NULL;
+    }
+    node->kind = NODE_IF;
+    node->op = strcmp(keyword, "elif") == 0 ? LIST_SEQ : (*items)->op;
+    drop_keyword(items, keyword);
+
+    node->cond = build_sequence(items, until_then, status);
+    if (*status == BUILD_OK) {
+        drop_keyword(items, "then");
+        node->body = build_sequence(items, until_branch, status);
+    }
+    if (*status != BUILD_OK) {
+        free_nodes(node);
+        return NULL;
+    }
+
+    const char *branch = leading_keyword(*items);
+    if (strcmp(branch, "elif") == 0) {
+        node->alt = build_if(items, "elif", status);
+        if (node->alt == NULL) {
+            free_nodes(node);
+            return NULL;
+        }
+        return node;
+    }
+    if (strcmp(branch, "else") == 0) {
+        drop_keyword(items, "else");
+        node->alt = build_sequence(items, until_fi, status);
+        if (*status != BUILD_OK) {
+            free_nodes(node);
+            return NULL;
+        }
+    }
+
+    // `fi` ends the command; anything after it needs a ';' first
+    CommandList *fi = *items;
+    *items = fi->next;
+    if (!is_blank(skip_keyword(fi->text, "fi"))) {
+        SYNTAX_ERROR(ERR_LIST_KEYWORD, "fi");
+        *status = BUILD_ERROR;
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+static const char *function_header(const char *text, const char **name, size_t *name_len){
+    /**
+     * If text starts with `NAME()`, returns what follows it and sets
+     * *name and *name_len, else NULL.
+    */
+    while (isspace((unsigned char) *text)) {
+        text++;
+    }
+    *name = text;
+    if (!isalpha((unsigned char) *text) && *text != '_') {
+        return NULL;
+    }
+    while (isalnum((unsigned char) *text) || *text == '_') {
+        text++;
+    }
+    *name_len = text - *name;
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    if (*text++ != '(') {
+        return NULL;
+    }
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    return *text == ')' ? text + 1 : NULL;
+}
+
+
+static ListNode *build_function(CommandList **items, BuildStatus *status){
+    // NAME() { BODY; }, the '{' on the same line or the next
+    ListNode *node = (ListNode *) calloc(1, sizeof(ListNode));
+    if (node == NULL) {
+        perror("calloc");
+        *status = BUILD_ERROR;
+        return NULL;
+    }
+    node->kind = NODE_FUNCTION;
+    node->op = (*items)->op;
+    CommandList *item = *items;
+    const char *name;
+    size_t name_len;
+    const char *rest = function_header(item->text, &name, &name_len);
+    node->text = strndup(name, name_len);
+    if (node->text == NULL) {
+        perror("malloc");
+        *status = BUILD_ERROR;
+        free(node);
+        return NULL;
+    }
+    if (is_blank(rest)) {
+        *items = item->next;
+    }
+    else {
+        memmove(item->text, rest, strlen(rest) + 1);
+    }
+
+    if (*items == NULL) {
+        *status = BUILD_INCOMPLETE;
+        free_nodes(node);
+        return NULL;
+    }
+    if (skip_keyword((*items)->text, "{") == NULL) {
+        SYNTAX_ERROR(ERR_FUNCTION_BODY, node->text);
+        *status = BUILD_ERROR;
+        free_nodes(node);
+        return NULL;
+    }
+    drop_keyword(items, "{");
+    node->body = build_sequence(items, until_brace, status);
+    if (*status != BUILD_OK) {
+        free_nodes(node);
+        return NULL;
+    }
+
+    CommandList *close = *items;
+    *items = close->next;
+    if (!is_blank(skip_keyword(close->text, "}"))) {
+        SYNTAX_ERROR(ERR_LIST_KEYWORD, "}");
+        *status = BUILD_ERROR;
+        free_nodes(node);
+        return NULL;
+    }
+    return node;
+}
+
+
+static bool is_one_of(const char *keyword, const char *const *until){
+    for (; until != NULL && *until != NULL; until++) {
+        if (strcmp(keyword, *until) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static ListNode *build_sequence(CommandList **items, const char *const *until,
+                                BuildStatus *status){
+    /**
+     * Groups items into nodes up to one of the keywords in until, which is
+     * left for the caller, or to the end of the items if until is NULL.
+    */
+    ListNode *head = NULL;
+    ListNode **tail = &head;
+    const char *name;
+    size_t name_len;
+    *status = BUILD_OK;
+    while (*items != NULL) {
+        const char *keyword = leading_keyword(*items);
+        if (keyword != NULL && is_one_of(keyword, until)) {
+            if (head == NULL) {
+                // `while; do`, `then fi` and the like
+                SYNTAX_ERROR(ERR_LIST_KEYWORD, keyword);
+                *status = BUILD_ERROR;
+            }
+            return head;
+        }
+
+        ListNode *node = NULL;
+        if (keyword != NULL && strcmp(keyword, "while") == 0) {
+            node = build_while(items, status);
+            if (node == NULL) {
+                free_nodes(head);
+                return NULL;
+            }
+        }
+        else if (keyword != NULL && strcmp(keyword, "if") == 0) {
+            node = build_if(items, "if", status);
+            if (node == NULL) {
+                free_nodes(head);
+                return NULL;
+            }
+        }
+        else if (keyword == NULL && function_header((*items)->text, &name, &name_len)) {
+            node = build_function(items, status);
+            if (node == NULL) {
+                free_nodes(head);
+                return NULL;
+            }
+        }
+        else if (keyword != NULL) {
+            SYNTAX_ERROR(ERR_LIST_KEYWORD, keyword);
+            *status = BUILD_ERROR;
+            free_nodes(head);
+            return NULL;
+        }
+        else {
+            node = (ListNode *) calloc(1, sizeof(ListNode));
+            if (node == NULL) {
+                perror("calloc");
+                *status = BUILD_ERROR;
+                free_nodes(head);
+                return NULL;
+            }
+            node->kind = NODE_PIPELINE;
+            node->op = (*items)->op;
+            // the item gives up its text
+            node->text = (*items)->text;
+            (*items)->text = NULL;
+            *items = (*items)->next;
+        }
+        *tail = node;
+        tail = &node->next;
+    }
+    // ran out of text with a compound still open
+    if (until != NULL) {
+        *status = BUILD_INCOMPLETE;
+        free_nodes(head);
+        return NULL;
+    }
+    return head;
+}
+
+
+static ListNode *parse_program(const char *text, BuildStatus *status){
+    CommandList *list = parse_list(text);
+    if (list == (CommandList *) -1) {
+        *status = BUILD_ERROR;
+        return NULL;
+    }
+    CommandList *items = list;
+    ListNode *nodes = build_sequence(&items, NULL, status);
+    free_list(list);
+    return nodes;
+}
+
+
+static int run_nodes(ListNode *node, Variable **root, bool tested);
+
+// `exit`, or `return` out of the function being run
+#define STOP_RUNNING() (shell_state.exit_requested || shell_state.returning)
+
+
+static int run_while(ListNode *node, Variable **root){
+    int saved_stdin = -1;
+    if (node->redir_in_path != NULL) {
+        // the whole loop, `read` included, reads the file
+        char *path = replace_variables_mk_line(node->redir_in_path, *root);
+        if (path == NULL || path == (char *) -1) {
+            return 1;
+        }
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(path);
+            free(path);
+            return 1;
+        }
+        free(path);
+        saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+        if (saved_stdin == -1 || dup2(fd, STDIN_FILENO) == -1) {
+            perror("dup2");
+            close(fd);
+            if (saved_stdin != -1) {
+                close(saved_stdin);
+            }
+            return 1;
+        }
+        close(fd);
+    }
+
+    int status = 0;
+    while (!STOP_RUNNING() && run_nodes(node->cond, root, true) == 0 &&
+           !STOP_RUNNING()) {
+        status = run_nodes(node->body, root, false);
+    }
+
+    if (saved_stdin != -1) {
+        dup2(saved_stdin, STDIN_FILENO);
+        close(saved_stdin);
+    }
+    return status;
+}
+
+
+static int run_if(ListNode *node, Variable **root){
+    if (run_nodes(node->cond, root, true) == 0) {
+        return run_nodes(node->body, root, false);
+    }
+    if (node->alt == NULL || STOP_RUNNING()) {
+        // 0 when no branch is taken, as in sh
+        return 0;
+    }
+    return run_nodes(node->alt, root, false);
+}
+
+
+static int run_nodes(ListNode *node, Variable **root, bool tested){
+    /**
+     * Runs a list of nodes; tested is set for the condition of a loop or
+     * an if, where a failure is an answer rather than something for set -e.
+    */
+    int status = shell_state.last_status;
+    for (; node != NULL && !STOP_RUNNING(); node = node->next) {
+        // `a && b || c`: left to right, each on the status so far
+        if ((node->op == LIST_AND && status != 0) ||
+            (node->op == LIST_OR && status == 0)) {
+            continue;
+        }
+        bool checked = tested || (node->next != NULL && node->next->op != LIST_SEQ);
+        bool outer_ignored = errexit_ignored;
+        errexit_ignored = outer_ignored || checked;
+        switch (node->kind) {
+        case NODE_WHILE:
+            status = run_while(node, root);
+            break;
+        case NODE_IF:
+            status = run_if(node, root);
+            break;
+        case NODE_FUNCTION:
+            status = define_function(node->text, copy_nodes(node->body));
+            break;
+        default:
+            status = run_pipeline(node, root, node == exec_node);
+        }
+        errexit_ignored = outer_ignored;
+        shell_state.last_status = status;
+
+        // set -e: only when the status is not about to be tested, and not
+        // for `return`, whose status is the caller's to test
+        if (status != 0 && shell_state.errexit && !errexit_ignored && !checked &&
+            !shell_state.returning) {
+            shell_state.exit_requested = true;
+        }
+    }
+    return status;
+}
+
+
+int run_body(ListNode *body, Variable **root){
+    return run_nodes(body, root, false);
+}
+
+
+void free_body(ListNode *body){
+    free_nodes(body);
+}
+
+
+bool is_command_list(const char *line){
+    CommandList *list = parse_list(line);
+    if (list == (CommandList *) -1) {
+        // let run_line report it
+        return true;
+    }
+    bool several = list != NULL && list->next != NULL;
+    free_list(list);
+    return several;
+}
+
+
+bool needs_more_lines(const char *text){
+    BuildStatus status;
+    checking_only = true;
+    ListNode *nodes = parse_program(text, &status);
+    checking_only = false;
+    free_nodes(nodes);
+    return status == BUILD_INCOMPLETE;
+}
+
+
+bool is_single_pipeline(const char *text){
+    BuildStatus status;
+    checking_only = true;
+    ListNode *nodes = parse_program(text, &status);
+    checking_only = false;
+    bool single = status == BUILD_OK && nodes != NULL && nodes->next == NULL &&
+        nodes->kind == NODE_PIPELINE;
+    free_nodes(nodes);
+    return single;
+}
+
+
+int run_line(const char *line, Variable **root){
+    BuildStatus build;
+    ListNode *nodes = parse_program(line, &build);
+    if (build != BUILD_OK) {
+        if (build == BUILD_INCOMPLETE) {
+            ERR_PRINT(ERR_LIST_INCOMPLETE);
+        }
+        shell_state.last_status = STATUS_SYNTAX;
+        return STATUS_SYNTAX;
+    }
+
+    // the last pipeline of the line, if it is not inside a compound
+    const ListNode *outer_exec = exec_node;
+    exec_node = NULL;
+    for (ListNode *node = nodes; shell_state.exec_last && node != NULL; node = node->next) {
+        exec_node = node->next == NULL && node->kind == NODE_PIPELINE ? node : NULL;
+    }
+    shell_state.exec_last = false;
+
+    int status = run_nodes(nodes, root, false);
+    exec_node = outer_exec;
+    free_nodes(nodes);
+    return status;
+}
+
+
+int append_line(char **text, const char *line){
+    size_t len = *text != NULL ? strlen(*text) : 0;
+    char *grown = (char *) realloc(*text, len + strlen(line) + 2);
+    if (grown == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    if (len > 0) {
+        grown[len++] = '\n';
+    }
+    strcpy(grown + len, line);
+    *text = grown;
+    return 0;
+}
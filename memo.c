@@ -0,0 +1,303 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** --incremental: a pipeline that writes to a file with '>' is not run
+** again when nothing it depends on has changed since it last succeeded,
+** as make would not rebuild an up-to-date target.
+**
+** What it depends on is its fingerprint: the working directory and, for
+** each stage, the resolved executable (and its mtime and size), the
+** expanded arguments, and the file it reads with '<' (and that file's
+** mtime, size and inode). A line that reads the output of an earlier one
+** has a new fingerprint as soon as that output is rewritten, so changing
+** one input reruns just the lines downstream of it. Files named only as
+** arguments are not looked at.
+**
+** The state file is a magic followed by MemoRecords. Each line that
+** succeeds appends its record straight away, so a run that is stopped
+** halfway keeps what it finished; a later record for the same
+** fingerprint wins. After a run that got to the end of the script,
+** memo_close rewrites the file with only the records that run used; one
+** that stopped early (set -e, exit) leaves it as it is, since the lines
+** it never reached still have their records there.
+*/
+typedef struct MemoRecord {
+    uint64_t fingerprint;
+    uint64_t outputs;       // hash of what the outputs were afterwards
+} MemoRecord;
+
+static char *state_path = NULL;
+static int state_fd = -1;
+static MemoRecord *loaded = NULL;      // sorted by fingerprint
+static size_t num_loaded = 0;
+static MemoRecord *used = NULL;        // this run's, in the order seen
+static size_t num_used = 0;
+static size_t used_cap = 0;
+
+
+static int compare_record(const void *a, const void *b){
+    uint64_t x = ((const MemoRecord *) a)->fingerprint;
+    uint64_t y = ((const MemoRecord *) b)->fingerprint;
+    return x < y ? -1 : x > y;
+}
+
+
+static void sort_records(MemoRecord *records, size_t count){
+    // bottom-up mergesort through a scratch copy
+    MemoRecord *scratch = (MemoRecord *) malloc(count * sizeof(MemoRecord) + 1);
+    if (scratch == NULL) {
+        perror("malloc");
+        return;
+    }
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t lo = 0; lo < count; lo += 2 * width) {
+            size_t mid = lo + width < count ? lo + width : count;
+            size_t hi = lo + 2 * width < count ? lo + 2 * width : count;
+            size_t a = lo, b = mid, out = lo;
+            while (a < mid || b < hi) {
+                bool take_a = b >= hi ||
+                    (a < mid && compare_record(&records[a], &records[b]) <= 0);
+                scratch[out++] = take_a ? records[a++] : records[b++];
+            }
+        }
+        memcpy(records, scratch, count * sizeof(MemoRecord));
+    }
+    free(scratch);
+}
+
+
+static uint64_t hash_file(uint64_t hash, const char *path, bool *exists){
+    // the path, and what it is now
+    hash = fnv1a(hash, path, strlen(path) + 1);
+    struct stat st;
+    *exists = stat(path, &st) == 0;
+    if (*exists) {
+        hash = fnv1a(hash, &st.st_mtim, sizeof(st.st_mtim));
+        hash = fnv1a(hash, &st.st_size, sizeof(st.st_size));
+        hash = fnv1a(hash, &st.st_ino, sizeof(st.st_ino));
+        hash = fnv1a(hash, &st.st_dev, sizeof(st.st_dev));
+    }
+    return hash;
+}
+
+
+static uint64_t hash_outputs(Command *head, bool *complete){
+    // every output has to be there for the line to be up to date
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    *complete = true;
+    for (Command *c = head; c != NULL; c = c->next) {
+        for (Redirect *out = c->redir_out; out != NULL; out = out->next) {
+            bool exists;
+            hash = hash_file(hash, out->path, &exists);
+            *complete = *complete && exists;
+        }
+    }
+    return hash;
+}
+
+
+static uint64_t line_fingerprint(Command *head){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    bool exists;
+    hash = fnv1a(hash, MEMO_MAGIC, sizeof(MEMO_MAGIC));
+    char cwd[MAX_PATH_STR];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        hash = fnv1a(hash, cwd, strlen(cwd) + 1);
+    }
+    for (Command *c = head; c != NULL; c = c->next) {
+        // a stage boundary, so `a b | c` and `a | b c` differ
+        hash = fnv1a(hash, "|", 2);
+        hash = hash_file(hash, c->exec_path, &exists);
+        for (int i = 1; c->args[i] != NULL; i++) {
+            hash = fnv1a(hash, c->args[i], strlen(c->args[i]) + 1);
+        }
+        if (c->redir_in_path != NULL) {
+            hash = fnv1a(hash, "<", 2);
+            hash = hash_file(hash, c->redir_in_path, &exists);
+        }
+        for (Redirect *out = c->redir_out; out != NULL; out = out->next) {
+            hash = fnv1a(hash, out->append ? ">>" : ">", out->append ? 3 : 2);
+            hash = fnv1a(hash, out->path, strlen(out->path) + 1);
+        }
+    }
+    return hash;
+}
+
+
+static bool is_memoizable(Command *head){
+    // builtins and functions change the shell, and a line with no output
+    // file only has its stdout to show for itself: all of them always run
+    bool writes_file = false;
+    for (Command *c = head; c != NULL; c = c->next) {
+        if (find_builtin(c->exec_path) != NULL || find_function(c->exec_path) != NULL) {
+            return false;
+        }
+        writes_file = writes_file || c->redir_out != NULL;
+    }
+    return writes_file;
+}
+
+
+static void mark_used(MemoRecord record){
+    if (num_used == used_cap) {
+        size_t new_cap = used_cap ? 2 * used_cap : 64;
+        MemoRecord *grown = (MemoRecord *) realloc(used, new_cap * sizeof(MemoRecord));
+        if (grown == NULL) {
+            perror("realloc");
+            return;
+        }
+        used = grown;
+        used_cap = new_cap;
+    }
+    used[num_used++] = record;
+}
+
+
+static int open_failed(const char *what){
+    // nothing is recorded, and memo_close leaves the file as it was
+    perror(what);
+    if (state_fd != -1) {
+        close(state_fd);
+        state_fd = -1;
+    }
+    return -1;
+}
+
+
+int memo_open(const char *path){
+    state_path = strdup(path);
+    if (state_path == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    state_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (state_fd == -1 || fstat(state_fd, &st) == -1) {
+        return open_failed(path);
+    }
+
+    char magic[sizeof(MEMO_MAGIC)];
+    size_t header = sizeof(magic);
+    if (st.st_size == 0) {
+        if (write(state_fd, MEMO_MAGIC, header) != (ssize_t) header) {
+            return open_failed(path);
+        }
+        return 0;
+    }
+    if (pread(state_fd, magic, header, 0) != (ssize_t) header ||
+        memcmp(magic, MEMO_MAGIC, header) != 0) {
+        // some other file: better not to overwrite it
+        ERR_PRINT(ERR_MEMO_STATE, path);
+        close(state_fd);
+        state_fd = -1;
+        return -1;
+    }
+
+    // a record cut short by a crash is left out
+    num_loaded = (st.st_size - header) / sizeof(MemoRecord);
+    loaded = (MemoRecord *) malloc(num_loaded * sizeof(MemoRecord) + 1);
+    ssize_t want = num_loaded * sizeof(MemoRecord);
+    if (loaded == NULL || pread(state_fd, loaded, want, header) != want) {
+        num_loaded = 0;
+        return open_failed(path);
+    }
+    // appended in order, so of two records for a fingerprint the later
+    // one is newer; mergesort keeps that order among equal fingerprints
+    sort_records(loaded, num_loaded);
+    size_t kept = 0;
+    for (size_t i = 0; i < num_loaded; i++) {
+        if (kept > 0 && loaded[kept - 1].fingerprint == loaded[i].fingerprint) {
+            kept--;
+        }
+        loaded[kept++] = loaded[i];
+    }
+    num_loaded = kept;
+    return 0;
+}
+
+
+bool memo_skip_line(Command *head, uint64_t *fingerprint){
+    *fingerprint = 0;
+    if (state_fd == -1 || !is_memoizable(head)) {
+        return false;
+    }
+    *fingerprint = line_fingerprint(head);
+
+    MemoRecord key = {*fingerprint, 0};
+    MemoRecord *found = num_loaded == 0 ? NULL :
+        bsearch(&key, loaded, num_loaded, sizeof(MemoRecord), compare_record);
+    if (found == NULL) {
+        return false;
+    }
+    bool complete;
+    uint64_t outputs = hash_outputs(head, &complete);
+    if (!complete || outputs != found->outputs) {
+        return false;
+    }
+    mark_used(*found);
+    shell_stats.lines_skipped++;
+    return true;
+}
+
+
+void memo_record_line(Command *head, uint64_t fingerprint){
+    if (state_fd == -1 || fingerprint == 0) {
+        return;
+    }
+    bool complete;
+    MemoRecord record = {fingerprint, hash_outputs(head, &complete)};
+    if (!complete) {
+        return;
+    }
+    mark_used(record);
+    if (write(state_fd, &record, sizeof(record)) != (ssize_t) sizeof(record)) {
+        perror(state_path);
+    }
+}
+
+
+int memo_close(bool finished){
+    if (state_fd == -1 || !finished) {
+        if (state_fd != -1) {
+            close(state_fd);
+            state_fd = -1;
+        }
+        free(state_path);
+        free(loaded);
+        free(used);
+        state_path = NULL;
+        loaded = used = NULL;
+        num_loaded = num_used = used_cap = 0;
+        return 0;
+    }
+    close(state_fd);
+    state_fd = -1;
+
+    // compact: only what this run used, written aside and renamed over
+    int ret = 0;
+    char tmp_path[MAX_PATH_STR];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state_path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    size_t size = num_used * sizeof(MemoRecord);
+    if (fd == -1 ||
+        write(fd, MEMO_MAGIC, sizeof(MEMO_MAGIC)) != (ssize_t) sizeof(MEMO_MAGIC) ||
+        (size > 0 && write(fd, used, size) != (ssize_t) size) ||
+        close(fd) == -1 || rename(tmp_path, state_path) == -1) {
+        perror(tmp_path);
+        unlink(tmp_path);
+        ret = -1;
+    }
+
+    free(state_path);
+    free(loaded);
+    free(used);
+    state_path = NULL;
+    loaded = used = NULL;
+    num_loaded = num_used = used_cap = 0;
+    return ret;
+}
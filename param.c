@@ -0,0 +1,309 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+/*
+** Parameter expansion operators, the body of a ${...}:
+**
+**   ${#V}          length of the value
+**   ${V:-word}     the value, or word if V is unset or empty
+**   ${V#pat}       remove the shortest prefix matching pat; ## the longest
+**   ${V%pat}       remove the shortest suffix matching pat; %% the longest
+**   ${V/pat/rep}   replace the first longest match of pat; // every match
+**   ${V:off:len}   len characters from off, both arithmetic; a negative
+**                  len stops that far from the end
+**
+** V is a variable, or a positional parameter (1, 2, ... 10, ...), # or @.
+** Patterns are globs, as for file names. Every result is a slice of the
+** value (or of word), or for '/' slices around the replacement, so the
+** only copy made is the returned string itself. word, pat and rep are
+** only expanded first when they use '$'.
+*/
+typedef struct Slice {
+    const char *str;
+    size_t len;
+} Slice;
+
+
+static int expand_word(const char *start, size_t len, Variable *variables,
+                       Slice *slice, char **owned){
+    /**
+     * Sets slice to the text, expanded if it has to be. *owned is the
+     * heap copy to free afterwards, if one was made.
+    */
+    *owned = NULL;
+    slice->str = start;
+    slice->len = len;
+    if (memchr(start, '$', len) == NULL) {
+        return 0;
+    }
+    char *text = strndup(start, len);
+    if (text == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    *owned = replace_variables_mk_line(text, variables);
+    free(text);
+    if (*owned == NULL || *owned == (char *) -1) {
+        *owned = NULL;
+        return -1;
+    }
+    slice->str = *owned;
+    slice->len = strlen(*owned);
+    return 0;
+}
+
+
+static int64_t clamp(int64_t value, int64_t lo, int64_t hi){
+    return value < lo ? lo : value > hi ? hi : value;
+}
+
+
+static int substring(Slice *value, const char *spec, size_t spec_len, Variable *variables){
+    // off[:len], each evaluated as $((...)) would be
+    const char *colon = memchr(spec, ':', spec_len);
+    size_t off_len = colon ? (size_t) (colon - spec) : spec_len;
+    char off_text[off_len + 1];
+    memcpy(off_text, spec, off_len);
+    off_text[off_len] = '\0';
+
+    int64_t off;
+    int64_t size = (int64_t) value->len;
+    if (eval_arith(off_text, variables, &off) == -1) {
+        return -1;
+    }
+    // a negative offset counts from the end
+    off = clamp(off < 0 ? size + off : off, 0, size);
+    int64_t count = size - off;
+    if (colon != NULL) {
+        size_t count_len = spec_len - off_len - 1;
+        char count_text[count_len + 1];
+        memcpy(count_text, colon + 1, count_len);
+        count_text[count_len] = '\0';
+        if (eval_arith(count_text, variables, &count) == -1) {
+            return -1;
+        }
+        count = count < 0 ? clamp(size + count - off, 0, size) : clamp(count, 0, size - off);
+    }
+    value->str += off;
+    value->len = (size_t) count;
+    return 0;
+}
+
+
+static void remove_affix(Slice *value, Slice pattern, bool suffix, bool longest){
+    // '#' and '%': try the candidate lengths from shortest or longest
+    size_t len = value->len;
+    for (size_t i = 0; i <= len; i++) {
+        size_t cut = longest ? len - i : i;
+        const char *start = suffix ? value->str + len - cut : value->str;
+        if (glob_match_n(pattern.str, pattern.len, start, cut)) {
+            value->len -= cut;
+            if (!suffix) {
+                value->str += cut;
+            }
+            return;
+        }
+    }
+}
+
+
+static char *replace_matches(Slice value, Slice pattern, Slice rep, bool all){
+    /**
+     * '/' and '//'; empty matches are not replaced. The matches are found
+     * twice, once to size the result and once to fill it.
+    */
+    char *result = NULL;
+    size_t result_len = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        size_t out = 0;
+        size_t i = 0;
+        bool replaced = false;
+        while (i < value.len) {
+            // the longest non-empty match starting here
+            size_t match = 0;
+            for (size_t end = value.len; pattern.len > 0 && (all || !replaced) && end > i; end--) {
+                if (glob_match_n(pattern.str, pattern.len, value.str + i, end - i)) {
+                    match = end - i;
+                    break;
+                }
+            }
+            if (match > 0) {
+                if (result != NULL) {
+                    memcpy(result + out, rep.str, rep.len);
+                }
+                out += rep.len;
+                i += match;
+                replaced = true;
+            }
+            else {
+                if (result != NULL) {
+                    result[out] = value.str[i];
+                }
+                out++;
+                i++;
+            }
+        }
+        if (pass == 0) {
+            result_len = out;
+            result = (char *) malloc(result_len + 1);
+            if (result == NULL) {
+                perror("malloc");
+                return NULL;
+            }
+        }
+    }
+    result[result_len] = '\0';
+    return result;
+}
+
+
+static const char *find_separator(const char *pattern, const char *end){
+    // The '/' ending pat in ${V/pat/rep}: not escaped, not inside [...]
+    for (const char *c = pattern; c < end; c++) {
+        if (*c == '\\' && c + 1 < end) {
+            c++;
+        }
+        else if (*c == '[') {
+            const char *close = c + 2 < end ? memchr(c + 2, ']', end - c - 2) : NULL;
+            c = close != NULL ? close : c;
+        }
+        else if (*c == '/') {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+
+static char *apply_operator(Slice value, const char *op, const char *body,
+                            size_t body_len, Variable *variables){
+    /**
+     * What the operator at op, up to the end of body, makes of value; a
+     * heap string, or NULL (after printing why) on error.
+    */
+    size_t rest_len = body + body_len - op;
+    bool use_default = rest_len >= 2 && op[0] == ':' && op[1] == '-';
+    char *owned = NULL;
+    char *output = NULL;
+    if (use_default) {
+        if (value.len == 0 && expand_word(op + 2, rest_len - 2, variables, &value, &owned) == -1) {
+            return NULL;
+        }
+    }
+    else if (rest_len > 0 && op[0] == ':') {
+        if (substring(&value, op + 1, rest_len - 1, variables) == -1) {
+            return NULL;
+        }
+    }
+    else if (rest_len > 0 && (op[0] == '#' || op[0] == '%')) {
+        bool longest = rest_len > 1 && op[1] == op[0];
+        Slice pattern;
+        if (expand_word(op + 1 + longest, rest_len - 1 - longest, variables,
+                        &pattern, &owned) == -1) {
+            return NULL;
+        }
+        remove_affix(&value, pattern, op[0] == '%', longest);
+    }
+    else if (rest_len > 0 && op[0] == '/') {
+        bool all = rest_len > 1 && op[1] == '/';
+        const char *pat_start = op + 1 + all;
+        const char *slash = find_separator(pat_start, body + body_len);
+        const char *pat_end = slash ? slash : body + body_len;
+        Slice pattern, rep = {"", 0};
+        char *owned_rep = NULL;
+        if (expand_word(pat_start, pat_end - pat_start, variables, &pattern, &owned) == -1 ||
+            (slash != NULL && expand_word(slash + 1, body + body_len - slash - 1,
+                                          variables, &rep, &owned_rep) == -1)) {
+            free(owned);
+            return NULL;
+        }
+        output = replace_matches(value, pattern, rep, all);
+        free(owned_rep);
+        free(owned);
+        return output;
+    }
+    else if (rest_len > 0) {
+        ERR_PRINT(ERR_BAD_SUBST, (int) body_len, body);
+        return NULL;
+    }
+
+    output = strndup(value.str, value.len);
+    if (output == NULL) {
+        perror("malloc");
+    }
+    free(owned);
+    return output;
+}
+
+
+char *expand_parameter(const char *body, size_t body_len, Variable *variables){
+    bool length = body_len > 1 && body[0] == '#';
+    size_t name_start = length;
+    size_t name_end = name_start;
+    // ${1}, ${10}, ${#} and ${@} name the same things as $1, $# and $@
+    bool special = name_start < body_len && (isdigit((unsigned char) body[name_start]) ||
+                                             body[name_start] == '#' || body[name_start] == '@');
+    if (special && isdigit((unsigned char) body[name_start])) {
+        while (name_end < body_len && isdigit((unsigned char) body[name_end])) {
+            name_end++;
+        }
+    }
+    else if (special) {
+        name_end++;
+    }
+    while (!special && name_end < body_len &&
+           (isalpha((unsigned char) body[name_end]) || body[name_end] == '_')) {
+        name_end++;
+    }
+    if (name_end == name_start || (length && name_end != body_len)) {
+        ERR_PRINT(ERR_BAD_SUBST, (int) body_len, body);
+        return NULL;
+    }
+
+    char name[name_end - name_start + 1];
+    memcpy(name, body + name_start, name_end - name_start);
+    name[name_end - name_start] = '\0';
+    const char *op = body + name_end;
+    char *special_value = NULL;
+    Slice value = {"", 0};
+    if (special) {
+        special_value = special_parameter(name);
+        if (special_value == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+        value.str = special_value;
+        value.len = strlen(special_value);
+    }
+    else {
+        Variable *var = find_variable(variables, name);
+        bool use_default = body_len - name_end >= 2 && op[0] == ':' && op[1] == '-';
+        if (var == NULL && !use_default) {
+            ERR_PRINT(ERR_VAR_NOT_FOUND, name);
+            return NULL;
+        }
+        if (var != NULL) {
+            value.str = var->value;
+            value.len = strlen(var->value);
+        }
+    }
+
+    char *output;
+    if (length) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%zu", value.len);
+        output = strdup(buf);
+        if (output == NULL) {
+            perror("malloc");
+        }
+    }
+    else {
+        output = apply_operator(value, op, body, body_len, variables);
+    }
+    free(special_value);
+    return output;
+}
@@ -5,17 +5,20 @@
 
 #include "cscshell.h"
 
+#include <limits.h>
+
 #define CONTINUE_SEARCH NULL 
 
 // COMPLETE
 char *resolve_executable(const char *command_name, Variable *path){
 
+    shell_stats.resolve_calls++;
     if (command_name == NULL || path == NULL){
         return NULL;
     }
 
-    if (strcmp(command_name, CD) == 0){
-        return strdup(CD);
+    if (find_builtin(command_name) != NULL){
+        return strdup(command_name);
     }
 
     if (strcmp(path->name, PATH_VAR_NAME) != 0){
@@ -34,6 +37,12 @@ char *resolve_executable(const char *command_name, Variable *path){
         return exec_path;
     }
 
+    // the startup snapshot's index saves scanning the PATH directories
+    exec_path = lookup_exec_index(command_name, path->value);
+    if (exec_path != NULL){
+        return exec_path;
+    }
+
     // we create a duplicate so that we can mess it up with strtok
     char *path_to_toke = strdup(path->value);
     if (path_to_toke == NULL){
@@ -65,6 +74,7 @@ char *resolve_executable(const char *command_name, Variable *path){
                 // end of files, break
                 break;
             }
+            shell_stats.resolve_dir_entries++;
 
             if (strcmp(possible_file->d_name, command_name) == 0){
                 // +1 null term, +1 possible missing '/'
@@ -91,7 +101,173 @@ res_ex_cleanup:
     return exec_path;
 }
 
+static bool needs_resolving(const Command *cmd){
+    // paths are taken as they are, builtins and functions are never looked up
+    return strchr(cmd->exec_path, '/') == NULL && find_builtin(cmd->exec_path) == NULL &&
+        find_function(cmd->exec_path) == NULL;
+}
+
+
+static size_t point_stages(Command *head, const char *name, const char *exec_path){
+    /**
+     * Points every stage still named name at exec_path, so `cat | cat`
+     * is one lookup. A resolved path always has a '/', so it never
+     * matches a name again. Returns the stages set.
+    */
+    size_t count = 0;
+    for (Command *c = head; c != NULL; c = c->next) {
+        if (strcmp(c->exec_path, name) == 0) {
+            c->exec_path = exec_path;
+            count++;
+        }
+    }
+    return count;
+}
+
+
+static size_t set_resolved(Command *head, const char *name, const char *dir){
+    char full[MAX_PATH_STR];
+    size_t dir_len = strlen(dir);
+    if (snprintf(full, sizeof(full), "%s%s%s", dir,
+                 dir_len > 0 && dir[dir_len - 1] == '/' ? "" : "/", name) >= (int) sizeof(full)) {
+        return 0;
+    }
+    const char *exec_path = intern(full);
+    return exec_path != NULL ? point_stages(head, name, exec_path) : 0;
+}
+
+
+bool is_executable_at(int dirfd, const char *name){
+    // what execve would run: executable by us, and not a directory
+    struct stat st;
+    return faccessat(dirfd, name, X_OK, 0) == 0 &&
+        fstatat(dirfd, name, &st, 0) == 0 && !S_ISDIR(st.st_mode);
+}
+
+
+static size_t scan_path_dir(Command *head, int dirfd, const char *dir){
+    // The slow way, for a directory we cannot search but can still list
+    int fd = dup(dirfd);
+    DIR *listing = fd == -1 ? NULL : fdopendir(fd);
+    if (listing == NULL) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return 0;
+    }
+    size_t count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(listing)) != NULL) {
+        shell_stats.resolve_dir_entries++;
+        for (Command *c = head; c != NULL; c = c->next) {
+            if (strcmp(c->exec_path, entry->d_name) == 0) {
+                count += set_resolved(head, c->exec_path, dir);
+                break;
+            }
+        }
+    }
+    closedir(listing);
+    return count;
+}
+
+
+int resolve_line(Command *head){
+    size_t pending = 0;
+    for (Command *c = head; c != NULL; c = c->next) {
+        pending += needs_resolving(c);
+    }
+    if (pending == 0) {
+        return 0;
+    }
+
+    Variable *path = head->variables != NULL ?
+        find_variable(*head->variables, PATH_VAR_NAME) : NULL;
+    for (Command *c = head; path != NULL && c != NULL; c = c->next) {
+        // the startup snapshot's index saves looking at the directories
+        if (!needs_resolving(c)) {
+            continue;
+        }
+        shell_stats.resolve_calls++;
+        char *indexed = lookup_exec_index(c->exec_path, path->value);
+        if (indexed != NULL) {
+            const char *exec_path = intern(indexed);
+            free(indexed);
+            if (exec_path != NULL) {
+                pending -= point_stages(head, c->exec_path, exec_path);
+            }
+        }
+    }
+
+    // One walk over PATH for the whole pipeline; each directory is asked
+    // for the names directly instead of being read through
+    char *path_copy = NULL;
+    if (pending > 0 && path != NULL && (path_copy = strdup(path->value)) == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    char *saveptr;
+    char *dir = path_copy ? strtok_r(path_copy, ":", &saveptr) : NULL;
+    for (; dir != NULL && pending > 0; dir = strtok_r(NULL, ":", &saveptr)) {
+        int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirfd == -1) {
+            ERR_PRINT(ERR_BAD_PATH, dir);
+            continue;
+        }
+        // a directory we cannot search can still be listed
+        bool scan = faccessat(dirfd, ".", X_OK, 0) == -1;
+        for (Command *c = head; !scan && c != NULL && pending > 0; c = c->next) {
+            if (needs_resolving(c) && is_executable_at(dirfd, c->exec_path)) {
+                pending -= set_resolved(head, c->exec_path, dir);
+            }
+        }
+        if (scan && pending > 0) {
+            pending -= scan_path_dir(head, dirfd, dir);
+        }
+        close(dirfd);
+    }
+    free(path_copy);
+
+    for (Command *c = head; c != NULL; c = c->next) {
+        if (needs_resolving(c)) {
+            ERR_PRINT(ERR_NO_EXECU, c->exec_path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// nesting depth of parse_line/replace_variables_mk_line through $(...),
+// so that only the outermost call is timed
+static int parse_depth = 0;
+static int expand_depth = 0;
+
+static Command *parse_line_untimed(char *line, Variable **variables);
+static Command *parse_stage(char *stage, Variable **variables);
+static Command *finish_line(Command *head, Variable **variables);
+static Command *stage_from_words(char *words, char *redir_in_path, Redirect *redir_out,
+                                 Variable **variables);
+static Command *stage_from_args(char **args, int num_words, char *redir_in_path,
+                                Redirect *redir_out, Variable **variables);
+static char *replace_variables_untimed(const char *line, Variable *variables);
+
 Command *parse_line(char *line, Variable **variables){
+    shell_stats.lines_parsed++;
+    if (parse_depth++ > 0) {
+        Command *commands = parse_line_untimed(line, variables);
+        parse_depth--;
+        return commands;
+    }
+    uint64_t start = stats_now_ns();
+    Command *commands = parse_line_untimed(line, variables);
+    shell_stats.parse_ns += stats_now_ns() - start;
+    parse_depth--;
+    // directory listings are only trusted for the line they were read for
+    glob_release_line();
+    return commands;
+}
+
+static Command *parse_line_untimed(char *line, Variable **variables){
     /**
      * Parse a line into a list of commands if connected by pipes "|"
     */
@@ -104,24 +280,27 @@ Command *parse_line(char *line, Variable **variables){
     trim_leading_white_space(line);
     
     // ptr is a general pointer we use in this function
-    char *ptr = strchr(line, '#');
+    char *ptr = find_comment(line);
     if (ptr != NULL) {
         *ptr = '\0';
     }
 
     // If line empty return NULL
     if (strlen(line) == 0) {
+        free(line);
         return NULL;
     }
 
    // Split cases, whether if this is a command or a variable assignment
     ptr = strchr(line, '=');
     
-    // Potential variable assignment
-    if (ptr != NULL) {
+    // Potential variable assignment, only if the '=' belongs to the first word
+    char *first_space = strpbrk(line, " \t");
+    if (ptr != NULL && (first_space == NULL || ptr < first_space)) {
         // Can't start variable assignment w '='
         if (line[0] == '=') {
             fputs(ERR_VAR_START, stdout);
+            free(line);
             return (Command *) -1;
         }
 
@@ -130,12 +309,14 @@ Command *parse_line(char *line, Variable **variables){
         var_name[ptr - line] = '\0';
         if (!strncpy(var_name, line, ptr - line)) {
             ERR_PRINT("strncpy");
+            free(line);
             return (Command *) -1;
         }
         for (int i = 0; i < strlen(var_name); i++) {
             bool valid = isalpha(var_name[i]) || line[i] == '_';
             if (!valid) {
                 ERR_PRINT(ERR_VAR_NAME, var_name);
+                free(line);
                 return (Command *) -1;
             }
         }
@@ -145,264 +326,616 @@ Command *parse_line(char *line, Variable **variables){
         var_val[strlen(line) - strlen(var_name) - 1] = '\0';
         strncpy(var_val, ptr + 1, strlen(line) - strlen(var_name) - 1);
         
+        // The value may use variables or $(...) itself
+        char *val_replaced = replace_variables_mk_line(var_val, *variables);
+        if (val_replaced == NULL || val_replaced == (char *) -1) {
+            free(line);
+            return (Command *) -1;
+        }
+
         // Traverse the linked list to assign the variable
-        update_linked_list_variable(variables, var_name, var_val);
+        update_linked_list_variable(variables, var_name, val_replaced);
+        free(val_replaced);
         free(line);
         return NULL;
     }
 
     // This case is a potential command
-    else {
-        // Trim leading and trailing whitespace
-        trim_white_space(line);
-        // Replace all variables with values
-        char* line_replaced = replace_variables_mk_line(line, *variables);
-        if (line_replaced == NULL) {
-            free(line);
+    // Trim leading and trailing whitespace
+    trim_white_space(line);
+    // Replace all variables with values
+    char* line_replaced = replace_variables_mk_line(line, *variables);
+    free(line);
+    if (line_replaced == NULL || line_replaced == (char *) -1) {
+        return (Command *) -1;
+    }
+
+    // Linked list of commands, one per stage between pipes
+    Command *head = NULL;
+    Command **curr = &head;
+    char *saveptr;
+    for (char *stage = strtok_r(line_replaced, "|", &saveptr); stage != NULL;
+         stage = strtok_r(NULL, "|", &saveptr)) {
+        if (count_word(stage) == 0) {
+            // nothing between two pipes
+            continue;
+        }
+        *curr = parse_stage(stage, variables);
+        if (*curr == (Command *) -1) {
+            *curr = NULL;
+            free_command(head);
+            free(line_replaced);
             return (Command *) -1;
         }
-        free(line);
-        if (strchr(line_replaced, '|') == NULL && strchr(line_replaced, '>') == NULL && strchr(line_replaced, '<') == NULL) {
-            // We only have one command
-            // First determine the command name and arguments
-            char **args = (char **)malloc(sizeof(char *) * (count_word(line_replaced) + 1));
-            if (args == NULL) {
+        curr = &((*curr) -> next);
+    }
+    free(line_replaced);
+    return finish_line(head, variables);
+}
+
+static Command *finish_line(Command *head, Variable **variables){
+    // Pipes themselves are only created by execute_line, but the
+    // requested capacity comes from the shell variables
+    Variable *pipe_size_var = find_variable(*variables, PIPE_SIZE_VAR_NAME);
+    int pipe_size = 0;
+    if (pipe_size_var != NULL && pipe_size_var -> value[0] != '\0') {
+        // a whole positive number of bytes that fits F_SETPIPE_SZ's int;
+        // what the kernel then allows is still up to pipe-max-size
+        char *end;
+        errno = 0;
+        long size = strtol(pipe_size_var -> value, &end, 10);
+        if (errno != 0 || *end != '\0' || size <= 0 || size > INT_MAX) {
+            ERR_PRINT(ERR_BAD_PIPE_SIZE, pipe_size_var -> value);
+            free_command(head);
+            return (Command *) -1;
+        }
+        pipe_size = (int) size;
+    }
+    // so does the default timeout for stages without a `timeout` prefix
+    Variable *timeout_var = find_variable(*variables, TIMEOUT_VAR_NAME);
+    int timeout_ms = 0;
+    if (timeout_var != NULL && timeout_var -> value[0] != '\0') {
+        timeout_ms = parse_duration_ms(timeout_var -> value);
+        if (timeout_ms < 0) {
+            ERR_PRINT(ERR_BAD_TIMEOUT, timeout_var -> value);
+            free_command(head);
+            return (Command *) -1;
+        }
+    }
+    // and CMD_SCHED for stages without a `sched` prefix
+    Variable *sched_var = find_variable(*variables, SCHED_VAR_NAME);
+    SchedSpec *sched = sched_var != NULL ? parse_sched_var(sched_var -> value) : NULL;
+    if (sched == (SchedSpec *) -1) {
+        free_command(head);
+        return (Command *) -1;
+    }
+    for (Command *c = head; c != NULL; c = c -> next) {
+        c -> pipe_size = pipe_size;
+        c -> variables = variables;
+        if (c -> timeout_ms == 0) {
+            c -> timeout_ms = timeout_ms;
+        }
+        if (c -> sched == NULL && sched != NULL) {
+            c -> sched = (SchedSpec *) malloc(sizeof(SchedSpec));
+            if (c -> sched == NULL) {
                 perror("malloc");
-                free(line_replaced);
-                return (Command *) -1;
-            }
-            extract_commands(args, line_replaced);
-            Command *cmd = set_command(args, *variables, NULL, STDIN_FILENO, STDOUT_FILENO, NULL, NULL, 0);
-            if (cmd == (Command *) -1) {
-                free(args);
-                free(line_replaced);
+                free(sched);
+                free_command(head);
                 return (Command *) -1;
             }
-            free(line_replaced);
-            return cmd;
+            *c -> sched = *sched;
         }
-        else {
-            // We have either piping or redirection or both
-            // Linked list of commands
-            Command *head = NULL;
-            Command **curr = &head;
-            
-            // Pointer of start and end of current command
-            char *start = line_replaced;
-            char *end = line_replaced;
-
-            // First, we get the list of commands with 
-            // their respective arguments, but we don't
-            // set the file descriptors yet
-            int i = 0; // index of current character
-            while (line_replaced[i] != '\0') {
-                char c = line_replaced[i];
-                if (c == '|') {
-                    if (end - start > 0) {
-                        char *cmd = (char *)malloc(end - start + 1);
-                        if (cmd == NULL) {
-                            perror("malloc");
-                            return (Command *) -1;
-                        }
-                        strncpy(cmd, start, end - start);
-                        cmd[end - start] = '\0';
-                        trim_white_space(cmd);
-                        if (strlen(cmd) == 0) {
-                            free(cmd);
-                            end++;
-                            start = end;
-                            i++;
-                            continue;
-                        }
-                        char **args = (char **)malloc(sizeof(char *) * (count_word(cmd) + 1));
-                        if (args == NULL) {
-                            perror("malloc");
-                            free(cmd);
-                            free_command(head);
-                            return (Command *) -1;
-                        }
-                        extract_commands(args, cmd);
-                        *curr = set_command(args, *variables, NULL, fileno(stdin), fileno(stdout), NULL, NULL, 0);
-                        if (*curr == (Command *) -1) {
-                            return (Command *) -1;
-                        }
-                        curr = &((*curr) -> next);
-                    }
-                    // Move past the '|' character
-                    // Note that end is the '|' character
-                    end++;
-                    start = end;
-                    i++;
-                }
-                else if (c == '>') {
-                    // We have a redirect output
-                    if (end - start > 0) {
-                        char *cmd = (char *)malloc(end - start + 1);
-                        if (cmd == NULL) {
-                            perror("malloc");
-                            return (Command *) -1;
-                        }
-                        strncpy(cmd, start, end - start);
-                        cmd[end - start] = '\0';
-                        trim_white_space(cmd);
-                        if (strlen(cmd) == 0) {
-                            free(cmd);
-                            free(line_replaced);
-                            free_command(head);
-                            continue;
-                        }
-                        char **args = (char **)malloc(sizeof(char *) * (count_word(cmd) + 1));
-                        if (args == NULL) {
-                            perror("malloc");
-                            free(cmd);
-                            free_command(head);
-                            free(line_replaced);
-                            return (Command *) -1;
-                        }
-                        extract_commands(args, cmd);
-                        int name_len;
-                        if (i + 1 < strlen(line_replaced) && line_replaced[i + 1] == '>') {
-                            // We have a redirection as 
-                            char *file_name = extract_file_name(line_replaced, i + 2);
-                            name_len = strlen(file_name);
-                            trim_white_space(file_name);
-                            if (file_name == NULL) {
-                                return (Command *) -1;
-                            }
-                            *curr = set_command(args, *variables, NULL, fileno(stdin), fileno(stdout), NULL, file_name, 1);
-                            if (*curr == (Command *) -1) {
-                                return (Command *) -1;
-                            }
-                            i++;
-                            end++;
-                        }
-                        else {
-                            // We have a redirection without append
-                            char *file_name = extract_file_name(line_replaced, i + 1);
-                            name_len = strlen(file_name);
-                            trim_white_space(file_name);
-                            if (file_name == NULL) {
-                                return (Command *) -1;
-                            }
-                            *curr = set_command(args, *variables, NULL, fileno(stdin), fileno(stdout), NULL, file_name, 0);
-                            if (*curr == (Command *) -1) {
-                                free(file_name);
-                                free(line_replaced);
-                                free_command(head);
-                                return (Command *) -1;
-                            }
-                        }
-                        curr = &((*curr) -> next);
-                        end += name_len + 1;
-                        start = end;
-                        i += name_len + 1;
-                    }
+    }
+    free(sched);
+    return head;
+}
 
-                }
-                else if (c == '<') {
-                    if (end - start > 0) {
-                        char *cmd = (char *)malloc(end - start + 1);
-                        if (cmd == NULL) {
-                            perror("malloc");
-                            free(line_replaced);
-                            free_command(head);
-                            return (Command *) -1;
-                        }
-                        strncpy(cmd, start, end - start);
-                        cmd[end - start] = '\0';
-                        trim_white_space(cmd);
-                        if (strlen(cmd) == 0) {
-                            free(line_replaced);
-                            free_command(head);
-                            free(cmd);
-                            continue;
-                        }
-                        char **args = (char **)malloc(sizeof(char *) * (count_word(cmd) + 1));
-                        if (args == NULL) {
-                            perror("malloc");
-                            free(cmd);
-                            return (Command *) -1;
-                        }
-                        extract_commands(args, cmd);
-                        char *file_name = extract_file_name(line_replaced, i + 1);
-                        int name_len = strlen(file_name);
-                        trim_white_space(file_name);
-                        if (file_name == NULL) {
-                            free(line_replaced);
-                            free_command(head);
-                            free(cmd);
-                            return (Command *) -1;
-                        }
-                        // We have an input redirection
-                        *curr = set_command(args, *variables, NULL, fileno(stdin), fileno(stdout), file_name, NULL, 0);
-                        if (*curr == (Command *) -1) {
-                            free(line_replaced);
-                            free_command(head);
-                            free(cmd);
-                            free(file_name);
-                            return (Command *) -1;
-                        }
-                        curr = &((*curr) -> next);
-                        end += name_len + 1;
-                        start = end;
-                        i += name_len + 1;
-                    }
-                }
-                else {
-                    end++;
-                    i++;
-                }
+static void free_redirects(char *redir_in_path, Redirect *redir_out){
+    free(redir_in_path);
+    while (redir_out != NULL) {
+        Redirect *next = redir_out->next;
+        free(redir_out->path);
+        free(redir_out);
+        redir_out = next;
+    }
+}
+
+static Command *parse_stage(char *stage, Variable **variables) {
+    /**
+     * Parse a single pipeline stage: the command words, followed by any
+     * number of '<', '>' or '>>' redirections. Each file name runs up to
+     * the next redirection. The last '<' wins; every '>' and '>>' is kept.
+     * Returns the Command, or -1 on error.
+    */
+    char *redir_in_path = NULL;
+    Redirect *redir_out = NULL;
+    Redirect **redir_tail = &redir_out;
+
+    char *redir = strpbrk(stage, "<>");
+    char *words_end = redir ? redir : stage + strlen(stage);
+    while (redir != NULL) {
+        char kind = *redir;
+        uint8_t append = kind == '>' && redir[1] == '>';
+        char *name_start = redir + 1 + append;
+        char *next = strpbrk(name_start, "<>");
+        char *file_name = strndup(name_start, next ? (size_t) (next - name_start)
+                                                   : strlen(name_start));
+        if (file_name == NULL) {
+            perror("malloc");
+            goto stage_error;
+        }
+        trim_white_space(file_name);
+        if (file_name[0] == '\0') {
+            ERR_PRINT(ERR_REDIR_FILE, kind);
+            free(file_name);
+            goto stage_error;
+        }
+        if (kind == '<') {
+            free(redir_in_path);
+            redir_in_path = file_name;
+        }
+        else {
+            Redirect *out = (Redirect *) malloc(sizeof(Redirect));
+            if (out == NULL) {
+                perror("malloc");
+                free(file_name);
+                goto stage_error;
             }
-            // Add the last cmd
-            if (end - start > 0) {
-                char *cmd = (char *)malloc(end - start + 1);
-                if (cmd == NULL) {
-                    perror("malloc");
-                    free(line_replaced);
-                    free_command(head);
-                    return (Command *) -1;
-                }
-                strncpy(cmd, start, end - start);
-                cmd[end - start] = '\0';
-                trim_white_space(cmd);
-                if (strlen(cmd) != 0) {
-                    char **args = (char **)malloc(sizeof(char *) * (count_word(cmd) + 1));
-                    if (args == NULL) {
-                        perror("malloc");
-                        free(line_replaced);
-                        free_command(head);
-                        free(cmd);
-                        return (Command *) -1;
-                    }
-                    extract_commands(args, cmd);
-                    *curr = set_command(args, *variables, NULL, fileno(stdin), fileno(stdout), NULL, NULL, 0);
-                    if (*curr == (Command *) -1) {
-                        free(line_replaced);
-                        free_command(head);
-                        free(cmd);
-                        return (Command *) -1;
-                    }
-                    curr = &((*curr) -> next);
-                }
-                else {
-                    free(cmd);
-                }
+            out->path = file_name;
+            out->append = append;
+            out->next = NULL;
+            *redir_tail = out;
+            redir_tail = &out->next;
+        }
+        redir = next;
+    }
+    *words_end = '\0';
+    return stage_from_words(stage, redir_in_path, redir_out, variables);
+
+stage_error:
+    free_redirects(redir_in_path, redir_out);
+    return (Command *) -1;
+}
+
+static Command *stage_from_words(char *words, char *redir_in_path, Redirect *redir_out,
+                                 Variable **variables){
+    int num_words = count_word(words);
+    if (num_words <= 0) {
+        ERR_PRINT(ERR_PARSING_LINE);
+        free_redirects(redir_in_path, redir_out);
+        return (Command *) -1;
+    }
+    char **args = (char **)malloc(sizeof(char *) * (num_words + 1));
+    if (args == NULL) {
+        perror("malloc");
+        free_redirects(redir_in_path, redir_out);
+        return (Command *) -1;
+    }
+    extract_commands(args, words);
+    if (args[0] == NULL) {
+        free(args);
+        free_redirects(redir_in_path, redir_out);
+        return (Command *) -1;
+    }
+    return stage_from_args(args, num_words, redir_in_path, redir_out, variables);
+}
+
+static Command *stage_from_args(char **args, int num_words, char *redir_in_path,
+                                Redirect *redir_out, Variable **variables){
+    /**
+     * The rest of a stage once its words are split: the `timeout` and
+     * `sched` prefixes, globs and the Command itself. Takes over args and
+     * the redirections; returns the Command, or -1 on error.
+    */
+
+    // `timeout DURATION cmd ...` is handled by the shell itself; anything
+    // that is not a duration is left for the timeout program on PATH
+    int timeout_ms = 0;
+    if (strcmp(args[0], TIMEOUT) == 0 && args[1] != NULL && args[2] != NULL &&
+        (timeout_ms = parse_duration_ms(args[1])) >= 0) {
+        free(args[0]);
+        free(args[1]);
+        memmove(args, args + 2, sizeof(char *) * (num_words - 1));
+        num_words -= 2;
+    }
+    else {
+        timeout_ms = 0;
+    }
+
+    // `sched [OPTION]... cmd ...`, after any timeout, places the child
+    SchedSpec *sched = NULL;
+    if (strcmp(args[0], SCHED) == 0) {
+        sched = (SchedSpec *) malloc(sizeof(SchedSpec));
+        int used = sched ? parse_sched_options(args + 1, sched) : -1;
+        if (sched == NULL) {
+            perror("malloc");
+        }
+        else if (used != -1 && args[used + 1] == NULL) {
+            ERR_PRINT(ERR_SCHED_USAGE);
+            used = -1;
+        }
+        if (used == -1) {
+            for (int i = 0; args[i] != NULL; i++) {
+                free(args[i]);
             }
+            free(args);
+            free(sched);
+            goto stage_error;
+        }
+        for (int i = 0; i <= used; i++) {
+            free(args[i]);
+        }
+        memmove(args, args + used + 1, sizeof(char *) * (num_words - used));
+    }
 
-            // Now we have the list of commands, we need to set the file descriptors
-            int mypipe[2];
-            if (pipe(mypipe)) {
-                perror("pipe");
-                free_command(head);
-                return (Command *) -1;
+    if (expand_globs(&args) == -1) {
+        free(args);
+        free(sched);
+        goto stage_error;
+    }
+
+    Command *cmd = set_command(args, *variables, NULL, STDIN_FILENO, STDOUT_FILENO,
+                               redir_in_path, redir_out);
+    if (cmd == (Command *) -1) {
+        for (int i = 0; args[i] != NULL; i++) {
+            free(args[i]);
+        }
+        free(args);
+        free(sched);
+        goto stage_error;
+    }
+    cmd -> timeout_ms = timeout_ms;
+    cmd -> sched = sched;
+    return cmd;
+
+stage_error:
+    free_redirects(redir_in_path, redir_out);
+    return (Command *) -1;
+}
+
+/*
+** A pipeline cut up once, before expansion: its stages at each '|', and
+** each stage into its words and redirection targets. Cutting happens
+** outside of $(...) and ${...}, so instantiate_pipeline only has to
+** expand the pieces; a '|', '<' or '>' that comes out of a variable is
+** then part of a word, where parse_line would cut the line at it.
+*/
+typedef struct RedirTemplate {
+    char kind;                  // '<' or '>'
+    uint8_t append;
+    char *name;                 // as written, up to the next '<' or '>'
+    struct RedirTemplate *next;
+} RedirTemplate;
+
+typedef struct StageTemplate {
+    char *words;                // before the first redirection
+    char **literal;             // words already split, when there is no '$'
+    int num_literal;            // -1 if words needs expanding each time
+    RedirTemplate *redirs;
+    struct StageTemplate *next;
+} StageTemplate;
+
+typedef enum TemplateKind {TEMPLATE_EMPTY, TEMPLATE_ASSIGN, TEMPLATE_STAGES} TemplateKind;
+
+struct PipelineTemplate {
+    TemplateKind kind;
+    const char *name;           // TEMPLATE_ASSIGN: interned
+    char *value;                // TEMPLATE_ASSIGN: as written
+    StageTemplate *stages;
+};
+
+
+static char *find_unexpanded(char *text, const char *chars){
+    // the first of chars in text that is not inside $(...) or ${...}
+    int depth = 0;
+    for (char *c = text; *c != '\0'; c++) {
+        if (*c == '$' && (c[1] == '(' || c[1] == '{')) {
+            depth++;
+            c++;
+        }
+        else if (depth > 0) {
+            depth += *c == '(' || *c == '{';
+            depth -= *c == ')' || *c == '}';
+        }
+        else if (strchr(chars, *c) != NULL) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+
+static void free_literal(char **args){
+    for (int i = 0; args != NULL && args[i] != NULL; i++) {
+        free(args[i]);
+    }
+    free(args);
+}
+
+
+void free_pipeline(PipelineTemplate *tmpl){
+    if (tmpl == NULL) {
+        return;
+    }
+    while (tmpl->stages != NULL) {
+        StageTemplate *stage = tmpl->stages;
+        tmpl->stages = stage->next;
+        while (stage->redirs != NULL) {
+            RedirTemplate *redir = stage->redirs;
+            stage->redirs = redir->next;
+            free(redir->name);
+            free(redir);
+        }
+        free(stage->words);
+        free_literal(stage->literal);
+        free(stage);
+    }
+    free(tmpl->value);
+    free(tmpl);
+}
+
+
+static int add_stage_template(StageTemplate ***tail, char *stage){
+    StageTemplate *st = (StageTemplate *) calloc(1, sizeof(StageTemplate));
+    if (st == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    **tail = st;
+    *tail = &st->next;
+
+    char *redir = find_unexpanded(stage, "<>");
+    RedirTemplate **redir_tail = &st->redirs;
+    for (char *at = redir; at != NULL; ) {
+        RedirTemplate *r = (RedirTemplate *) calloc(1, sizeof(RedirTemplate));
+        if (r == NULL) {
+            perror("calloc");
+            return -1;
+        }
+        *redir_tail = r;
+        redir_tail = &r->next;
+        r->kind = *at;
+        r->append = *at == '>' && at[1] == '>';
+        char *name_start = at + 1 + r->append;
+        at = find_unexpanded(name_start, "<>");
+        r->name = strndup(name_start, at ? (size_t) (at - name_start) : strlen(name_start));
+        if (r->name == NULL) {
+            perror("malloc");
+            return -1;
+        }
+    }
+    if (redir != NULL) {
+        *redir = '\0';
+    }
+    if ((st->words = strdup(stage)) == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    // words with nothing to expand are split here, once
+    st->num_literal = -1;
+    if (strchr(st->words, '$') == NULL) {
+        int num_words = count_word(st->words);
+        if (num_words < 0) {
+            return -1;
+        }
+        st->literal = (char **) malloc(sizeof(char *) * (num_words + 1));
+        if (st->literal == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        extract_commands(st->literal, st->words);
+        if (num_words > 0 && st->literal[0] == NULL) {
+            return -1;
+        }
+        // extract_commands only splits at ' ', count_word at any space
+        st->num_literal = 0;
+        while (st->literal[st->num_literal] != NULL) {
+            st->num_literal++;
+        }
+    }
+    return 0;
+}
+
+
+PipelineTemplate *compile_pipeline(const char *text){
+    shell_stats.lines_parsed++;
+    PipelineTemplate *tmpl = (PipelineTemplate *) calloc(1, sizeof(PipelineTemplate));
+    char *line = strdup(text);
+    if (tmpl == NULL || line == NULL) {
+        perror("malloc");
+        free(tmpl);
+        free(line);
+        return NULL;
+    }
+    trim_leading_white_space(line);
+    char *ptr = find_comment(line);
+    if (ptr != NULL) {
+        *ptr = '\0';
+    }
+    if (line[0] == '\0') {
+        tmpl->kind = TEMPLATE_EMPTY;
+        free(line);
+        return tmpl;
+    }
+
+    // an assignment, as parse_line tells them apart; a bad name is left
+    // for parse_line to report every time the line runs
+    ptr = strchr(line, '=');
+    char *first_space = strpbrk(line, " \t");
+    if (ptr != NULL && (first_space == NULL || ptr < first_space)) {
+        *ptr = '\0';
+        bool valid = line[0] != '\0';
+        for (char *c = line; valid && *c != '\0'; c++) {
+            valid = isalpha((unsigned char) *c) || *c == '_';
+        }
+        tmpl->kind = TEMPLATE_ASSIGN;
+        if (!valid || (tmpl->name = intern(line)) == NULL ||
+            (tmpl->value = strdup(ptr + 1)) == NULL) {
+            free(line);
+            free_pipeline(tmpl);
+            return NULL;
+        }
+        free(line);
+        return tmpl;
+    }
+
+    tmpl->kind = TEMPLATE_STAGES;
+    trim_white_space(line);
+    StageTemplate **tail = &tmpl->stages;
+    for (char *stage = line; stage != NULL; ) {
+        char *bar = find_unexpanded(stage, "|");
+        if (bar != NULL) {
+            *bar = '\0';
+        }
+        if (add_stage_template(&tail, stage) == -1) {
+            free(line);
+            free_pipeline(tmpl);
+            return NULL;
+        }
+        stage = bar != NULL ? bar + 1 : NULL;
+    }
+    free(line);
+    return tmpl;
+}
+
+
+static char *expand_piece(const char *text, Variable *variables){
+    // a piece with nothing to expand is only copied
+    if (strchr(text, '$') != NULL) {
+        return replace_variables_mk_line(text, variables);
+    }
+    char *copy = strdup(text);
+    if (copy == NULL) {
+        perror("malloc");
+        return (char *) -1;
+    }
+    return copy;
+}
+
+
+static Command *instantiate_stage(const StageTemplate *st, Variable **variables){
+    /**
+     * One stage of a template with its pieces expanded, in the order
+     * parse_stage takes them. Returns the Command, NULL if the stage came
+     * out empty (as `a | | b` would be), or -1 on error.
+    */
+    char *redir_in_path = NULL;
+    Redirect *redir_out = NULL;
+    Redirect **redir_tail = &redir_out;
+    for (const RedirTemplate *r = st->redirs; r != NULL; r = r->next) {
+        char *file_name = expand_piece(r->name, *variables);
+        if (file_name == NULL || file_name == (char *) -1) {
+            free_redirects(redir_in_path, redir_out);
+            return (Command *) -1;
+        }
+        trim_white_space(file_name);
+        if (file_name[0] == '\0') {
+            ERR_PRINT(ERR_REDIR_FILE, r->kind);
+            free(file_name);
+            free_redirects(redir_in_path, redir_out);
+            return (Command *) -1;
+        }
+        if (r->kind == '<') {
+            free(redir_in_path);
+            redir_in_path = file_name;
+            continue;
+        }
+        Redirect *out = (Redirect *) malloc(sizeof(Redirect));
+        if (out == NULL) {
+            perror("malloc");
+            free(file_name);
+            free_redirects(redir_in_path, redir_out);
+            return (Command *) -1;
+        }
+        out->path = file_name;
+        out->append = r->append;
+        out->next = NULL;
+        *redir_tail = out;
+        redir_tail = &out->next;
+    }
+
+    if (st->num_literal == 0 && st->redirs == NULL) {
+        return NULL;
+    }
+    if (st->num_literal > 0) {
+        char **args = (char **) calloc(st->num_literal + 1, sizeof(char *));
+        for (int i = 0; args != NULL && i < st->num_literal; i++) {
+            if ((args[i] = strdup(st->literal[i])) == NULL) {
+                free_literal(args);
+                args = NULL;
             }
-            // setup_commands(head);
-            free(line_replaced);
-            return head;
         }
+        if (args == NULL) {
+            perror("malloc");
+            free_redirects(redir_in_path, redir_out);
+            return (Command *) -1;
+        }
+        return stage_from_args(args, st->num_literal, redir_in_path, redir_out, variables);
+    }
+
+    char *words = st->num_literal == 0 ? strdup("") :
+        replace_variables_mk_line(st->words, *variables);
+    if (words == NULL || words == (char *) -1) {
+        free_redirects(redir_in_path, redir_out);
+        return (Command *) -1;
+    }
+    if (st->redirs == NULL && count_word(words) == 0) {
+        free(words);
+        return NULL;
+    }
+    Command *cmd = stage_from_words(words, redir_in_path, redir_out, variables);
+    free(words);
+    return cmd;
+}
+
+
+static Command *instantiate_untimed(const PipelineTemplate *tmpl, Variable **variables){
+    if (tmpl->kind == TEMPLATE_EMPTY) {
+        return NULL;
+    }
+    if (tmpl->kind == TEMPLATE_ASSIGN) {
+        char *value = replace_variables_mk_line(tmpl->value, *variables);
+        if (value == NULL || value == (char *) -1) {
+            return (Command *) -1;
+        }
+        update_linked_list_variable(variables, tmpl->name, value);
+        free(value);
+        return NULL;
     }
+
+    Command *head = NULL;
+    Command **curr = &head;
+    for (const StageTemplate *st = tmpl->stages; st != NULL; st = st->next) {
+        Command *cmd = instantiate_stage(st, variables);
+        if (cmd == (Command *) -1) {
+            free_command(head);
+            return (Command *) -1;
+        }
+        if (cmd != NULL) {
+            *curr = cmd;
+            curr = &cmd->next;
+        }
+    }
+    return finish_line(head, variables);
 }
 
+
+Command *instantiate_pipeline(const PipelineTemplate *tmpl, Variable **variables){
+    if (parse_depth++ > 0) {
+        Command *commands = instantiate_untimed(tmpl, variables);
+        parse_depth--;
+        return commands;
+    }
+    uint64_t start = stats_now_ns();
+    Command *commands = instantiate_untimed(tmpl, variables);
+    shell_stats.parse_ns += stats_now_ns() - start;
+    parse_depth--;
+    glob_release_line();
+    return commands;
+}
+
+
 void extract_commands(char **args, char *str) {
     /***
      * Extract the command name and arguments from the line
@@ -414,6 +947,7 @@ void extract_commands(char **args, char *str) {
     char *line = strdup(str);
     if (line == NULL) {
         perror("malloc");
+        args[0] = NULL;
         return;
     }
     char *token = strtok_r(line, " ", &saveptr);
@@ -426,6 +960,8 @@ void extract_commands(char **args, char *str) {
                 free(args[i]);
                 i--;
             }
+            // callers see an empty argument list
+            args[0] = NULL;
             free(line);
             return;
         }
@@ -437,7 +973,7 @@ void extract_commands(char **args, char *str) {
 }
 
 Command *set_command(char **args, Variable *path, struct Command *next, uint32_t stdin_fd, uint32_t stdout_fd,
-char *redir_in_path, char *redir_out_path, uint8_t redir_append) {
+char *redir_in_path, Redirect *redir_out) {
     /***
      * We have one single command to handle, so return 
      * the Command* for this command
@@ -447,123 +983,113 @@ char *redir_in_path, char *redir_out_path, uint8_t redir_append) {
         perror("malloc");
         return (Command *) -1;
     }
-    char *cmd_name = args[0];
-    cmd -> exec_path = resolve_executable(cmd_name, path);
-    if (cmd -> exec_path == NULL) {
-        ERR_PRINT(ERR_NO_EXECU, cmd_name);
-        free(cmd);
-        return (Command *) -1;
-    }
-    args[0] = strdup(cmd -> exec_path);
+    // the name is only resolved against PATH when the line runs; until
+    // then, and for paths and builtins for good, it is just args[0]
+    cmd -> exec_path = args[0];
 
     // Set the rest of the command
     cmd -> next = next;
     cmd -> stdin_fd = stdin_fd;
     cmd -> stdout_fd = stdout_fd;
     cmd -> redir_in_path = redir_in_path;
-    cmd -> redir_out_path = redir_out_path;
-    cmd -> redir_append = redir_append;
+    cmd -> redir_out = redir_out;
+    cmd -> fanout = false;
+    cmd -> pipe_size = 0;
+    cmd -> variables = NULL;
+    cmd -> timeout_ms = 0;
+    cmd -> sched = NULL;
+    cmd -> pgid = 0;
+    cmd -> pid = 0;
+    cmd -> pidfd = -1;
+    cmd -> status = 0;
+    cmd -> started_ns = 0;
     cmd -> args = args;
     return cmd;
 }
 
-void update_linked_list_variable(Variable **variables, const char *var_name, const char *var_val) {
+static Variable *new_variable(const char *var_name, const char *var_val) {
+    Variable *var = (Variable *)malloc(sizeof(Variable));
+    if (var == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    var -> name = intern(var_name);
+    if (var -> name == NULL) {
+        free(var);
+        return NULL;
+    }
+    var -> value = strdup(var_val);
+    if (var -> value == NULL) {
+        perror("malloc");
+        free(var);
+        return NULL;
+    }
+    var -> exported = 0;
+    var -> next = NULL;
+    return var;
+}
+
+static Variable *set_variable_value(Variable *var, const char *var_val) {
+    char *value = strdup(var_val);
+    if (value == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    free(var -> value);
+    var -> value = value;
+    if (var -> exported) {
+        // children must see the new value
+        mark_environment_dirty();
+    }
+    return var;
+}
+
+Variable *update_linked_list_variable(Variable **variables, const char *var_name, const char *var_val) {
     /***
      * Update @param var_name in linkedlist @param variables if variable exists,
-     * else append it to the end of the linked list
+     * else append it to the end of the linked list.
+     * PATH is always kept at the head of the list.
+     * Returns the updated variable, or NULL on error.
     */
 
+    // names are interned, so from here on they compare by pointer
+    var_name = intern(var_name);
+    if (var_name == NULL) {
+        return NULL;
+    }
     Variable *root = *variables;
     if (root == NULL) {
         // If the linked list is empty
-        Variable *var = (Variable *)malloc(sizeof(Variable));
-        if (var == NULL) {
-            perror("malloc");
-            return;
-        }
-        var -> name = strdup(var_name);
-        if (var -> name == NULL) {
-            perror("malloc");
-            free(var);
-            return;
-        }
-        var -> value = strdup(var_val);
-        if (var -> value == NULL) {
-            perror("malloc");
-            free(var -> name);
-            free(var);
-            return;
-        }
-        var -> next = NULL;
-        *variables = var;
-        return;
+        *variables = new_variable(var_name, var_val);
+        return *variables;
     }
-    if (strcmp(var_name, "PATH") == 0) {
+    if (strcmp(var_name, PATH_VAR_NAME) == 0) {
+        if (root -> name == var_name) {
+            return set_variable_value(root, var_val);
+        }
         // Add it to beginning of the linked list
-        Variable *var = (Variable *)malloc(sizeof(Variable));
+        Variable *var = new_variable(var_name, var_val);
         if (var == NULL) {
-            perror("malloc");
-            return;
-        }
-        var -> name = strdup(var_name);
-        if (var -> name == NULL) {
-            perror("malloc");
-            free(var);
-            return;
-        }
-        var -> value = strdup(var_val);
-        if (var -> value == NULL) {
-            perror("malloc");
-            free(var -> name);
-            free(var);
-            return;
+            return NULL;
         }
         var -> next = root;
         *variables = var;
-        return;
+        return var;
     }
     while (root -> next != NULL) {
-        if (strcmp(root -> name, var_name) == 0) {
-            free(root -> value);
-            root -> value = strdup(var_val);
-            if (root -> value == NULL) {
-                perror("malloc");
-            }
-            return;
+        if (root -> name == var_name) {
+            return set_variable_value(root, var_val);
         }
         root = root -> next;
     }
     // Check the last variable
-    if (strcmp(root -> name, var_name) == 0) {
-        free(root -> value);
-        root -> value = strdup(var_val);
-        if (root -> value == NULL) {
-            perror("malloc");
-        }
-        return;
+    if (root -> name == var_name) {
+        return set_variable_value(root, var_val);
     }
 
     // If not then append it to the end of the linked list
-    Variable *var = (Variable *)malloc(sizeof(Variable));
-    if (var == NULL) {
-        perror("malloc\n");
-        return;
-    }
-    var -> name = strdup(var_name);
-    if (var -> name == NULL) {
-        perror("malloc\n");
-        free(var);
-        return;
-    }
-    var -> value = strdup(var_val);
-    if (var -> value == NULL) {
-        perror("malloc\n");
-        free(var -> name);
-        free(var);
-        return;
-    }
-    root -> next = var;
-    var -> next = NULL;
+    root -> next = new_variable(var_name, var_val);
+    return root -> next;
 }
 
 void trim_white_space(char *str) {
@@ -625,6 +1151,78 @@ void trim_leading_white_space(char *str) {
 }
 
 
+char *find_comment(const char *line) {
+    // '#' only starts a comment at the start of a word, so ${#V} is safe
+    for (const char *c = strchr(line, '#'); c != NULL; c = strchr(c + 1, '#')) {
+        if (c == line || isspace((unsigned char) c[-1])) {
+            return (char *) c;
+        }
+    }
+    return NULL;
+}
+
+
+static const char *find_closing_paren(const char *open) {
+    /**
+     * Given a pointer to '(', returns the matching ')' or NULL,
+     * so that nested $(...) stay inside their parent
+    */
+    int depth = 0;
+    for (const char *c = open; *c != '\0'; c++) {
+        if (*c == '(') {
+            depth++;
+        }
+        else if (*c == ')' && --depth == 0) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static const char *find_closing_brace(const char *open) {
+    // As find_closing_paren, for the '{' of a ${...}
+    int depth = 0;
+    for (const char *c = open; *c != '\0'; c++) {
+        if (*c == '{') {
+            depth++;
+        }
+        else if (*c == '}' && --depth == 0) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static char *expand_arith(const char *start, const char *end, Variable *variables) {
+    /**
+     * The value of the $((...)) between start and end as a heap string,
+     * or NULL on error. $VAR and $(...) inside are expanded first.
+    */
+    char *expr = strndup(start, end - start);
+    if (expr == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    char *expanded = replace_variables_mk_line(expr, variables);
+    free(expr);
+    if (expanded == NULL || expanded == (char *) -1) {
+        return NULL;
+    }
+    int64_t value;
+    int ret = eval_arith(expanded, variables, &value);
+    free(expanded);
+    if (ret == -1) {
+        return NULL;
+    }
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%" PRId64, value);
+    char *output = strdup(buf);
+    if (output == NULL) {
+        perror("malloc");
+    }
+    return output;
+}
+
 /*
 ** WARNING: this is a challenging string parsing task.
 **
@@ -636,6 +1234,56 @@ void trim_leading_white_space(char *str) {
 */
 char *replace_variables_mk_line(const char *line,
                                 Variable *variables){
+    if (expand_depth++ > 0) {
+        char *new_line = replace_variables_untimed(line, variables);
+        expand_depth--;
+        return new_line;
+    }
+    uint64_t start = stats_now_ns();
+    char *new_line = replace_variables_untimed(line, variables);
+    shell_stats.expand_ns += stats_now_ns() - start;
+    expand_depth--;
+    return new_line;
+}
+
+static bool is_special_parameter(char c){
+    return c == '?' || c == '#' || c == '@' || c == '*' || isdigit((unsigned char) c);
+}
+
+char *special_parameter(const char *name){
+    char c = name[0];
+    char number[16];
+    if (c == '?' || c == '#') {
+        int value = c == '?' ? shell_state.last_status :
+            (script_argc > 1 ? script_argc - 1 : 0);
+        snprintf(number, sizeof(number), "%d", value);
+        return strdup(number);
+    }
+    if (isdigit((unsigned char) c)) {
+        // past the last argument is empty
+        unsigned long index = strtoul(name, NULL, 10);
+        return strdup(index < (unsigned long) script_argc && script_argv != NULL ?
+                      script_argv[index] : "");
+    }
+    size_t len = 1;
+    for (int i = 1; i < script_argc; i++) {
+        len += strlen(script_argv[i]) + 1;
+    }
+    char *joined = (char *) malloc(len);
+    if (joined == NULL) {
+        return NULL;
+    }
+    char *end = joined;
+    for (int i = 1; i < script_argc; i++) {
+        end = stpcpy(end, script_argv[i]);
+        *end++ = ' ';
+    }
+    *(end > joined ? end - 1 : end) = '\0';
+    return joined;
+}
+
+static char *replace_variables_untimed(const char *line,
+                                       Variable *variables){
     // NULL terminator accounted for here
     size_t new_line_length = strlen(line) + 1;
 
@@ -648,14 +1296,114 @@ char *replace_variables_mk_line(const char *line,
     // and list of replacements in order
     parse_var_st = strchr(line, '$');
     while (parse_var_st != NULL) {
-        // Look for variable name
-        parse_var_end = parse_var_st + 1;
-        // Check if {} are used around variable name
-        bool left_brace = parse_var_st[1] == '{';
-        if (left_brace) {
-            parse_var_end++;
+        // Command substitution, replaced by the command's output
+        if (parse_var_st[1] == '(') {
+            const char *close = find_closing_paren(parse_var_st + 1);
+            if (close == NULL) {
+                ERR_PRINT(ERR_SUBST_USAGE, parse_var_st);
+                free_variable(replacements, 1);
+                return NULL;
+            }
+            char *output;
+            // $((...)) is arithmetic when it ends in '))', `$((a)*(b))`
+            // included: what is inside $( ) is then one parenthesised
+            // expression, whose outer pair is dropped if it has one
+            if (parse_var_st[2] == '(' && close[-1] == ')') {
+                output = find_closing_paren(parse_var_st + 2) == close - 1 ?
+                    expand_arith(parse_var_st + 3, close - 1, variables) :
+                    expand_arith(parse_var_st + 2, close, variables);
+            }
+            else {
+                char *sub_line = strndup(parse_var_st + 2, close - parse_var_st - 2);
+                if (sub_line == NULL) {
+                    perror("malloc");
+                    free_variable(replacements, 1);
+                    return (char *) -1;
+                }
+                output = run_substitution(sub_line, variables);
+                free(sub_line);
+            }
+            if (output == NULL) {
+                free_variable(replacements, 1);
+                return NULL;
+            }
+            *current = (Variable *)malloc(sizeof(Variable));
+            if (*current == NULL) {
+                perror("malloc");
+                free(output);
+                free_variable(replacements, 1);
+                return (char *) -1;
+            }
+            // only the output is needed; the text is found again below
+            (*current) -> name = NULL;
+            (*current) -> value = output;
+            (*current) -> exported = 0;
+            (*current) -> next = NULL;
+            current = &((*current) -> next);
+            new_line_length += strlen(output);
+            new_line_length -= close - parse_var_st + 1;
+            parse_var_st = strchr(close + 1, '$');
+            continue;
         }
 
+        // $? is the status of the last pipeline, $1... the arguments
+        if (is_special_parameter(parse_var_st[1])) {
+            char name[2] = {parse_var_st[1], '\0'};
+            char *value = special_parameter(name);
+            *current = (Variable *)malloc(sizeof(Variable));
+            if (*current == NULL || value == NULL) {
+                perror("malloc");
+                free(value);
+                free(*current);
+                *current = NULL;
+                free_variable(replacements, 1);
+                return (char *) -1;
+            }
+            (*current) -> name = NULL;
+            (*current) -> value = value;
+            (*current) -> exported = 0;
+            (*current) -> next = NULL;
+            current = &((*current) -> next);
+            new_line_length += strlen(value);
+            new_line_length -= 2;
+            parse_var_st = strchr(parse_var_st + 2, '$');
+            continue;
+        }
+
+        // ${...}, with or without an operator (see param.c)
+        if (parse_var_st[1] == '{') {
+            const char *close = find_closing_brace(parse_var_st + 1);
+            if (close == NULL) {
+                ERR_PRINT(ERR_BAD_SUBST, (int) strlen(parse_var_st + 2), parse_var_st + 2);
+                free_variable(replacements, 1);
+                return NULL;
+            }
+            char *value = expand_parameter(parse_var_st + 2, close - parse_var_st - 2,
+                                           variables);
+            if (value == NULL) {
+                free_variable(replacements, 1);
+                return NULL;
+            }
+            *current = (Variable *)malloc(sizeof(Variable));
+            if (*current == NULL) {
+                perror("malloc");
+                free(value);
+                free_variable(replacements, 1);
+                return (char *) -1;
+            }
+            (*current) -> name = NULL;
+            (*current) -> value = value;
+            (*current) -> exported = 0;
+            (*current) -> next = NULL;
+            current = &((*current) -> next);
+            new_line_length += strlen(value);
+            new_line_length -= close - parse_var_st + 1;
+            parse_var_st = strchr(close + 1, '$');
+            continue;
+        }
+
+        // Look for variable name
+        parse_var_end = parse_var_st + 1;
         while (isalpha((unsigned char)*parse_var_end) || *parse_var_end == '_') {
             parse_var_end++;
         }
@@ -665,18 +1413,7 @@ char *replace_variables_mk_line(const char *line,
         // Our var_name
         char *var_name = NULL;
 
-        if (left_brace && right_brace) {
-            var_name = (char *)malloc(parse_var_end - parse_var_st - 1);
-            if (var_name == NULL) {
-                perror("malloc");
-                free_variable(replacements, 1);
-                return (char *) -1;
-            }
-            new_line_length -= 2;
-            strncpy(var_name, parse_var_st + 2, parse_var_end - parse_var_st - 2);
-            var_name[parse_var_end - parse_var_st - 2] = '\0';
-        }
-        else if (!left_brace && !right_brace) {
+        if (!right_brace) {
             var_name = (char *)malloc(parse_var_end - parse_var_st);
             if (var_name == NULL) {
                 perror("malloc");
@@ -707,21 +1444,16 @@ char *replace_variables_mk_line(const char *line,
             free_variable(replacements, 1);
             return (char *) -1;
         }
-        (*current) -> name = strdup(var -> name);
-        if ((*current) -> name == NULL) {
-            perror("malloc");
-            free(current);
-            free_variable(replacements, 1);
-            return (char *) -1;
-        }
+        (*current) -> name = var -> name;
         (*current) -> value = strdup(var -> value);
         if ((*current) -> value == NULL) {
             perror("malloc");
-            free_variable(replacements, 1);
-            free((*current) -> name);
             free(*current);
+            *current = NULL;
+            free_variable(replacements, 1);
             return (char *) -1;
         }
+        (*current) -> exported = 0;
         (*current) -> next = NULL;
         current = &((*current) -> next);
         parse_var_st = strchr(parse_var_end, '$');
@@ -743,26 +1475,34 @@ char *replace_variables_mk_line(const char *line,
 
     // Copy the line, replacing variables
     while (*line_ptr != '\0') {
-        if ((*line_ptr == '$') && current_replacement != NULL) {
-            // Check for braces
-            bool has_braces = *(line_ptr + 1) == '{';
-            
+        if ((*line_ptr == '$') && current_replacement != NULL &&
+            *(line_ptr + 1) == '(') {
+            strcpy(new_line_ptr, current_replacement->value);
+            new_line_ptr += strlen(current_replacement->value);
+            line_ptr = find_closing_paren(line_ptr + 1) + 1;
+            current_replacement = current_replacement->next;
+        }
+        else if ((*line_ptr == '$') && current_replacement != NULL &&
+                 is_special_parameter(*(line_ptr + 1))) {
+            strcpy(new_line_ptr, current_replacement->value);
+            new_line_ptr += strlen(current_replacement->value);
+            line_ptr += 2;
+            current_replacement = current_replacement->next;
+        }
+        else if ((*line_ptr == '$') && current_replacement != NULL) {
             // Copy the replacement value
             strcpy(new_line_ptr, current_replacement->value);
             new_line_ptr += strlen(current_replacement->value);
 
-            line_ptr++;
-            if (has_braces){
-                line_ptr++; // Skip the left brace
+            if (*(line_ptr + 1) == '{') {
+                line_ptr = find_closing_brace(line_ptr + 1) + 1;
             }
-
-            // Skip the variable name in the original line
-            while (*line_ptr && (*line_ptr == '_' || isalpha((unsigned char)*line_ptr))) {
+            else {
+                // Skip the variable name in the original line
                 line_ptr++;
-            }
-
-            if (has_braces && *line_ptr == '}'){
-                line_ptr++; // Skip the right brace
+                while (*line_ptr && (*line_ptr == '_' || isalpha((unsigned char)*line_ptr))) {
+                    line_ptr++;
+                }
             }
 
             current_replacement = current_replacement->next;
@@ -782,7 +1522,7 @@ void free_variable(Variable *var, uint8_t recursive){
     Variable *next = NULL;
     while (curr != NULL) {
         next = curr -> next;
-        free(curr -> name);
+        // names are interned
         free(curr -> value);
         free(curr);
         if (!recursive) {
@@ -826,9 +1566,14 @@ Variable *find_variable(Variable *variables, const char *var_name) {
      * Find the variable with name @param var_name in the linked list
      * @param variables
     */
+    // a name that was never interned cannot belong to any variable
+    const char *name = intern_lookup(var_name);
+    if (name == NULL) {
+        return NULL;
+    }
     Variable *curr = variables;
     while (curr != NULL) {
-        if (strcmp(curr -> name, var_name) == 0) {
+        if (curr -> name == name) {
             return curr;
         }
         curr = curr -> next;
@@ -854,4 +1599,4 @@ char *extract_file_name(char *line, int start_index) {
     strncpy(file_name, line + start_index, i - start_index);
     file_name[i - start_index] = '\0';
     return file_name;
-}
\ No newline at end of file
+}
\ No newline at end of file
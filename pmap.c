@@ -0,0 +1,302 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+/*
+** `pmap [-j N] cmd ... < FILE`: N copies of cmd, each reading its own
+** part of FILE, with their outputs put back together in order.
+**
+** FILE is mapped and cut into N parts that end on a newline. Each copy
+** reads from a pipe that its part is vmspliced into straight from the
+** mapping, so the data is never copied by the shell; one epoll_wait
+** feeds every pipe as it drains. The first copy writes to pmap's stdout
+** directly; the others write into memory files that are sent after it,
+** in order, once each copy has finished.
+*/
+typedef struct PmapJob {
+    const char *data;       // the part of the file still to feed
+    size_t len;
+    int feed;               // write end of the copy's stdin, -1 once done
+    int out;                // memfd, or -1 for the first copy
+    pid_t pid;
+    uint64_t started_ns;
+    int status;
+} PmapJob;
+
+
+static size_t split_point(const char *data, size_t size, size_t at){
+    // just after the first newline at or after at, or the end
+    if (at >= size) {
+        return size;
+    }
+    const char *nl = memchr(data + at, '\n', size - at);
+    return nl != NULL ? (size_t) (nl - data) + 1 : size;
+}
+
+
+static int start_job(PmapJob *job, Command *inner, char **envp, int stdout_fd){
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return -1;
+    }
+    shell_stats.pipes_opened++;
+    // bigger pipes, fewer wakeups; not fatal if refused
+    fcntl(fds[1], F_SETPIPE_SZ, PMAP_PIPE_SIZE);
+
+    fflush(stdout);
+    job->started_ns = stats_now_ns();
+    job->pid = fork();
+    if (job->pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (job->pid == 0) {
+        inner->stdin_fd = fds[0];
+        inner->stdout_fd = job->out != -1 ? job->out : stdout_fd;
+        exec_command(inner, envp);
+    }
+    shell_stats.forks++;
+    shell_stats.execs++;
+    close(fds[0]);
+    job->feed = fds[1];
+    return 0;
+}
+
+
+static void stop_feeding(PmapJob *job, int epoll_fd){
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, job->feed, NULL);
+    close(job->feed);
+    job->feed = -1;
+}
+
+
+static int feed_jobs(PmapJob *jobs, int num_jobs){
+    /**
+     * vmsplices every part into its pipe as fast as the copies read.
+     * A copy that exits early (say, head) just stops being fed.
+    */
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    int feeding = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        struct epoll_event event = {.events = EPOLLOUT, .data.ptr = &jobs[i]};
+        if (fcntl(jobs[i].feed, F_SETFL, O_NONBLOCK) == -1 ||
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, jobs[i].feed, &event) == -1) {
+            perror("epoll_ctl");
+            close(epoll_fd);
+            return -1;
+        }
+        feeding++;
+    }
+
+    struct epoll_event events[SUPERVISE_MAX_EVENTS];
+    int ret = 0;
+    while (feeding > 0) {
+        int ready = epoll_wait(epoll_fd, events, SUPERVISE_MAX_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            ret = -1;
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            PmapJob *job = (PmapJob *) events[i].data.ptr;
+            ssize_t fed = 0;
+            if (job->len > 0) {
+                struct iovec iov = {(void *) job->data, job->len};
+                fed = vmsplice(job->feed, &iov, 1, SPLICE_F_NONBLOCK);
+            }
+            if (fed == -1 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+            if (fed > 0) {
+                job->data += fed;
+                job->len -= fed;
+            }
+            // EOF for the copy, or it is gone (EPIPE)
+            if (job->len == 0 || fed == -1) {
+                stop_feeding(job, epoll_fd);
+                feeding--;
+            }
+        }
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i].feed != -1) {
+            stop_feeding(&jobs[i], epoll_fd);
+        }
+    }
+    close(epoll_fd);
+    return ret;
+}
+
+
+static int send_output(int from, int to){
+    // the whole memory file, with sendfile, or read and write for the
+    // outputs sendfile refuses (O_APPEND)
+    off_t offset = 0;
+    struct stat st;
+    if (fstat(from, &st) == -1) {
+        perror("fstat");
+        return -1;
+    }
+    while (offset < st.st_size) {
+        ssize_t sent = sendfile(to, from, &offset, st.st_size - offset);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent == -1 && errno == EINVAL) {
+            char buf[PIPE_READ_CHUNK];
+            sent = pread(from, buf, sizeof(buf), offset);
+            if (sent > 0 && write(to, buf, sent) != sent) {
+                sent = -1;
+            }
+            offset += sent > 0 ? sent : 0;
+        }
+        if (sent <= 0) {
+            perror("write");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+static int wait_job(PmapJob *job){
+    int status;
+    struct rusage usage;
+    pid_t ret;
+    while ((ret = wait4(job->pid, &status, 0, &usage)) == -1 && errno == EINTR);
+    if (ret == -1) {
+        perror("wait4");
+        return -1;
+    }
+    stats_child_reaped(job->started_ns, &usage);
+    job->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    job->pid = 0;
+    return 0;
+}
+
+
+int run_pmap(Command *command, int num_jobs, bool grep_status, char **words){
+    if (find_builtin(words[0]) != NULL || find_function(words[0]) != NULL) {
+        ERR_PRINT(ERR_PMAP_USAGE);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(command->stdin_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        ERR_PRINT(ERR_PMAP_INPUT);
+        return -1;
+    }
+    size_t size = (size_t) st.st_size;
+    const char *data = "";
+    if (size > 0) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, command->stdin_fd, 0);
+        if (data == MAP_FAILED) {
+            perror("mmap");
+            return -1;
+        }
+        madvise((void *) data, size, MADV_SEQUENTIAL);
+    }
+
+    Command *inner = command_from_words(words, command->variables);
+    char **envp = environ;
+    if (inner != NULL && command->variables != NULL) {
+        envp = exported_environment(*command->variables);
+    }
+    if (inner == NULL || envp == NULL) {
+        free_command(inner);
+        if (size > 0) {
+            munmap((void *) data, size);
+        }
+        return -1;
+    }
+
+    // the parts, each ending on a newline; small files make fewer
+    PmapJob jobs[num_jobs];
+    int started = 0;
+    size_t start = 0;
+    int ret = 0;
+    for (int i = 0; i < num_jobs && (start < size || i == 0); i++) {
+        size_t end = i == num_jobs - 1 ? size :
+            split_point(data, size, (size_t) ((double) size * (i + 1) / num_jobs));
+        if (end <= start && size > 0) {
+            // a line longer than a part: the previous one took it
+            continue;
+        }
+        PmapJob *job = &jobs[started];
+        job->data = data + start;
+        job->len = end - start;
+        job->feed = -1;
+        job->status = 0;
+        job->out = -1;
+        if (i > 0 && (job->out = memfd_create("cscshell-pmap", MFD_CLOEXEC)) == -1) {
+            perror("memfd_create");
+            ret = -1;
+            break;
+        }
+        if (start_job(job, inner, envp, command->stdout_fd) == -1) {
+            if (job->out != -1) {
+                close(job->out);
+            }
+            ret = -1;
+            break;
+        }
+        started++;
+        start = end;
+    }
+
+    // the copies are forked already: a copy that exits early must not take
+    // the shell down with SIGPIPE while it is being fed
+    if (ret == 0) {
+        void (*old_handler)(int) = signal(SIGPIPE, SIG_IGN);
+        ret = feed_jobs(jobs, started);
+        signal(SIGPIPE, old_handler);
+    }
+    else {
+        for (int i = 0; i < started; i++) {
+            close(jobs[i].feed);
+        }
+    }
+
+    // in order: each output is complete once its copy has exited
+    int lowest = INT32_MAX, highest = 0;
+    for (int i = 0; i < started; i++) {
+        if (wait_job(&jobs[i]) == -1) {
+            ret = -1;
+        }
+        if (jobs[i].out != -1) {
+            if (ret == 0 && send_output(jobs[i].out, command->stdout_fd) == -1) {
+                ret = -1;
+            }
+            close(jobs[i].out);
+        }
+        lowest = jobs[i].status < lowest ? jobs[i].status : lowest;
+        highest = jobs[i].status > highest ? jobs[i].status : highest;
+    }
+    // the worst copy's status; with -g, as for grep, 1 from some parts is
+    // only "no match" if another part matched
+    int status = grep_status && highest <= 1 ? lowest : highest;
+
+    free_command(inner);
+    if (size > 0) {
+        munmap((void *) data, size);
+    }
+    return ret == -1 ? -1 : status;
+}
@@ -5,6 +5,7 @@
 
 #include "cscshell.h"
 
+extern char **environ;
 
 // COMPLETE
 int cd_cscshell(const char *target_dir){
@@ -30,16 +31,28 @@ int cd_cscshell(const char *target_dir){
 }
 
 
+static void exec_in_place(Command *command){
+    // Returns only if the environment could not be built
+    char **envp = environ;
+    if (command -> variables != NULL) {
+        envp = exported_environment(*command -> variables);
+        if (envp == NULL) {
+            return;
+        }
+    }
+    fflush(stdout);
+    fflush(stderr);
+    shell_stats.execs++;
+    exec_command(command, envp);
+}
+
+
 int *execute_line(Command *head){
     #ifdef DEBUG
     printf("\n***********************\n");
     printf("BEGIN: Executing line...\n");
     #endif
 
-    #ifdef DEBUG
-    printf("All children created\n");
-    #endif
-
     if (head == NULL) {
         return NULL;
     }
@@ -51,57 +64,155 @@ int *execute_line(Command *head){
         return NULL;
     }
     *ret_code = 0;
-    // Set up all the file descriptors for the commands
+
+    // The last thing a script does needs no fork: the shell becomes it.
+    // Not when the shell still has to watch it (a timeout), or it has to
+    // run in the shell itself, or a fan-out stage goes with it
+    bool exec_last = shell_state.exec_last && head -> next == NULL &&
+        head -> timeout_ms == 0 && find_builtin(head -> exec_path) == NULL &&
+        find_function(head -> exec_path) == NULL &&
+        (head -> redir_out == NULL || head -> redir_out -> next == NULL);
+    shell_state.exec_last = false;
+
+    // Nothing starts unless every stage can
+    if (resolve_line(head) == -1) {
+        *ret_code = STATUS_NOT_FOUND;
+        free_command(head);
+        return ret_code;
+    }
+
+    if (shell_state.cpuspread && spread_line_cpus(head) == -1) {
+        *ret_code = -1;
+        free_command(head);
+        return ret_code;
+    }
+
+    // --incremental: nothing to do if the outputs are up to date
+    uint64_t fingerprint;
+    if (memo_skip_line(head, &fingerprint)) {
+        free_command(head);
+        return ret_code;
+    }
+
+    // The line runs in its own process group when it has a timeout, so
+    // that running out of time kills everything the stages started
+    int timeout_ms = 0;
+    for (Command *c = head; c != NULL; c = c -> next) {
+        if (c -> timeout_ms > 0 && (timeout_ms == 0 || c -> timeout_ms < timeout_ms)) {
+            timeout_ms = c -> timeout_ms;
+        }
+    }
+    bool own_group = timeout_ms > 0;
+    pid_t pgid = 0;
+
+    // Set up all the file descriptors for the commands, starting every
+    // stage before waiting for any of them
     while (curr != NULL && *ret_code != -1) {
         if (curr -> redir_in_path) {
             // Handle input redirection
-            curr -> stdin_fd = open(curr -> redir_in_path, O_RDONLY);
+            if (curr -> stdin_fd != STDIN_FILENO) {
+                // drop the pipe from the previous stage, the file wins
+                fd_close(curr -> stdin_fd);
+            }
+            curr -> stdin_fd = open_line_file(curr -> redir_in_path, O_RDONLY);
             if (curr -> stdin_fd == -1) {
-                perror("open");
                 *ret_code = -1;
-                free_command(head);
-                return ret_code;
+                break;
             }
         }
 
-        if (curr -> next && curr -> redir_out_path) {
+        if (curr -> next == NULL && curr -> redir_out && curr -> redir_out -> next &&
+            !curr -> fanout) {
+            // Several output files: the stage writes into a pipe and the
+            // fan-out stage put behind it copies that into each of them
+            if (insert_fanout(curr) == -1) {
+                *ret_code = -1;
+                break;
+            }
+        }
+
+        if (curr -> next && curr -> redir_out) {
             // Can't have both piping and output redirection
             *ret_code = -1;
-            return ret_code;
+            break;
         }
         else if (curr -> next) {
             // Create a pipe
             int fd[2];
-            if (pipe(fd) == -1) {
-                perror("pipe");
+            if (open_line_pipe(fd, curr -> pipe_size) == -1) {
                 *ret_code = -1;
-                free_command(head);
-                return ret_code;
+                break;
             }
             curr -> stdout_fd = fd[1];
             curr -> next -> stdin_fd = fd[0];
         }
 
-        else if (curr -> redir_out_path) { 
-            // Output redirection
-            int flags = O_WRONLY | O_CREAT | (curr -> redir_append ? O_APPEND : O_TRUNC);
-            curr -> stdout_fd = open(curr -> redir_out_path, flags, 0666);
+        else if (curr -> redir_out && !curr -> fanout) { 
+            // Output redirection; a fan-out stage opens its own files
+            int flags = O_WRONLY | O_CREAT | (curr -> redir_out -> append ? O_APPEND : O_TRUNC);
+            curr -> stdout_fd = open_line_file(curr -> redir_out -> path, flags);
             if (curr -> stdout_fd == -1) {
-                perror("open");
                 *ret_code = -1;
-                free_command(head);
-                return ret_code;
+                break;
             }
         }
 
-        *ret_code = run_command(curr);
-        // Close the write end of the pipe
-        // We still leave the read end open for the next command
-        if (curr -> stdout_fd != STDOUT_FILENO) {
-            close(curr -> stdout_fd);
+        curr -> pgid = own_group ? pgid : -1;
+        if (exec_last) {
+            exec_in_place(curr);
+            *ret_code = -1;
+            break;
+        }
+        if (run_command(curr) == -1) {
+            *ret_code = -1;
+        }
+        else if (own_group && pgid == 0 && curr -> pid > 0) {
+            pgid = curr -> pid;
         }
+        // Close the write end of the pipe so the next stage sees EOF.
+        // We still leave the read end open for the next command
+        fd_close(curr -> stdout_fd);
         curr = curr -> next;
     }
+    // Whatever is left (error paths, unread pipe ends) goes with the line
+    fd_release_line();
+    #ifdef DEBUG
+    printf("All children created\n");
+    #endif
+
+    // Hand the terminal to the line's group while it runs in the foreground
+    bool took_terminal = pgid > 0 && isatty(STDIN_FILENO) &&
+        tcgetpgrp(STDIN_FILENO) == getpgrp() &&
+        tcsetpgrp(STDIN_FILENO, pgid) == 0;
+
+    // Even after a failed stage, whatever did start has to be reaped
+    supervise_line(head, pgid, timeout_ms);
+
+    if (took_terminal) {
+        // we are in the background now; SIGTTOU would stop us
+        signal(SIGTTOU, SIG_IGN);
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+        signal(SIGTTOU, SIG_DFL);
+    }
+
+    // The line's status is that of its last stage, or with pipefail
+    // that of the last stage to fail. A fan-out stage only counts if it
+    // failed to write its files
+    if (*ret_code != -1) {
+        int failed = 0;
+        for (Command *c = head; c != NULL; c = c -> next) {
+            failed = c -> status != 0 ? c -> status : failed;
+            if (!c -> fanout || c -> status != 0) {
+                *ret_code = c -> status;
+            }
+        }
+        if (shell_state.pipefail && failed != 0) {
+            *ret_code = failed;
+        }
+        if (*ret_code == 0) {
+            memo_record_line(head, fingerprint);
+        }
+    }
     #ifdef DEBUG
     printf("All children finished\n");
     #endif
@@ -139,105 +250,494 @@ int run_command(Command *command){
     }
     printf("\n");
     printf("Redir out: %s\n Redir in: %s\n",
-           command->redir_out_path, command->redir_in_path);
+           command->redir_out ? command->redir_out->path : NULL,
+           command->redir_in_path);
     printf("Stdin fd: %d | Stdout fd: %d\n",
            command->stdin_fd, command->stdout_fd);
     #endif
 
-    // FOR CD COMMAND
-    if (strcmp(command->exec_path, CD) == 0) {
-        if (command->args[1] == NULL) {
-            return cd_cscshell(NULL);
-        }
-        else {
-            return cd_cscshell(command->args[1]);
+    // Builtins (cd, export, ...) run in the shell itself, unless they
+    // feed a pipe: then a reader that has not started yet could leave
+    // them blocked on a full pipe, so they get a child like anything else.
+    // So do builtins placed with `sched`, which must not move the shell
+    builtin_fn builtin = find_builtin(command->exec_path);
+    if (builtin != NULL && command->next == NULL && command->sched == NULL) {
+        // a builtin failing is a status, not an error running the line
+        int ret = builtin(command);
+        fd_close(command -> stdin_fd);
+        command->status = ret == -1 ? 1 : ret;
+        return 0;
+    }
+    // Functions likewise, so their variables and `cd` stick
+    Function *function = builtin == NULL ? find_function(command->exec_path) : NULL;
+    if (function != NULL && command->next == NULL && command->sched == NULL) {
+        command->status = call_function(function, command);
+        fd_close(command -> stdin_fd);
+        return 0;
+    }
+
+    // Resolve the envp before forking so the cache survives in the parent
+    char **envp = environ;
+    if (command->variables != NULL) {
+        envp = exported_environment(*command->variables);
+        if (envp == NULL) {
+            return -1;
         }
     }
 
     // We create a new process to execute the command with the arguments
+    fflush(stdout);
+    command->started_ns = stats_now_ns();
     pid_t pid = fork();
     if (pid < 0) {
         perror("fork");
         return -1;
     }
-    else if (pid == 0) {
-        if (command -> stdin_fd != STDIN_FILENO) {
-            if (dup2(command -> stdin_fd, STDIN_FILENO) == -1) {
-                perror("dup2");
-                exit(-1);
+    if (pid == 0) {
+        if (command->pgid >= 0) {
+            setpgid(0, command->pgid);
+        }
+        if (command->fanout) {
+            _exit(run_fanout(command) == 0 ? 0 : 1);
+        }
+        if (builtin != NULL) {
+            if (apply_sched(command->sched) == -1) {
+                _exit(1);
             }
+            int ret = builtin(command);
+            _exit(ret == -1 ? 1 : ret);
         }
-        if (command -> stdout_fd != STDOUT_FILENO) {
-            if (dup2(command -> stdout_fd, STDOUT_FILENO) == -1) {
-                perror("dup2");
-                exit(-1);
+        if (function != NULL) {
+            if (apply_sched(command->sched) == -1) {
+                _exit(1);
             }
+            int ret = call_function(function, command);
+            fflush(stdout);
+            _exit(ret);
         }
-        signal(SIGTTOU, SIG_IGN);
-        execvp(command->exec_path, command->args);
-        perror("execvp");
-        exit(-1);
+        exec_command(command, envp);
     }
-    else {
-        // Wait for the child process to finish
-        // First close the read-end if we already read from pipe of the last command
-        if (command -> stdin_fd != STDIN_FILENO) {
-            close(command -> stdin_fd);
+
+    shell_stats.forks++;
+    if (builtin == NULL && function == NULL && !command->fanout) {
+        shell_stats.execs++;
+    }
+    // Set the group from both sides, whichever runs first wins the race
+    if (command->pgid >= 0) {
+        setpgid(pid, command->pgid ? command->pgid : pid);
+    }
+    // The child has its own copy of the read end now
+    fd_close(command -> stdin_fd);
+    command->pid = pid;
+
+    #ifdef DEBUG
+    printf("Parent process created child PID [%d] for %s\n", pid, command->exec_path);
+    #endif
+    return pid;
+}
+
+Command *command_from_words(char **words, Variable **variables){
+    // its own copy of the words, resolved like any stage
+    int num_words = 0;
+    while (words[num_words] != NULL) {
+        num_words++;
+    }
+    char **args = (char **) calloc(num_words + 1, sizeof(char *));
+    if (args == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    for (int i = 0; i < num_words; i++) {
+        args[i] = strdup(words[i]);
+        if (args[i] == NULL) {
+            perror("malloc");
+            for (int j = 0; j < i; j++) {
+                free(args[j]);
+            }
+            free(args);
+            return NULL;
         }
-        int status;
-        waitpid(pid, &status, 0);
-        if (WIFEXITED(status)) {
-            return pid;
+    }
+    Command *command = set_command(args, NULL, NULL, STDIN_FILENO, STDOUT_FILENO,
+                                   NULL, NULL);
+    if (command == (Command *) -1) {
+        for (int i = 0; i < num_words; i++) {
+            free(args[i]);
+        }
+        free(args);
+        return NULL;
+    }
+    command->variables = variables;
+    if (resolve_line(command) == -1) {
+        free_command(command);
+        return NULL;
+    }
+    return command;
+}
+
+void exec_command(Command *command, char **envp){
+    if (command -> stdin_fd != STDIN_FILENO) {
+        if (dup2(command -> stdin_fd, STDIN_FILENO) == -1) {
+            perror("dup2");
+            exit(-1);
         }
-        else if (WIFSTOPPED(status)) {
-            printf("Child stopped by signal: %d\n", WSTOPSIG(status));
-            return pid;
+    }
+    if (command -> stdout_fd != STDOUT_FILENO) {
+        if (dup2(command -> stdout_fd, STDOUT_FILENO) == -1) {
+            perror("dup2");
+            exit(-1);
         }
-        else {
-            perror("waitpid");
+    }
+    signal(SIGTTOU, SIG_IGN);
+    if (apply_sched(command -> sched) == -1) {
+        exit(-1);
+    }
+    close_inherited_fds();
+    // argv[0] is the resolved path, as it has always been
+    command->args[0] = (char *) command->exec_path;
+    execve(command->exec_path, command->args, envp);
+    perror("execve");
+    exit(-1);
+}
+
+
+int read_from_pipe(int fd, char ***args){
+    size_t cap = PIPE_READ_CHUNK;
+    size_t len = 0;
+    char *buf = (char *) malloc(cap + 1);
+    if (buf == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    // Large reads straight into a buffer that doubles when full
+    ssize_t n;
+    while ((n = read(fd, buf + len, cap - len)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERR_PRINT(ERR_READ_PIPE);
+            free(buf);
             return -1;
         }
+        len += n;
+        if (len == cap) {
+            char *grown = (char *) realloc(buf, cap * 2 + 1);
+            if (grown == NULL) {
+                perror("realloc");
+                free(buf);
+                return -1;
+            }
+            buf = grown;
+            cap *= 2;
+        }
     }
+    buf[len] = '\0';
 
-    #ifdef DEBUG
-    // printf("Parent process created child PID [%d] for %s\n", pid, command->exec_path);
-    #endif
-    return -1;
+    int num_words = count_word(buf);
+    if (num_words == -1) {
+        free(buf);
+        return -1;
+    }
+    char **words = (char **) malloc(sizeof(char *) * (num_words + 1));
+    if (words == NULL) {
+        perror("malloc");
+        free(buf);
+        return -1;
+    }
+
+    int i = 0;
+    char *saveptr;
+    for (char *token = strtok_r(buf, " \t\n\r\v\f", &saveptr); token != NULL;
+         token = strtok_r(NULL, " \t\n\r\v\f", &saveptr)) {
+        words[i] = strdup(token);
+        if (words[i] == NULL) {
+            perror("malloc");
+            while (--i >= 0) {
+                free(words[i]);
+            }
+            free(words);
+            free(buf);
+            return -1;
+        }
+        i++;
+    }
+    words[i] = NULL;
+    free(buf);
+    *args = words;
+    return i;
 }
 
-int run_script(char *file_path, Variable **root){
-    FILE *stream = fopen(file_path, "r");
-    if (stream == NULL){
-        perror("fopen");
+
+static char *join_words(char **words, int num_words){
+    size_t len = 1;
+    for (int i = 0; i < num_words; i++) {
+        len += strlen(words[i]) + 1;
+    }
+    char *joined = (char *) malloc(len);
+    if (joined == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    char *end = joined;
+    *end = '\0';
+    for (int i = 0; i < num_words; i++) {
+        if (i > 0) {
+            *end++ = ' ';
+        }
+        size_t word_len = strlen(words[i]);
+        memcpy(end, words[i], word_len + 1);
+        end += word_len;
+    }
+    return joined;
+}
+
+
+static pid_t run_list_substitution(const char *cmd_line, Variable *variables,
+                                   int *out_fd){
+    /**
+     * `$(a; b && c)`: the whole list runs in one child writing to the
+     * pipe whose read end goes to *out_fd. Returns the pid, -1 on error.
+    */
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe2");
+        return -1;
+    }
+    shell_stats.pipes_opened++;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
         return -1;
     }
+    if (pid == 0) {
+        if (dup2(fds[1], STDOUT_FILENO) == -1) {
+            perror("dup2");
+            _exit(1);
+        }
+        int status = run_line(cmd_line, &variables);
+        fflush(stdout);
+        _exit(status);
+    }
+    shell_stats.forks++;
+    close(fds[1]);
+    *out_fd = fds[0];
+    return pid;
+}
+
+char *run_substitution(const char *cmd_line, Variable *variables){
+    int out_fd;
+    pid_t pid = -1;
+    uint64_t started = 0;
+    if (is_command_list(cmd_line)) {
+        started = stats_now_ns();
+        pid = run_list_substitution(cmd_line, variables, &out_fd);
+        if (pid == -1) {
+            return NULL;
+        }
+        goto read_output;
+    }
+
+    // cut up like any other pipeline, so an expanded '|' stays in its word
+    PipelineTemplate *tmpl = compile_pipeline(cmd_line);
+    Command *head;
+    if (tmpl != NULL) {
+        head = instantiate_pipeline(tmpl, &variables);
+        free_pipeline(tmpl);
+    }
+    else {
+        char *line = strdup(cmd_line);
+        if (line == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+        head = parse_line(line, &variables);
+        free(line);
+    }
+    if (head == (Command *) -1) {
+        return NULL;
+    }
+    if (head == NULL) {
+        shell_state.subst_status = 0;
+        return strdup("");
+    }
+    // the lone command below is exec'd without going through execute_line
+    if (resolve_line(head) == -1) {
+        free_command(head);
+        return NULL;
+    }
+
+    if (head->next == NULL && head->redir_out == NULL &&
+        (find_builtin(head->exec_path) != NULL || find_function(head->exec_path) != NULL)) {
+        // Builtins and functions stay in-process: they write into a
+        // memory file
+        out_fd = memfd_create("cscshell-subst", MFD_CLOEXEC);
+        if (out_fd == -1) {
+            perror("memfd_create");
+            free_command(head);
+            return NULL;
+        }
+        head->stdout_fd = out_fd;
+        int *ret_code = execute_line(head);
+        shell_state.subst_status = ret_code == NULL || *ret_code == -1 ? 1 : *ret_code;
+        free(ret_code);
+        if (lseek(out_fd, 0, SEEK_SET) == -1) {
+            perror("lseek");
+            close(out_fd);
+            return NULL;
+        }
+    }
+    else {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            perror("pipe2");
+            free_command(head);
+            return NULL;
+        }
+        shell_stats.pipes_opened++;
+
+        char **envp = exported_environment(variables);
+        fflush(stdout);
+        started = stats_now_ns();
+        pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            close(fds[0]);
+            close(fds[1]);
+            free_command(head);
+            return NULL;
+        }
+        shell_stats.forks++;
+        if (head->next == NULL && head->redir_in_path == NULL &&
+            head->redir_out == NULL) {
+            shell_stats.execs++;
+        }
+        if (pid == 0) {
+            if (head->next == NULL && head->redir_in_path == NULL &&
+                head->redir_out == NULL && envp != NULL) {
+                // A lone command needs no shell in between
+                head->stdout_fd = fds[1];
+                exec_command(head, envp);
+            }
+            if (dup2(fds[1], STDOUT_FILENO) == -1) {
+                perror("dup2");
+                _exit(-1);
+            }
+            int *ret_code = execute_line(head);
+            _exit(ret_code == NULL || *ret_code == -1 ? 1 : *ret_code);
+        }
+        close(fds[1]);
+        free_command(head);
+        out_fd = fds[0];
+    }
+
+read_output:;
+    char **words;
+    int num_words = read_from_pipe(out_fd, &words);
+    close(out_fd);
+    // reap the child, if any, after its output has been drained
+    if (pid > 0) {
+        struct rusage usage;
+        int status;
+        if (wait4(pid, &status, 0, &usage) != -1) {
+            stats_child_reaped(started, &usage);
+            shell_state.subst_status = WIFEXITED(status) ? WEXITSTATUS(status) :
+                                       128 + WTERMSIG(status);
+        }
+    }
+    if (num_words == -1) {
+        return NULL;
+    }
+
+    char *output = join_words(words, num_words);
+    for (int i = 0; i < num_words; i++) {
+        free(words[i]);
+    }
+    free(words);
+    return output;
+}
+
+
+static int run_stream(FILE *stream, const char *file_path, Variable **root){
     char *line = (char*)malloc(MAX_SINGLE_LINE*sizeof(char));
     if (line == NULL){
         perror("malloc");
+        fclose(stream);
         return -1;
     }
     size_t len = MAX_SINGLE_LINE - 1;
     int line_length;
+    long line_number = 0;
+    int ret = 0;
+    // a compound command is run once all of its lines are in
+    char *pending = NULL;
+    // main's script or -c: only its very last line may end in an exec
+    bool exec_last = shell_state.exec_last;
+    shell_state.exec_last = false;
     while ((line_length = getline(&line, &len, stream)) != -1){
-        line[line_length - 1] = '\0'; // Remove the newline character
-        Command *commands = parse_line(line, root);
-        if (commands == (Command *) -1){
-            ERR_PRINT(ERR_PARSING_LINE);
+        line_number++;
+        if (pending == NULL) {
+            alloc_line_begin();
+        }
+        if (line[line_length - 1] == '\n'){
+            line[line_length - 1] = '\0'; // Remove the newline character
+        }
+        if (append_line(&pending, line) == -1) {
+            free(pending);
+            pending = NULL;
+            ret = -1;
+            break;
+        }
+        if (needs_more_lines(pending)) {
             continue;
         }
-        if (commands == NULL) continue;
-
-        int *last_ret_code_pt = execute_line(commands);
-        if (*last_ret_code_pt == -1){
-            ERR_PRINT(ERR_EXECUTE_LINE);
-            free(last_ret_code_pt);
-            return -1;
+        if (exec_last) {
+            // the last line, trailing blank lines aside; what is skipped
+            // here would have been run as nothing
+            int next;
+            while ((next = getc(stream)) != EOF && isspace(next));
+            shell_state.exec_last = next == EOF;
+            ungetc(next, stream);
         }
-        free(last_ret_code_pt);
+        ret = run_line(pending, root);
+        free(pending);
+        pending = NULL;
+        alloc_line_end(file_path, line_number);
+        if (shell_state.exit_requested){
+            break;
+        }
+    }
+    if (pending != NULL) {
+        // the input ended inside a compound command
+        ret = run_line(pending, root);
+        free(pending);
     }
     free(line);
     fclose(stream);
-    return 0;
+    return ret;
+}
+
+int run_script(char *file_path, Variable **root){
+    FILE *stream = fopen(file_path, "r");
+    if (stream == NULL){
+        perror("fopen");
+        return -1;
+    }
+    return run_stream(stream, file_path, root);
+}
+
+int run_command_string(const char *text, Variable **root){
+    // read-only, so fmemopen never writes through the cast
+    FILE *stream = fmemopen((void *) text, strlen(text), "r");
+    if (stream == NULL){
+        perror("fmemopen");
+        return -1;
+    }
+    return run_stream(stream, "-c", root);
 }
 
 void free_command(Command *command) {
@@ -245,9 +745,7 @@ void free_command(Command *command) {
         return;
     }
     free_command(command->next);
-    if (command->exec_path != NULL) {
-        free(command->exec_path);
-    }
+    // exec_path is either args[0] or interned
     char **args = command->args;    
     if (args != NULL) {
         for (int i=0; args[i] != NULL; i++){
@@ -258,8 +756,12 @@ void free_command(Command *command) {
     if (command->redir_in_path != NULL){
         free(command->redir_in_path);
     }
-    if (command->redir_out_path != NULL){
-        free(command->redir_out_path);
+    while (command->redir_out != NULL){
+        Redirect *next = command->redir_out->next;
+        free(command->redir_out->path);
+        free(command->redir_out);
+        command->redir_out = next;
     }
+    free(command->sched);
     free(command);
-}
\ No newline at end of file
+}
\ No newline at end of file
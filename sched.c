@@ -0,0 +1,292 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <sys/syscall.h>
+
+/*
+** Placement of children: `sched [OPTION]... cmd ...` in front of a stage,
+** or the same options in CMD_SCHED for every stage without a prefix. The
+** spec is checked while parsing and applied in the child just before it
+** execs, so a bad value is a parse error rather than a failed child.
+**
+**   -c CPUS        CPU affinity, a list such as 0,2-3
+**   -n N           add N to the niceness, as nice(1) does
+**   -i CLASS[:N]   I/O priority: idle, be:0-7 or rt:0-7
+**   -l RES=VAL     set a resource limit, soft and hard, in the units of
+**                  setrlimit(2), or "unlimited"
+*/
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+typedef struct RlimitName {
+    const char *name;
+    int resource;
+} RlimitName;
+
+static const RlimitName rlimit_names[] = {
+    {"as", RLIMIT_AS},
+    {"core", RLIMIT_CORE},
+    {"cpu", RLIMIT_CPU},
+    {"data", RLIMIT_DATA},
+    {"fsize", RLIMIT_FSIZE},
+    {"memlock", RLIMIT_MEMLOCK},
+    {"nofile", RLIMIT_NOFILE},
+    {"nproc", RLIMIT_NPROC},
+    {"stack", RLIMIT_STACK},
+    {NULL, 0}
+};
+
+
+static int parse_cpus(const char *list, cpu_set_t *cpus){
+    // 0,2-3: each item a CPU or an inclusive range
+    CPU_ZERO(cpus);
+    const char *c = list;
+    while (1) {
+        char *end;
+        long first = strtol(c, &end, 10);
+        long last = first;
+        if (end == c || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            c = end + 1;
+            last = strtol(c, &end, 10);
+            if (end == c || last < first) {
+                return -1;
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        if (*end == '\0') {
+            return 0;
+        }
+        if (*end != ',') {
+            return -1;
+        }
+        c = end + 1;
+    }
+}
+
+
+static int parse_ioprio(const char *value){
+    // returns the packed ioprio value, or -1
+    int class;
+    const char *level = strchr(value, ':');
+    size_t class_len = level ? (size_t) (level - value) : strlen(value);
+    if (class_len == 4 && strncmp(value, "idle", 4) == 0) {
+        return level == NULL ? 3 << IOPRIO_CLASS_SHIFT : -1;
+    }
+    if (class_len == 2 && strncmp(value, "rt", 2) == 0) {
+        class = 1;
+    }
+    else if (class_len == 2 && strncmp(value, "be", 2) == 0) {
+        class = 2;
+    }
+    else {
+        return -1;
+    }
+
+    long data = 4;
+    if (level != NULL) {
+        char *end;
+        data = strtol(level + 1, &end, 10);
+        if (end == level + 1 || *end != '\0' || data < 0 || data > 7) {
+            return -1;
+        }
+    }
+    return (class << IOPRIO_CLASS_SHIFT) | (int) data;
+}
+
+
+static int parse_rlimit(const char *value, SchedSpec *spec){
+    const char *eq = strchr(value, '=');
+    if (eq == NULL || spec->num_limits == SCHED_MAX_LIMITS) {
+        return -1;
+    }
+    const RlimitName *res = rlimit_names;
+    while (res->name != NULL &&
+           (strncmp(res->name, value, eq - value) != 0 ||
+            res->name[eq - value] != '\0')) {
+        res++;
+    }
+    if (res->name == NULL) {
+        return -1;
+    }
+
+    rlim_t limit = RLIM_INFINITY;
+    if (strcmp(eq + 1, "unlimited") != 0) {
+        char *end;
+        errno = 0;
+        unsigned long long parsed = strtoull(eq + 1, &end, 10);
+        if (end == eq + 1 || *end != '\0' || errno != 0 || eq[1] == '-') {
+            return -1;
+        }
+        limit = (rlim_t) parsed;
+    }
+    spec->limits[spec->num_limits].resource = res->resource;
+    spec->limits[spec->num_limits].limit.rlim_cur = limit;
+    spec->limits[spec->num_limits].limit.rlim_max = limit;
+    spec->num_limits++;
+    return 0;
+}
+
+
+int parse_sched_options(char **words, SchedSpec *spec){
+    memset(spec, 0, sizeof(SchedSpec));
+    int i = 0;
+    while (words[i] != NULL && words[i][0] == '-') {
+        char *flag = words[i];
+        char *value = words[i + 1];
+        if (flag[1] == '\0' || flag[2] != '\0' || value == NULL) {
+            ERR_PRINT(ERR_SCHED_USAGE);
+            return -1;
+        }
+
+        int bad = 0;
+        if (flag[1] == 'c') {
+            bad = parse_cpus(value, &spec->cpus);
+            spec->has_cpus = true;
+        }
+        else if (flag[1] == 'n') {
+            char *end;
+            long nice = strtol(value, &end, 10);
+            bad = end == value || *end != '\0' || nice < -40 || nice > 40;
+            spec->nice = (int) nice;
+            spec->has_nice = true;
+        }
+        else if (flag[1] == 'i') {
+            spec->ioprio = parse_ioprio(value);
+            bad = spec->ioprio == -1;
+            spec->has_ioprio = true;
+        }
+        else if (flag[1] == 'l') {
+            bad = parse_rlimit(value, spec);
+        }
+        else {
+            bad = 1;
+        }
+        if (bad) {
+            ERR_PRINT(ERR_SCHED_VALUE, flag, value);
+            return -1;
+        }
+        i += 2;
+    }
+    return i;
+}
+
+
+SchedSpec *parse_sched_var(const char *value){
+    /**
+     * CMD_SCHED holds the options alone. Returns a heap spec, NULL if the
+     * value is empty, or (SchedSpec *) -1 if it does not parse.
+    */
+    int num_words = count_word(value);
+    if (num_words <= 0) {
+        return NULL;
+    }
+    char **words = (char **) malloc(sizeof(char *) * (num_words + 1));
+    SchedSpec *spec = (SchedSpec *) malloc(sizeof(SchedSpec));
+    char *copy = strdup(value);
+    if (words == NULL || spec == NULL || copy == NULL) {
+        perror("malloc");
+        free(words);
+        free(spec);
+        free(copy);
+        return (SchedSpec *) -1;
+    }
+    char *saveptr;
+    int n = 0;
+    for (char *word = strtok_r(copy, " ", &saveptr); word != NULL && n < num_words;
+         word = strtok_r(NULL, " ", &saveptr)) {
+        words[n++] = word;
+    }
+    words[n] = NULL;
+
+    int used = parse_sched_options(words, spec);
+    if (used != n) {
+        if (used != -1) {
+            ERR_PRINT(ERR_SCHED_USAGE);
+        }
+        free(spec);
+        spec = (SchedSpec *) -1;
+    }
+    free(words);
+    free(copy);
+    return spec;
+}
+
+
+int spread_line_cpus(Command *head){
+    /**
+     * set -o cpuspread: stage i of a pipeline is pinned to the i-th CPU
+     * the shell may run on, wrapping around, unless it chose its own.
+    */
+    if (head == NULL || head->next == NULL) {
+        return 0;
+    }
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+    int num_cpus = CPU_COUNT(&allowed);
+    int cpu = -1;
+    for (Command *c = head; c != NULL && num_cpus > 0; c = c->next) {
+        // the next allowed CPU after the last one handed out
+        do {
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        } while (!CPU_ISSET(cpu, &allowed));
+
+        if (c->sched == NULL) {
+            c->sched = (SchedSpec *) calloc(1, sizeof(SchedSpec));
+            if (c->sched == NULL) {
+                perror("calloc");
+                return -1;
+            }
+        }
+        if (!c->sched->has_cpus) {
+            CPU_ZERO(&c->sched->cpus);
+            CPU_SET(cpu, &c->sched->cpus);
+            c->sched->has_cpus = true;
+        }
+    }
+    return 0;
+}
+
+
+int apply_sched(const SchedSpec *spec){
+    if (spec == NULL) {
+        return 0;
+    }
+    if (spec->has_cpus &&
+        sched_setaffinity(0, sizeof(spec->cpus), &spec->cpus) == -1) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+    errno = 0;
+    if (spec->has_nice && nice(spec->nice) == -1 && errno != 0) {
+        perror("nice");
+        return -1;
+    }
+    // glibc has no wrapper for ioprio_set
+    if (spec->has_ioprio &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, spec->ioprio) == -1) {
+        perror("ioprio_set");
+        return -1;
+    }
+    for (int i = 0; i < spec->num_limits; i++) {
+        if (setrlimit(spec->limits[i].resource, &spec->limits[i].limit) == -1) {
+            perror("setrlimit");
+            return -1;
+        }
+    }
+    return 0;
+}
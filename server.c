@@ -0,0 +1,358 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+** Shell server. `cscshell --server SOCKET` runs the init script once and
+** then serves requests on a SOCK_SEQPACKET Unix socket, forking a child
+** from that warm state for each one. `cscshell --client SOCKET ...` sends
+** one request and exits with the status it gets back.
+**
+** A request is one packet: a RequestHeader, then the NUL terminated
+** strings cwd, script path or command string, and each argument, with
+** the client's stdin, stdout and stderr attached as SCM_RIGHTS. The reply
+** is the int32_t exit status.
+**
+** Requests run as the server's user, so only that user is served: the
+** socket is mode 0600 and each peer's uid is checked with SO_PEERCRED.
+*/
+#define REQUEST_MAGIC 0x43534352u   // "CSCR"
+#define REQUEST_SCRIPT 0
+#define REQUEST_COMMAND 1
+#define REQUEST_FDS 3
+
+typedef struct RequestHeader {
+    uint32_t magic;
+    uint32_t kind;          // REQUEST_SCRIPT or REQUEST_COMMAND
+    uint32_t argc;          // strings after the script or command
+    uint32_t payload_len;
+} RequestHeader;
+
+int script_argc = 0;
+char **script_argv = NULL;
+
+
+static int remove_stale_socket(const char *socket_path, const struct sockaddr_un *addr){
+    /**
+     * A socket left behind by a server that is gone is removed. Anything
+     * else at the path, or a server still answering there, is an error.
+    */
+    struct stat st;
+    if (lstat(socket_path, &st) == -1) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        perror(socket_path);
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        ERR_PRINT(ERR_SOCKET_EXISTS, socket_path);
+        return -1;
+    }
+    int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (probe == -1) {
+        perror("socket");
+        return -1;
+    }
+    int live = connect(probe, (const struct sockaddr *) addr, sizeof(*addr)) == 0;
+    close(probe);
+    if (live) {
+        ERR_PRINT(ERR_SOCKET_IN_USE, socket_path);
+        return -1;
+    }
+    if (unlink(socket_path) == -1) {
+        perror(socket_path);
+        return -1;
+    }
+    return 0;
+}
+
+
+static int bind_server_socket(const char *socket_path){
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        ERR_PRINT(ERR_SOCKET_PATH, socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (remove_stale_socket(socket_path, &addr) == -1) {
+        close(sock);
+        return -1;
+    }
+    // created 0600 rather than chmod'ed after, so it is never open to others
+    mode_t old_mask = umask(0177);
+    int bound = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+    umask(old_mask);
+    if (bound == -1 || listen(sock, SOMAXCONN) == -1) {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+
+static int receive_request(int conn, char *payload, RequestHeader *header, int fds[REQUEST_FDS]){
+    struct iovec iov[2] = {
+        {.iov_base = header, .iov_len = sizeof(RequestHeader)},
+        {.iov_base = payload, .iov_len = SERVER_MAX_REQUEST},
+    };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * REQUEST_FDS)];
+    } control;
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t got = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    if (got == 0) {
+        // closed without a request: another server checking we are alive
+        return 1;
+    }
+    if (got < (ssize_t) sizeof(RequestHeader)) {
+        return -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int) * REQUEST_FDS)) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * REQUEST_FDS);
+
+    size_t payload_len = got - sizeof(RequestHeader);
+    if (header->magic != REQUEST_MAGIC || (msg.msg_flags & MSG_TRUNC) ||
+        header->payload_len != payload_len || payload_len == 0 ||
+        payload[payload_len - 1] != '\0') {
+        for (int i = 0; i < REQUEST_FDS; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+
+static int serve_request(int conn, Variable **root){
+    /**
+     * Runs in a child forked from the server: takes over the client's
+     * stdio and cwd, runs the request and replies with its status.
+    */
+    char *payload = (char *) malloc(SERVER_MAX_REQUEST);
+    if (payload == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    RequestHeader header;
+    int fds[REQUEST_FDS];
+    int received = receive_request(conn, payload, &header, fds);
+    if (received != 0) {
+        if (received == -1) {
+            ERR_PRINT(ERR_BAD_REQUEST);
+        }
+        free(payload);
+        return received == 1 ? 0 : -1;
+    }
+    for (int i = 0; i < REQUEST_FDS; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+
+    // cwd, then the script or command, then its arguments
+    char *end = payload + header.payload_len;
+    char *cwd = payload;
+    char *target = cwd + strlen(cwd) + 1;
+    char **args = (char **) calloc(header.argc + 2, sizeof(char *));
+    if (target >= end || args == NULL) {
+        ERR_PRINT(ERR_BAD_REQUEST);
+        free(args);
+        free(payload);
+        return -1;
+    }
+    args[0] = target;
+    char *next = target + strlen(target) + 1;
+    for (uint32_t i = 1; i <= header.argc && next < end; i++) {
+        args[i] = next;
+        next += strlen(next) + 1;
+    }
+    script_argc = header.argc + 1;
+    script_argv = args;
+
+    int32_t status;
+    if (chdir(cwd) == -1) {
+        perror("chdir");
+        status = 1;
+    }
+    else {
+        int ret = header.kind == REQUEST_COMMAND ?
+            run_command_string(target, root) : run_script(target, root);
+        status = ret < 0 ? 1 : ret;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    send(conn, &status, sizeof(status), MSG_NOSIGNAL);
+
+    script_argv = NULL;
+    free(args);
+    free(payload);
+    return 0;
+}
+
+
+int run_server(const char *socket_path, Variable **root){
+    int sock = bind_server_socket(socket_path);
+    if (sock == -1) {
+        return -1;
+    }
+
+    while (1) {
+        int conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept4");
+            break;
+        }
+        // the mode keeps others out; a peer that is not us is refused anyway
+        struct ucred cred;
+        socklen_t cred_len = sizeof(cred);
+        if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1 ||
+            cred.uid != getuid()) {
+            close(conn);
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(sock);
+            int ret = serve_request(conn, root);
+            close(conn);
+            dump_stats_on_exit();
+            exit(ret == 0 ? 0 : 1);
+        }
+        if (pid == -1) {
+            perror("fork");
+        }
+        close(conn);
+
+        // children that have finished since the last request
+        while (waitpid(-1, NULL, WNOHANG) > 0);
+    }
+    close(sock);
+    unlink(socket_path);
+    return -1;
+}
+
+
+int run_client(const char *socket_path, int argc, char **argv){
+    /**
+     * argv is `-c COMMAND [ARG]...` or `SCRIPT [ARG]...`.
+     * Returns the exit status of the request, or -1 on error.
+    */
+    uint32_t kind = REQUEST_SCRIPT;
+    if (argc > 0 && strcmp(argv[0], "-c") == 0) {
+        kind = REQUEST_COMMAND;
+        argc--;
+        argv++;
+    }
+    if (argc < 1) {
+        ERR_PRINT(ERR_CLIENT_USAGE);
+        return -1;
+    }
+
+    char *payload = (char *) malloc(SERVER_MAX_REQUEST);
+    if (payload == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    if (getcwd(payload, MAX_PATH_STR) == NULL) {
+        perror("getcwd");
+        free(payload);
+        return -1;
+    }
+    size_t len = strlen(payload) + 1;
+    for (int i = 0; i < argc; i++) {
+        // a script path is looked up relative to the client's cwd anyway
+        size_t arg_len = strlen(argv[i]) + 1;
+        if (len + arg_len > SERVER_MAX_REQUEST) {
+            ERR_PRINT(ERR_BAD_REQUEST);
+            free(payload);
+            return -1;
+        }
+        memcpy(payload + len, argv[i], arg_len);
+        len += arg_len;
+    }
+    RequestHeader header = {REQUEST_MAGIC, kind, (uint32_t) argc - 1, (uint32_t) len};
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        ERR_PRINT(ERR_SOCKET_PATH, socket_path);
+        free(payload);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror("connect");
+        if (sock != -1) {
+            close(sock);
+        }
+        free(payload);
+        return -1;
+    }
+
+    int fds[REQUEST_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    struct iovec iov[2] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = payload, .iov_len = len},
+    };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int32_t status = -1;
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) == -1) {
+        perror("sendmsg");
+    }
+    else {
+        ssize_t got;
+        while ((got = recv(sock, &status, sizeof(status), 0)) == -1 && errno == EINTR);
+        if (got != sizeof(status)) {
+            // the serving child died without replying
+            ERR_PRINT(ERR_NO_REPLY);
+            status = -1;
+        }
+    }
+    close(sock);
+    free(payload);
+    return status;
+}
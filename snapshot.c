@@ -0,0 +1,808 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+extern char **environ;
+
+/*
+** On-disk layout of a snapshot. Every offset is from the start of the file
+** and points into the string table that follows the fixed-size arrays.
+** Executables are sorted by name so lookups can bsearch the mapping as is.
+**
+** Only what the init file does is kept: each variable it assigns or
+** exports, applied over the environment of the run that loads it. The
+** environment variables it reads before assigning them are recorded with
+** their values, and a snapshot made under other values is not used.
+*/
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t num_vars;
+    uint32_t num_deps;
+    uint32_t num_dirs;
+    uint32_t num_execs;
+    uint32_t path_off;      // PATH value the executable index was built for
+    uint32_t init_off;      // absolute path of the init file
+    int64_t init_mtime_sec; // and what it was when it ran
+    int64_t init_mtime_nsec;
+    int64_t init_size;
+    uint64_t init_ino;
+} SnapshotHeader;
+
+typedef struct SnapshotDir {
+    uint32_t name_off;
+    uint32_t pad;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} SnapshotDir;
+
+typedef struct SnapshotVar {
+    uint32_t name_off;
+    uint32_t value_off;     // only if assigned
+    uint32_t exported;      // the init file exports it
+    uint32_t assigned;      // the init file assigns it
+} SnapshotVar;
+
+// an environment variable the init file read
+typedef struct SnapshotDep {
+    uint32_t name_off;
+    uint32_t value_off;
+    uint32_t present;       // 0 if it was not in the environment
+    uint32_t pad;
+} SnapshotDep;
+
+typedef struct SnapshotExec {
+    uint32_t name_off;
+    uint32_t dir;
+} SnapshotExec;
+
+// What the init file does to each variable name it mentions
+#define INIT_ASSIGNED 1
+#define INIT_EXPORTED 2
+#define INIT_DEPENDS 4      // read before the init file assigns it
+
+typedef struct InitNames {
+    const char **names;     // interned, in order of first mention
+    uint8_t *flags;
+    size_t count;
+    size_t cap;
+} InitNames;
+
+// Growable byte buffer used while writing a snapshot
+typedef struct SnapshotBuf {
+    char *data;
+    size_t len;
+    size_t cap;
+} SnapshotBuf;
+
+// The mapping stays alive for the whole run, the index points into it
+static char *snap_map = NULL;
+static size_t snap_len = 0;
+
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t len){
+    const unsigned char *bytes = (const unsigned char *) data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+static int snapshot_file_path(const char *init_file, char *out, size_t out_len,
+                              char *init_abs, struct stat *init_st){
+    /**
+     * One snapshot per init file: the name is a hash of its absolute
+     * path, so a new version replaces the old one. Fills init_abs (of
+     * MAX_PATH_STR) and *init_st for checking that it still applies.
+    */
+    if (realpath(init_file, init_abs) == NULL || stat(init_abs, init_st) == -1) {
+        return -1;
+    }
+    uint64_t key = 0xcbf29ce484222325ULL;
+    key = fnv1a(key, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    key = fnv1a(key, init_abs, strlen(init_abs) + 1);
+
+    const char *cache = getenv("XDG_CACHE_HOME");
+    int written;
+    if (cache != NULL && cache[0] == '/') {
+        written = snprintf(out, out_len, "%s/cscshell/init-%016llx.snap",
+                           cache, (unsigned long long) key);
+    }
+    else if ((cache = getenv("HOME")) != NULL) {
+        written = snprintf(out, out_len, "%s/.cache/cscshell/init-%016llx.snap",
+                           cache, (unsigned long long) key);
+    }
+    else {
+        return -1;
+    }
+    if (written < 0 || (size_t) written >= out_len) {
+        return -1;
+    }
+    return 0;
+}
+
+
+static int buf_reserve(SnapshotBuf *buf, size_t extra){
+    if (buf->len + extra <= buf->cap) {
+        return 0;
+    }
+    size_t new_cap = buf->cap ? buf->cap : 4096;
+    while (new_cap < buf->len + extra) {
+        new_cap *= 2;
+    }
+    char *grown = (char *) realloc(buf->data, new_cap);
+    if (grown == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    buf->data = grown;
+    buf->cap = new_cap;
+    return 0;
+}
+
+
+static uint32_t buf_add_string(SnapshotBuf *buf, const char *str){
+    size_t len = strlen(str) + 1;
+    if (buf_reserve(buf, len) == -1) {
+        return 0;
+    }
+    uint32_t off = (uint32_t) buf->len;
+    memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
+    return off;
+}
+
+
+static int compare_exec(const void *a, const void *b, void *strings){
+    const SnapshotExec *ea = (const SnapshotExec *) a;
+    const SnapshotExec *eb = (const SnapshotExec *) b;
+    return strcmp((const char *) strings + ea->name_off,
+                  (const char *) strings + eb->name_off);
+}
+
+
+int init_snapshot_allowed(const char *init_file){
+    /**
+     * A snapshot can only replace the init script if running it had no
+     * effect besides setting variables: assignments and export, nothing
+     * that runs programs or depends on their output. Each line has to be
+     * a single pipeline, so `A=1; touch f` or an if or loop is not pure.
+    */
+    FILE *stream = fopen(init_file, "r");
+    if (stream == NULL) {
+        return 0;
+    }
+    char *line = NULL;
+    size_t len = 0;
+    int pure = 1;
+    while (pure && getline(&line, &len, stream) != -1) {
+        char *comment = find_comment(line);
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        trim_white_space(line);
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (strstr(line, "$(") != NULL || !is_single_pipeline(line)) {
+            pure = 0;
+        }
+        else if (strncmp(line, EXPORT " ", strlen(EXPORT) + 1) == 0 ||
+                 strcmp(line, EXPORT) == 0) {
+            continue;
+        }
+        else {
+            char *eq = strchr(line, '=');
+            char *space = strpbrk(line, " \t");
+            pure = eq != NULL && (space == NULL || eq < space);
+        }
+    }
+    free(line);
+    fclose(stream);
+    return pure;
+}
+
+
+static int add_init_name(InitNames *names, const char *name, size_t len, uint8_t flag){
+    const char *interned = intern_n(name, len);
+    if (interned == NULL) {
+        return -1;
+    }
+    size_t i = 0;
+    while (i < names->count && names->names[i] != interned) {
+        i++;
+    }
+    if (i == names->count) {
+        if (names->count == names->cap) {
+            size_t new_cap = names->cap ? 2 * names->cap : 16;
+            const char **grown_names = (const char **) realloc(names->names,
+                new_cap * sizeof(char *));
+            if (grown_names == NULL) {
+                perror("realloc");
+                return -1;
+            }
+            names->names = grown_names;
+            uint8_t *grown_flags = (uint8_t *) realloc(names->flags, new_cap);
+            if (grown_flags == NULL) {
+                perror("realloc");
+                return -1;
+            }
+            names->flags = grown_flags;
+            names->cap = new_cap;
+        }
+        names->names[i] = interned;
+        names->flags[i] = 0;
+        names->count++;
+    }
+    // a read only depends on the environment until the name is assigned
+    if (flag != INIT_DEPENDS || !(names->flags[i] & INIT_ASSIGNED)) {
+        names->flags[i] |= flag;
+    }
+    return 0;
+}
+
+
+static int scan_init_line(InitNames *names, const char *line){
+    // what it reads first: `A=$A:x` depends on the A from before
+    for (const char *c = strchr(line, '$'); c != NULL; c = strchr(c + 1, '$')) {
+        const char *name = c + 1 + (c[1] == '{');
+        size_t len = 0;
+        while (isalpha((unsigned char) name[len]) || name[len] == '_') {
+            len++;
+        }
+        if (len > 0 && add_init_name(names, name, len, INIT_DEPENDS) == -1) {
+            return -1;
+        }
+    }
+
+    if (strncmp(line, EXPORT " ", strlen(EXPORT) + 1) == 0) {
+        // export NAME[=VALUE]...
+        const char *word = line + strlen(EXPORT);
+        while (*word != '\0') {
+            word += strspn(word, " \t");
+            size_t len = strcspn(word, " \t");
+            size_t name_len = strcspn(word, "= \t");
+            uint8_t flag = INIT_EXPORTED | (name_len < len ? INIT_ASSIGNED : 0);
+            if (name_len > 0 && add_init_name(names, word, name_len, flag) == -1) {
+                return -1;
+            }
+            word += len;
+        }
+        return 0;
+    }
+    const char *eq = strchr(line, '=');
+    if (eq != NULL && eq > line) {
+        return add_init_name(names, line, eq - line, INIT_ASSIGNED);
+    }
+    return 0;
+}
+
+
+static int scan_init_names(const char *init_file, InitNames *names){
+    /**
+     * The names the init file assigns, exports or reads, for an init file
+     * that init_snapshot_allowed accepted.
+    */
+    FILE *stream = fopen(init_file, "r");
+    if (stream == NULL) {
+        return -1;
+    }
+    char *line = NULL;
+    size_t len = 0;
+    int ret = 0;
+    while (ret == 0 && getline(&line, &len, stream) != -1) {
+        char *comment = find_comment(line);
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        trim_white_space(line);
+        ret = scan_init_line(names, line);
+    }
+    free(line);
+    fclose(stream);
+    return ret;
+}
+
+
+static SnapshotDir *snapshot_dirs(char *map){
+    return (SnapshotDir *) (map + sizeof(SnapshotHeader));
+}
+
+
+static SnapshotVar *snapshot_vars(char *map){
+    SnapshotHeader *header = (SnapshotHeader *) map;
+    return (SnapshotVar *) (snapshot_dirs(map) + header->num_dirs);
+}
+
+
+static SnapshotDep *snapshot_deps(char *map){
+    SnapshotHeader *header = (SnapshotHeader *) map;
+    return (SnapshotDep *) (snapshot_vars(map) + header->num_vars);
+}
+
+
+static SnapshotExec *snapshot_execs(char *map){
+    SnapshotHeader *header = (SnapshotHeader *) map;
+    return (SnapshotExec *) (snapshot_deps(map) + header->num_deps);
+}
+
+
+static bool same_init_file(const SnapshotHeader *header, const struct stat *init_st){
+    return header->init_mtime_sec == init_st->st_mtim.tv_sec &&
+        header->init_mtime_nsec == init_st->st_mtim.tv_nsec &&
+        header->init_size == init_st->st_size &&
+        header->init_ino == init_st->st_ino;
+}
+
+
+static bool string_in_map(uint32_t off, size_t strings, size_t size){
+    // the map ends in '\0', so a string starting inside it ends inside it
+    return off >= strings && off < size;
+}
+
+
+static bool snapshot_consistent(char *map, size_t size){
+    /**
+     * Whether every count and offset in the file stays inside it, so
+     * that a truncated or corrupted cache file is only a miss.
+    */
+    SnapshotHeader *header = (SnapshotHeader *) map;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        return false;
+    }
+    size_t strings = sizeof(SnapshotHeader) +
+        (size_t) header->num_dirs * sizeof(SnapshotDir) +
+        (size_t) header->num_vars * sizeof(SnapshotVar) +
+        (size_t) header->num_deps * sizeof(SnapshotDep) +
+        (size_t) header->num_execs * sizeof(SnapshotExec);
+    if (strings > size || map[size - 1] != '\0' ||
+        !string_in_map(header->path_off, strings, size) ||
+        !string_in_map(header->init_off, strings, size)) {
+        return false;
+    }
+    SnapshotDir *dirs = snapshot_dirs(map);
+    for (uint32_t i = 0; i < header->num_dirs; i++) {
+        if (!string_in_map(dirs[i].name_off, strings, size)) {
+            return false;
+        }
+    }
+    SnapshotVar *vars = snapshot_vars(map);
+    for (uint32_t i = 0; i < header->num_vars; i++) {
+        if (!string_in_map(vars[i].name_off, strings, size) ||
+            (vars[i].assigned && !string_in_map(vars[i].value_off, strings, size))) {
+            return false;
+        }
+    }
+    SnapshotDep *deps = snapshot_deps(map);
+    for (uint32_t i = 0; i < header->num_deps; i++) {
+        if (!string_in_map(deps[i].name_off, strings, size) ||
+            (deps[i].present && !string_in_map(deps[i].value_off, strings, size))) {
+            return false;
+        }
+    }
+    SnapshotExec *execs = snapshot_execs(map);
+    for (uint32_t i = 0; i < header->num_execs; i++) {
+        if (!string_in_map(execs[i].name_off, strings, size) ||
+            execs[i].dir >= header->num_dirs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static int map_snapshot(const char *snap_path, const char *init_abs,
+                        const struct stat *init_st){
+    int fd = open(snap_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return 0;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 0;
+    }
+
+    SnapshotHeader *header = (SnapshotHeader *) map;
+    if (!snapshot_consistent(map, st.st_size) ||
+        strcmp(map + header->init_off, init_abs) != 0 ||
+        !same_init_file(header, init_st)) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    // PATH directories changed since the index was built: stale
+    SnapshotDir *dirs = snapshot_dirs(map);
+    for (uint32_t i = 0; i < header->num_dirs; i++) {
+        struct stat dir_st;
+        if (stat(map + dirs[i].name_off, &dir_st) == -1 ||
+            dir_st.st_mtim.tv_sec != dirs[i].mtime_sec ||
+            dir_st.st_mtim.tv_nsec != dirs[i].mtime_nsec) {
+            munmap(map, st.st_size);
+            return 0;
+        }
+    }
+
+    // the init file would not compute the same values in this environment
+    SnapshotDep *deps = snapshot_deps(map);
+    for (uint32_t i = 0; i < header->num_deps; i++) {
+        const char *now = getenv(map + deps[i].name_off);
+        bool same = deps[i].present ?
+            now != NULL && strcmp(now, map + deps[i].value_off) == 0 : now == NULL;
+        if (!same) {
+            munmap(map, st.st_size);
+            return 0;
+        }
+    }
+
+    snap_map = map;
+    snap_len = st.st_size;
+    return 1;
+}
+
+
+int load_init_snapshot(const char *init_file, Variable **variables){
+    char snap_path[MAX_PATH_STR];
+    char init_abs[MAX_PATH_STR];
+    struct stat init_st;
+    if (snapshot_file_path(init_file, snap_path, sizeof(snap_path), init_abs, &init_st) == -1 ||
+        !map_snapshot(snap_path, init_abs, &init_st)) {
+        return 0;
+    }
+
+    // what running the init file would have done to the imported list
+    SnapshotHeader *header = (SnapshotHeader *) snap_map;
+    SnapshotVar *vars = snapshot_vars(snap_map);
+    for (uint32_t i = 0; i < header->num_vars; i++) {
+        const char *name = snap_map + vars[i].name_off;
+        Variable *var = find_variable(*variables, name);
+        if (vars[i].assigned || var == NULL) {
+            var = update_linked_list_variable(variables, name,
+                vars[i].assigned ? snap_map + vars[i].value_off : "");
+            if (var == NULL) {
+                return -1;
+            }
+        }
+        if (vars[i].exported) {
+            var->exported = 1;
+        }
+    }
+    mark_environment_dirty();
+    return 1;
+}
+
+
+static void prune_snapshots(const char *snap_path){
+    /**
+     * Removes the other snapshots in the cache directory that can never
+     * be used again: an older format, or an init file that is gone.
+    */
+    char dir_path[MAX_PATH_STR];
+    snprintf(dir_path, sizeof(dir_path), "%s", snap_path);
+    char *slash = strrchr(dir_path, '/');
+    if (slash == NULL) {
+        return;
+    }
+    *slash = '\0';
+    const char *own_name = strrchr(snap_path, '/') + 1;
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (strncmp(entry->d_name, "init-", 5) != 0 || len < 5 ||
+            strcmp(entry->d_name + len - 5, ".snap") != 0 ||
+            strcmp(entry->d_name, own_name) == 0) {
+            continue;
+        }
+        int fd = openat(dirfd(dir), entry->d_name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        SnapshotHeader header;
+        char init_abs[MAX_PATH_STR];
+        ssize_t got = pread(fd, &header, sizeof(header), 0);
+        bool stale = got != (ssize_t) sizeof(header) ||
+            memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0;
+        if (!stale) {
+            got = pread(fd, init_abs, sizeof(init_abs) - 1, header.init_off);
+            init_abs[got > 0 ? got : 0] = '\0';
+            stale = access(init_abs, F_OK) == -1 && errno == ENOENT;
+        }
+        close(fd);
+        if (stale) {
+            unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+    closedir(dir);
+}
+
+
+int save_init_snapshot(const char *init_file, Variable *variables){
+    char snap_path[MAX_PATH_STR];
+    char init_abs[MAX_PATH_STR];
+    struct stat init_st;
+    if (snapshot_file_path(init_file, snap_path, sizeof(snap_path), init_abs, &init_st) == -1) {
+        return -1;
+    }
+    Variable *path = find_variable(variables, PATH_VAR_NAME);
+    if (path == NULL) {
+        return -1;
+    }
+    InitNames names = {NULL, NULL, 0, 0};
+    if (scan_init_names(init_abs, &names) == -1) {
+        free(names.names);
+        free(names.flags);
+        return -1;
+    }
+
+    // Directory and executable tables are only known after scanning,
+    // so strings go to their own buffer and are rebased at the end
+    SnapshotBuf strings = {NULL, 0, 0};
+    SnapshotBuf dirs = {NULL, 0, 0};
+    SnapshotBuf execs = {NULL, 0, 0};
+    SnapshotBuf vars = {NULL, 0, 0};
+    SnapshotBuf deps = {NULL, 0, 0};
+    int ret = -1;
+
+    buf_add_string(&strings, "");
+    uint32_t path_off = buf_add_string(&strings, path->value);
+    uint32_t init_off = buf_add_string(&strings, init_abs);
+    uint32_t num_vars = 0, num_deps = 0, num_dirs = 0, num_execs = 0;
+
+    for (size_t i = 0; i < names.count; i++) {
+        uint8_t flags = names.flags[i];
+        Variable *var = find_variable(variables, names.names[i]);
+        if ((flags & (INIT_ASSIGNED | INIT_EXPORTED)) && var != NULL) {
+            if (buf_reserve(&vars, sizeof(SnapshotVar)) == -1) {
+                goto save_cleanup;
+            }
+            SnapshotVar *sv = (SnapshotVar *) (vars.data + vars.len);
+            sv->name_off = buf_add_string(&strings, var->name);
+            sv->value_off = flags & INIT_ASSIGNED ? buf_add_string(&strings, var->value) : 0;
+            sv->exported = (flags & INIT_EXPORTED) != 0;
+            sv->assigned = (flags & INIT_ASSIGNED) != 0;
+            vars.len += sizeof(SnapshotVar);
+            num_vars++;
+        }
+        if (flags & INIT_DEPENDS) {
+            if (buf_reserve(&deps, sizeof(SnapshotDep)) == -1) {
+                goto save_cleanup;
+            }
+            const char *value = getenv(names.names[i]);
+            SnapshotDep *sd = (SnapshotDep *) (deps.data + deps.len);
+            sd->name_off = buf_add_string(&strings, names.names[i]);
+            sd->value_off = buf_add_string(&strings, value != NULL ? value : "");
+            sd->present = value != NULL;
+            sd->pad = 0;
+            deps.len += sizeof(SnapshotDep);
+            num_deps++;
+        }
+    }
+
+    char *path_to_toke = strdup(path->value);
+    if (path_to_toke == NULL) {
+        perror("malloc");
+        goto save_cleanup;
+    }
+    char *saveptr;
+    for (char *dir_name = strtok_r(path_to_toke, ":", &saveptr); dir_name != NULL;
+         dir_name = strtok_r(NULL, ":", &saveptr)) {
+        struct stat dir_st;
+        DIR *dir = opendir(dir_name);
+        if (dir == NULL || fstat(dirfd(dir), &dir_st) == -1) {
+            if (dir != NULL) {
+                closedir(dir);
+            }
+            continue;
+        }
+
+        if (buf_reserve(&dirs, sizeof(SnapshotDir)) == -1) {
+            closedir(dir);
+            free(path_to_toke);
+            goto save_cleanup;
+        }
+        SnapshotDir *sd = (SnapshotDir *) (dirs.data + dirs.len);
+        sd->name_off = buf_add_string(&strings, dir_name);
+        sd->pad = 0;
+        sd->mtime_sec = dir_st.st_mtim.tv_sec;
+        sd->mtime_nsec = dir_st.st_mtim.tv_nsec;
+        dirs.len += sizeof(SnapshotDir);
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            // only what resolve_line would take, or the index shadows it
+            if (entry->d_name[0] == '.' || !is_executable_at(dirfd(dir), entry->d_name)) {
+                continue;
+            }
+            if (buf_reserve(&execs, sizeof(SnapshotExec)) == -1) {
+                closedir(dir);
+                free(path_to_toke);
+                goto save_cleanup;
+            }
+            SnapshotExec *se = (SnapshotExec *) (execs.data + execs.len);
+            se->name_off = buf_add_string(&strings, entry->d_name);
+            se->dir = num_dirs;
+            execs.len += sizeof(SnapshotExec);
+            num_execs++;
+        }
+        closedir(dir);
+        num_dirs++;
+    }
+    free(path_to_toke);
+
+    // Sort by name, then keep the first directory for each name,
+    // which is the one resolve_executable would have found
+    SnapshotExec *exec_arr = (SnapshotExec *) execs.data;
+    if (num_execs > 0) {
+        qsort_r(exec_arr, num_execs, sizeof(SnapshotExec), compare_exec,
+                strings.data);
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < num_execs; i++) {
+            if (kept > 0 && strcmp(strings.data + exec_arr[kept - 1].name_off,
+                                   strings.data + exec_arr[i].name_off) == 0) {
+                if (exec_arr[i].dir < exec_arr[kept - 1].dir) {
+                    exec_arr[kept - 1] = exec_arr[i];
+                }
+                continue;
+            }
+            exec_arr[kept++] = exec_arr[i];
+        }
+        num_execs = kept;
+    }
+
+    // Rebase string offsets now that the table sizes are final
+    uint32_t base = sizeof(SnapshotHeader) + num_dirs * sizeof(SnapshotDir) +
+        num_vars * sizeof(SnapshotVar) + num_deps * sizeof(SnapshotDep) +
+        num_execs * sizeof(SnapshotExec);
+    SnapshotHeader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.num_vars = num_vars;
+    header.num_deps = num_deps;
+    header.num_dirs = num_dirs;
+    header.num_execs = num_execs;
+    header.path_off = base + path_off;
+    header.init_off = base + init_off;
+    header.init_mtime_sec = init_st.st_mtim.tv_sec;
+    header.init_mtime_nsec = init_st.st_mtim.tv_nsec;
+    header.init_size = init_st.st_size;
+    header.init_ino = init_st.st_ino;
+    for (uint32_t i = 0; i < num_dirs; i++) {
+        ((SnapshotDir *) dirs.data)[i].name_off += base;
+    }
+    for (uint32_t i = 0; i < num_vars; i++) {
+        ((SnapshotVar *) vars.data)[i].name_off += base;
+        ((SnapshotVar *) vars.data)[i].value_off += base;
+    }
+    for (uint32_t i = 0; i < num_deps; i++) {
+        ((SnapshotDep *) deps.data)[i].name_off += base;
+        ((SnapshotDep *) deps.data)[i].value_off += base;
+    }
+    for (uint32_t i = 0; i < num_execs; i++) {
+        exec_arr[i].name_off += base;
+    }
+
+    // Create the cache directory, then write and rename atomically
+    char dir_path[MAX_PATH_STR];
+    strncpy(dir_path, snap_path, sizeof(dir_path));
+    for (char *slash = strchr(dir_path + 1, '/'); slash != NULL;
+         slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(dir_path, 0700);
+        *slash = '/';
+    }
+
+    char tmp_path[MAX_PATH_STR + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", snap_path, (int) getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        goto save_cleanup;
+    }
+    struct iovec parts[] = {
+        {&header, sizeof(header)},
+        {dirs.data, num_dirs * sizeof(SnapshotDir)},
+        {vars.data, num_vars * sizeof(SnapshotVar)},
+        {deps.data, num_deps * sizeof(SnapshotDep)},
+        {execs.data, num_execs * sizeof(SnapshotExec)},
+        {strings.data, strings.len},
+    };
+    size_t total = 0;
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        total += parts[i].iov_len;
+    }
+    if (writev(fd, parts, sizeof(parts) / sizeof(parts[0])) != (ssize_t) total) {
+        close(fd);
+        unlink(tmp_path);
+        goto save_cleanup;
+    }
+    close(fd);
+    if (rename(tmp_path, snap_path) == -1) {
+        unlink(tmp_path);
+        goto save_cleanup;
+    }
+
+    prune_snapshots(snap_path);
+
+    // Use the index we just built for the rest of this run as well
+    ret = map_snapshot(snap_path, init_abs, &init_st) ? 0 : -1;
+
+save_cleanup:
+    free(strings.data);
+    free(dirs.data);
+    free(execs.data);
+    free(vars.data);
+    free(deps.data);
+    free(names.names);
+    free(names.flags);
+    return ret;
+}
+
+
+char *lookup_exec_index(const char *command_name, const char *path_value){
+    if (snap_map == NULL) {
+        return NULL;
+    }
+    SnapshotHeader *header = (SnapshotHeader *) snap_map;
+    if (strcmp(snap_map + header->path_off, path_value) != 0) {
+        // PATH was changed after startup, the index does not apply
+        return NULL;
+    }
+
+    SnapshotDir *dirs = snapshot_dirs(snap_map);
+    SnapshotExec *execs = snapshot_execs(snap_map);
+
+    size_t lo = 0, hi = header->num_execs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(command_name, snap_map + execs[mid].name_off);
+        if (cmp == 0) {
+            const char *dir = snap_map + dirs[execs[mid].dir].name_off;
+            size_t dir_len = strlen(dir);
+            // +1 null term, +1 possible missing '/'
+            size_t buflen = dir_len + strlen(command_name) + 2;
+            char *exec_path = (char *) malloc(buflen);
+            if (exec_path == NULL) {
+                perror("malloc");
+                return NULL;
+            }
+            snprintf(exec_path, buflen, "%s%s%s", dir,
+                     dir_len > 0 && dir[dir_len - 1] == '/' ? "" : "/",
+                     command_name);
+            // the index is as of startup: a hit that has since moved or
+            // gone is left to the caller's own walk over PATH
+            if (!is_executable_at(AT_FDCWD, exec_path)) {
+                free(exec_path);
+                return NULL;
+            }
+            return exec_path;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return NULL;
+}
+
+
+void free_init_snapshot(void){
+    if (snap_map != NULL) {
+        munmap(snap_map, snap_len);
+        snap_map = NULL;
+        snap_len = 0;
+    }
+}
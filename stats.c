@@ -0,0 +1,101 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <malloc.h>
+#include <stddef.h>
+#include <time.h>
+
+ShellStats shell_stats;
+
+// Name and location of every counter, in report order
+static const struct {
+    const char *name;
+    size_t offset;
+} stat_fields[] = {
+    {"lines_parsed", offsetof(ShellStats, lines_parsed)},
+    {"parse_ns", offsetof(ShellStats, parse_ns)},
+    {"expand_ns", offsetof(ShellStats, expand_ns)},
+    {"resolve_calls", offsetof(ShellStats, resolve_calls)},
+    {"resolve_dir_entries", offsetof(ShellStats, resolve_dir_entries)},
+    {"forks", offsetof(ShellStats, forks)},
+    {"execs", offsetof(ShellStats, execs)},
+    {"pipes_opened", offsetof(ShellStats, pipes_opened)},
+    {"children_reaped", offsetof(ShellStats, children_reaped)},
+    {"child_wall_ns", offsetof(ShellStats, child_wall_ns)},
+    {"child_user_ns", offsetof(ShellStats, child_user_ns)},
+    {"child_sys_ns", offsetof(ShellStats, child_sys_ns)},
+    {"bytes_allocated", offsetof(ShellStats, bytes_allocated)},
+    {"lines_skipped", offsetof(ShellStats, lines_skipped)},
+};
+#define NUM_STAT_FIELDS (sizeof(stat_fields) / sizeof(stat_fields[0]))
+
+
+uint64_t stats_now_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+void stats_child_reaped(uint64_t started_ns, const struct rusage *usage){
+    shell_stats.children_reaped++;
+    shell_stats.child_wall_ns += stats_now_ns() - started_ns;
+    shell_stats.child_user_ns += usage->ru_utime.tv_sec * 1000000000ULL +
+        usage->ru_utime.tv_usec * 1000ULL;
+    shell_stats.child_sys_ns += usage->ru_stime.tv_sec * 1000000000ULL +
+        usage->ru_stime.tv_usec * 1000ULL;
+}
+
+
+static uint64_t heap_in_use(void){
+    // what the allocator currently hands out, arenas and mmap'd chunks
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+
+int write_stats(int fd, bool json){
+    // formatted up front so the report reaches fd in a single write
+    char buf[STATS_REPORT_BUF];
+    size_t len = 0;
+    uint64_t heap = heap_in_use();
+
+    len += snprintf(buf + len, sizeof(buf) - len, json ? "{" : "");
+    for (size_t i = 0; i < NUM_STAT_FIELDS; i++) {
+        unsigned long long value = *(uint64_t *)
+            ((char *) &shell_stats + stat_fields[i].offset);
+        len += snprintf(buf + len, sizeof(buf) - len,
+                        json ? "\"%s\": %llu, " : "%-20s %llu\n",
+                        stat_fields[i].name, value);
+    }
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    json ? "\"%s\": %llu}\n" : "%-20s %llu\n",
+                    "heap_bytes", (unsigned long long) heap);
+
+    if (write(fd, buf, len) != (ssize_t) len) {
+        perror("write");
+        return -1;
+    }
+    return 0;
+}
+
+
+int dump_stats_on_exit(void){
+    const char *path = getenv(STATS_ENV_NAME);
+    if (path == NULL || path[0] == '\0') {
+        return 0;
+    }
+    // one JSON object per shell, appended so a fleet can share a file
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        perror("open");
+        return -1;
+    }
+    write_stats(fd, true);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,204 @@
+/*****************************************************************************/
+/*                           CSC209-24s A3 CSCSHELL                          */
+/*       Copyright 2024 -- Demetres Kostas PhD (aka Darlene Heliokinde)      */
+/*****************************************************************************/
+
+#include "cscshell.h"
+
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+
+// One epoll instance for the life of the shell, every line reuses it
+static int epoll_fd = -1;
+
+
+int parse_duration_ms(const char *duration){
+    /**
+     * "1.5", "500ms", "30s", "2m", "1h" or "1d"; plain numbers are seconds.
+     * Returns milliseconds, 0 for no timeout, or -1 if not a duration.
+    */
+    if (duration == NULL || !(isdigit((unsigned char) duration[0]) ||
+                              duration[0] == '.')) {
+        return -1;
+    }
+    char *unit;
+    errno = 0;
+    double value = strtod(duration, &unit);
+    if (errno != 0 || unit == duration || value < 0) {
+        return -1;
+    }
+
+    double scale;
+    if (*unit == '\0' || strcmp(unit, "s") == 0) {
+        scale = 1000;
+    }
+    else if (strcmp(unit, "ms") == 0) {
+        scale = 1;
+    }
+    else if (strcmp(unit, "m") == 0) {
+        scale = 60 * 1000;
+    }
+    else if (strcmp(unit, "h") == 0) {
+        scale = 60 * 60 * 1000;
+    }
+    else if (strcmp(unit, "d") == 0) {
+        scale = 24 * 60 * 60 * 1000;
+    }
+    else {
+        return -1;
+    }
+
+    double ms = value * scale;
+    if (ms > INT32_MAX) {
+        return INT32_MAX;
+    }
+    // round up so that tiny non-zero durations do not disable the timeout
+    return (int) ms + (ms > (int) ms);
+}
+
+
+static int status_to_exit_code(int status){
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return -1;
+}
+
+
+static void reap(Command *command, bool timed_out){
+    int status;
+    struct rusage usage;
+    pid_t ret;
+    while ((ret = wait4(command->pid, &status, 0, &usage)) == -1 &&
+           errno == EINTR);
+    if (ret == -1) {
+        perror("wait4");
+        command->status = -1;
+    }
+    else {
+        stats_child_reaped(command->started_ns, &usage);
+        command->status = timed_out ? TIMEOUT_STATUS : status_to_exit_code(status);
+    }
+    command->pid = 0;
+}
+
+
+static void kill_line(Command *head, pid_t pgid, int signal){
+    if (pgid > 0) {
+        // the whole group, including anything the stages forked
+        kill(-pgid, signal);
+        return;
+    }
+    for (Command *curr = head; curr != NULL; curr = curr->next) {
+        if (curr->pid > 0) {
+            kill(curr->pid, signal);
+        }
+    }
+}
+
+
+int supervise_line(Command *head, pid_t pgid, int timeout_ms){
+    int pending = 0;
+    for (Command *curr = head; curr != NULL; curr = curr->next) {
+        if (curr->pid > 0) {
+            pending++;
+        }
+    }
+    if (pending == 0) {
+        return 0;
+    }
+
+    if (epoll_fd == -1) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    // A pidfd per child; all of them are watched by one epoll_wait
+    int watched = 0;
+    for (Command *curr = head; epoll_fd != -1 && curr != NULL; curr = curr->next) {
+        curr->pidfd = -1;
+        if (curr->pid <= 0) {
+            continue;
+        }
+        curr->pidfd = pidfd_open(curr->pid, 0);
+        if (curr->pidfd == -1) {
+            break;
+        }
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = curr};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, curr->pidfd, &event) == -1) {
+            close(curr->pidfd);
+            curr->pidfd = -1;
+            break;
+        }
+        watched++;
+    }
+
+    if (watched < pending) {
+        // no pidfd support: fall back to blocking waits, without timeouts
+        for (Command *curr = head; curr != NULL; curr = curr->next) {
+            if (curr->pidfd != -1) {
+                close(curr->pidfd);
+                curr->pidfd = -1;
+            }
+            if (curr->pid > 0) {
+                reap(curr, false);
+            }
+        }
+        return 0;
+    }
+
+    // the children were all started just now, time the line from here
+    uint64_t deadline = timeout_ms > 0 ?
+        stats_now_ns() + (uint64_t) timeout_ms * 1000000ULL : 0;
+    int stage = 0;  // 0 running, 1 sent SIGTERM, 2 sent SIGKILL
+    struct epoll_event events[SUPERVISE_MAX_EVENTS];
+
+    while (pending > 0) {
+        int wait_ms = -1;
+        if (deadline != 0) {
+            uint64_t now = stats_now_ns();
+            if (now >= deadline) {
+                if (stage == 0) {
+                    ERR_PRINT(ERR_TIMED_OUT, timeout_ms);
+                }
+                kill_line(head, pgid, stage == 0 ? SIGTERM : SIGKILL);
+                stage++;
+                deadline = stage < 2 ? now + KILL_GRACE_MS * 1000000ULL : 0;
+                continue;
+            }
+            wait_ms = (int) ((deadline - now + 999999) / 1000000);
+        }
+
+        int ready = epoll_wait(epoll_fd, events, SUPERVISE_MAX_EVENTS, wait_ms);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            Command *done = (Command *) events[i].data.ptr;
+            // closing the pidfd also takes it out of the epoll set
+            close(done->pidfd);
+            done->pidfd = -1;
+            reap(done, stage > 0);
+            pending--;
+        }
+    }
+
+    // only reached early if epoll_wait failed: do not leave zombies
+    for (Command *curr = head; curr != NULL; curr = curr->next) {
+        if (curr->pidfd != -1) {
+            close(curr->pidfd);
+            curr->pidfd = -1;
+        }
+        if (curr->pid > 0) {
+            reap(curr, stage > 0);
+        }
+    }
+    return 0;
+}